@@ -7,8 +7,16 @@ layout(location = 2) in vec3 inNormal;
 out vec3 vertexNormal;
 out vec2 tcs;
 
-uniform mat4 projMatrix;
-uniform mat4 viewMatrix;
+layout(std140) uniform Frame {
+    mat4 projMatrix;
+    mat4 viewMatrix;
+    vec4 viewPos;
+    vec4 lightDirection;
+    vec4 lightAmbient;
+    vec4 lightDiffuse;
+    vec4 lightSpecular;
+};
+
 uniform mat4 modelMatrix;
 
 void main() {
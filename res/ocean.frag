@@ -2,12 +2,6 @@
 
 uniform sampler2D tex;
 
-struct Light {
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
 in vec3 vertexNormal;
 in vec2 tcs;
 in vec3 pos;
@@ -15,15 +9,22 @@ in vec3 lightDir;
 
 out vec4 fragColor;
 
-uniform vec3 viewPos;
-uniform Light light;
+layout(std140) uniform Frame {
+    mat4 projMatrix;
+    mat4 viewMatrix;
+    vec4 viewPos;
+    vec4 lightDirection;
+    vec4 lightAmbient;
+    vec4 lightDiffuse;
+    vec4 lightSpecular;
+};
 
 uniform float heightMax = 0;
 uniform float heightMin = 0;
 
 void main() {
     vec3 norm = vertexNormal;
-    vec3 viewDir  = normalize(viewPos - pos);
+    vec3 viewDir  = normalize(viewPos.xyz - pos);
 
     vec3 ambientFactor = vec3(0.0);
     vec3 diffuseFactor = vec3(0.2);
@@ -31,7 +32,7 @@ void main() {
     vec3 skyColor = vec3(0.49, 0.73, 0.91);
 
     // Ambient color
-    vec3 ambient = light.ambient * ambientFactor;
+    vec3 ambient = lightAmbient.xyz * ambientFactor;
 
     // Height color
     vec3 shallowColor = vec3(0.0, 0.64, 0.68);
@@ -51,18 +52,18 @@ void main() {
 
     // Diffuse color
     float diff = clamp(dot(norm, lightDir), 0, 1);
-    vec3 diffuse = diffuseFactor * light.diffuse * diff;
+    vec3 diffuse = diffuseFactor * lightDiffuse.xyz * diff;
 
     // if (dot(norm, viewDir) > 0) norm = -norm;
 
     // Pseudo reflection
-    float refCoeff = clamp(pow(clamp(dot(norm, viewPos), 0, 1), 0.3), 0, 1);
+    float refCoeff = clamp(pow(clamp(dot(norm, viewPos.xyz), 0, 1), 0.3), 0, 1);
     vec3 reflectCol = (1 - refCoeff) * skyColor;
 
     // Specular color
     vec3 reflectDir = reflect(lightDir, norm);
     float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0), 64);
-    vec3 specular = light.specular * specCoeff;
+    vec3 specular = lightSpecular.xyz * specCoeff;
 
     vec3 combinedColor = ambient + diffuse + heightColor + 0.3 * reflectCol;
 
@@ -10,16 +10,22 @@ out vec2 tcs;
 out vec3 pos;
 out vec3 lightDir;
 
-uniform mat4 projMatrix;
-uniform mat4 viewMatrix;
-uniform mat4 modelMatrix;
+layout(std140) uniform Frame {
+    mat4 projMatrix;
+    mat4 viewMatrix;
+    vec4 viewPos;
+    vec4 lightDirection;
+    vec4 lightAmbient;
+    vec4 lightDiffuse;
+    vec4 lightSpecular;
+};
 
-uniform vec3 lightDirection;
+uniform mat4 modelMatrix;
 
 void main() {
     gl_Position = (projMatrix) * (viewMatrix * modelMatrix * vec4(inPosition + inDisplacement, 1.0));
     pos = vec3(modelMatrix * vec4(inPosition + inDisplacement, 1.0));
     vertexNormal = mat3(transpose(inverse(modelMatrix))) * (inNormal);
     tcs = inTexCoords;
-    lightDir = normalize(viewMatrix * vec4(lightDirection, 0.0)).xyz;
+    lightDir = normalize(viewMatrix * vec4(lightDirection.xyz, 0.0)).xyz;
 }
\ No newline at end of file
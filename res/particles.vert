@@ -0,0 +1,21 @@
+#version 330 core
+
+layout(location = 0) in vec3 inPosition;
+
+layout(std140) uniform Frame {
+    mat4 projMatrix;
+    mat4 viewMatrix;
+    vec4 viewPos;
+    vec4 lightDirection;
+    vec4 lightAmbient;
+    vec4 lightDiffuse;
+    vec4 lightSpecular;
+};
+
+uniform mat4 modelMatrix;
+uniform float pointSize;
+
+void main() {
+    gl_Position = (projMatrix) * (viewMatrix * modelMatrix * vec4(inPosition, 1.0));
+    gl_PointSize = pointSize;
+}
\ No newline at end of file
@@ -0,0 +1,12 @@
+#version 330 core
+
+// Surface picking: the grid position under each pixel, blue marks a hit
+
+in vec3 vertexNormal;
+in vec2 tcs;
+
+out vec4 fragColor;
+
+void main() {
+    fragColor = vec4(tcs, 1.0, 1.0);
+}
@@ -0,0 +1,233 @@
+#ifndef __ASYNC_WRITER_H__
+#define __ASYNC_WRITER_H__
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "utils/types.h"
+#include "utils/trace.h"
+
+// What submit-side code does when every buffer is still queued for the disk
+enum WritePolicy {
+    WRITE_BLOCK,  // Wait for the writer, output is complete but the solver stalls
+    WRITE_DROP,   // Skip this frame
+    WRITE_COARSEN // Skip this frame and double the cadence until the queue drains
+};
+
+static const uint MAX_COARSENING = 64;
+
+// A recycled output buffer, filled by the solver thread and immutable once submitted
+struct OutputBuffer {
+    std::vector<char> bytes;
+    size_t size = 0;
+
+    char* data() { return bytes.data(); }
+};
+
+// Appends buffers to one file from a dedicated thread. A fixed pool of
+// `depth` buffers bounds both the memory in flight and how far the disk may
+// fall behind; the writer takes everything queued at once and hands it to a
+// single writev, then returns the buffers to the pool.
+class AsyncWriter {
+public:
+    AsyncWriter(uint depth_ = 8, WritePolicy policy_ = WRITE_BLOCK);
+    ~AsyncWriter() { close(); }
+
+    bool open(const char* path);
+    // Writes everything still queued and closes the file
+    void close();
+
+    // Whether a frame at `step` is due for a base cadence of `every` steps,
+    // stretched while WRITE_COARSEN is backing off
+    bool due(uint step, uint every) const;
+
+    // A free buffer of at least `bytes`, or NULL if the policy drops this frame
+    OutputBuffer* acquire(size_t bytes);
+    void submit(OutputBuffer* buffer);
+
+    // Buffers on disk, frames skipped and acquires that had to wait
+    unsigned long get_written() const { return written.load(std::memory_order_relaxed); }
+    unsigned long get_dropped() const { return dropped.load(std::memory_order_relaxed); }
+    unsigned long get_stalls() const { return stalls.load(std::memory_order_relaxed); }
+    uint get_coarsening() const { return coarsening.load(std::memory_order_relaxed); }
+
+private:
+    uint depth;
+    WritePolicy policy;
+
+    int fd = -1;
+    std::thread writer;
+    std::vector<OutputBuffer> buffers;
+    std::vector<OutputBuffer*> free_buffers;
+    std::deque<OutputBuffer*> queue;
+    std::mutex mutex;
+    std::condition_variable queued, freed;
+    bool closing = false;
+    bool failed = false;
+
+    // Updated under the mutex, atomic so the getters may read them without it
+    std::atomic<unsigned long> written, dropped, stalls;
+    std::atomic<uint> coarsening; // Cadence multiplier, a power of two
+
+    void write_loop();
+};
+
+AsyncWriter::AsyncWriter(uint depth_, WritePolicy policy_): depth(std::max(depth_, 1u)), policy(policy_),
+        written(0), dropped(0), stalls(0), coarsening(1) {
+}
+
+bool AsyncWriter::open(const char* path) {
+    close();
+
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR Failed to open output file: %s!\n", path);
+        return false;
+    }
+
+    buffers.assign(depth, OutputBuffer());
+    free_buffers.clear();
+    for (uint i = 0; i < depth; i++)
+        free_buffers.push_back(&buffers[i]);
+
+    closing = failed = false;
+    written = dropped = stalls = 0;
+    coarsening = 1;
+    writer = std::thread(&AsyncWriter::write_loop, this);
+    return true;
+}
+
+void AsyncWriter::close() {
+    if (fd < 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    queued.notify_one();
+    writer.join();
+
+    ::close(fd);
+    fd = -1;
+}
+
+bool AsyncWriter::due(uint step, uint every) const {
+    return every > 0 && step % (every * coarsening.load(std::memory_order_relaxed)) == 0;
+}
+
+OutputBuffer* AsyncWriter::acquire(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (fd < 0 || failed)
+        return NULL;
+
+    if (free_buffers.empty()) {
+        if (policy != WRITE_BLOCK) {
+            dropped++;
+            if (policy == WRITE_COARSEN)
+                coarsening = std::min(coarsening * 2, MAX_COARSENING);
+            return NULL;
+        }
+        stalls++;
+        freed.wait(lock, [&]() { return !free_buffers.empty() || failed; });
+        if (failed)
+            return NULL;
+    }
+
+    OutputBuffer* buffer = free_buffers.back();
+    free_buffers.pop_back();
+    lock.unlock();
+
+    // Buffers keep their capacity, so after the first few frames this never allocates
+    if (buffer->bytes.size() < bytes)
+        buffer->bytes.resize(bytes);
+    buffer->size = bytes;
+    return buffer;
+}
+
+void AsyncWriter::submit(OutputBuffer* buffer) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(buffer);
+    }
+    queued.notify_one();
+}
+
+void AsyncWriter::write_loop() {
+    TRACE_THREAD("snapshot writer");
+    std::vector<OutputBuffer*> batch;
+    std::vector<struct iovec> iov;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queued.wait(lock, [&]() { return closing || !queue.empty(); });
+            if (queue.empty())
+                break;
+            batch.assign(queue.begin(), queue.end());
+            queue.clear();
+        }
+
+        // One syscall per IOV_MAX buffers, short writes resume where they stopped.
+        // Only buffers of chunks that made it to the file count as written.
+        TRACE_SCOPE("writev");
+        bool ok = true;
+        size_t done = 0;
+        for (size_t first = 0; first < batch.size() && ok; first += IOV_MAX) {
+            const size_t count = std::min(batch.size() - first, (size_t)IOV_MAX);
+            iov.resize(count);
+            size_t total = 0;
+            for (size_t i = 0; i < count; i++) {
+                iov[i].iov_base = batch[first + i]->data();
+                iov[i].iov_len = batch[first + i]->size;
+                total += iov[i].iov_len;
+            }
+            struct iovec* next = &iov[0];
+            size_t left = count;
+            while (total > 0) {
+                ssize_t n = writev(fd, next, left);
+                if (n < 0) {
+                    fprintf(stderr, "ERROR Failed to write output!\n");
+                    ok = false;
+                    break;
+                }
+                total -= n;
+                while (left > 0 && (size_t)n >= next->iov_len) {
+                    n -= next->iov_len;
+                    next++;
+                    left--;
+                }
+                if (left > 0) {
+                    next->iov_base = (char*)next->iov_base + n;
+                    next->iov_len -= n;
+                }
+            }
+            if (ok)
+                done += count;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < batch.size(); i++)
+                free_buffers.push_back(batch[i]);
+            written += done;
+            failed = failed || !ok;
+
+            // Caught up, ease the cadence back towards the requested one
+            if (queue.empty() && coarsening > 1)
+                coarsening = coarsening / 2;
+        }
+        freed.notify_all();
+    }
+}
+
+#endif
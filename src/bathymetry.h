@@ -0,0 +1,253 @@
+#ifndef __BATHYMETRY_H__
+#define __BATHYMETRY_H__
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "utils/types.h"
+#include "utils/thread_pool.h"
+#include "field.h"
+
+enum RasterFormat {
+    RASTER_F32, // Raw little-endian float32, needs width/height
+    RASTER_I16, // Raw little-endian int16, needs width/height
+    RASTER_PGM  // Binary PGM (P5), 8 or 16 bit big-endian
+};
+
+enum Resample {
+    RESAMPLE_BILINEAR, // Touches 4 source pixels per cell, cheapest for huge rasters
+    RESAMPLE_AREA      // Averages every source pixel under the cell footprint
+};
+
+struct BathymetryOptions {
+    RasterFormat format = RASTER_F32;
+    uint width = 0, height = 0; // Only for raw formats, PGM reads its header
+
+    Resample resample = RESAMPLE_BILINEAR;
+
+    // h_B = offset + scale * value
+    double scale = 1, offset = 0;
+
+    // Source rows streamed per tile, resident pages of finished tiles are released
+    uint tile_rows = 1024;
+};
+
+// Read-only memory map of a raster, nothing is read until a pixel is touched
+class Raster {
+public:
+    Raster(): data(NULL), map_size(0), width(0), height(0) {}
+    ~Raster() { close(); }
+
+    bool open(const char* path, const BathymetryOptions& opts);
+    void close();
+
+    double get(uint col, uint row) const;
+
+    // Hands the pages backing source rows [r0, r1) back to the kernel
+    void release_rows(uint r0, uint r1) const;
+
+    uint get_width() const { return width; }
+    uint get_height() const { return height; }
+
+private:
+    const uint8_t* data;
+    size_t map_size;
+    size_t offset;
+    uint width, height;
+    uint pixel_size;
+    RasterFormat format;
+    uint pgm_max;
+
+    bool parse_pgm_header(const char* path);
+};
+
+bool Raster::open(const char* path, const BathymetryOptions& opts) {
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR Failed to open raster: %s!\n", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "ERROR Failed to stat raster: %s!\n", path);
+        ::close(fd);
+        return false;
+    }
+    map_size = st.st_size;
+
+    void* p = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "ERROR Failed to map raster: %s!\n", path);
+        map_size = 0;
+        return false;
+    }
+    data = (const uint8_t*)p;
+
+    format = opts.format;
+    if (format == RASTER_PGM) {
+        if (!parse_pgm_header(path)) {
+            close();
+            return false;
+        }
+    }
+    else {
+        width = opts.width;
+        height = opts.height;
+        offset = 0;
+        pixel_size = (format == RASTER_F32 ? 4 : 2);
+    }
+
+    if (width == 0 || height == 0 || offset + (size_t)width * height * pixel_size > map_size) {
+        fprintf(stderr, "ERROR Raster %s is smaller than %ux%u!\n", path, width, height);
+        close();
+        return false;
+    }
+
+    // Bilinear only touches a few pixels per row, read-ahead would be wasted
+    madvise((void*)data, map_size, opts.resample == RESAMPLE_BILINEAR ? MADV_RANDOM : MADV_SEQUENTIAL);
+    return true;
+}
+
+void Raster::close() {
+    if (data != NULL)
+        munmap((void*)data, map_size);
+    data = NULL;
+    map_size = 0;
+}
+
+bool Raster::parse_pgm_header(const char* path) {
+    // "P5" <ws> width <ws> height <ws> maxval <single ws> data, '#' comments allowed
+    uint values[3];
+    size_t i = 2;
+    if (map_size < 2 || data[0] != 'P' || data[1] != '5') {
+        fprintf(stderr, "ERROR %s is not a binary PGM!\n", path);
+        return false;
+    }
+    for (uint k = 0; k < 3; k++) {
+        while (i < map_size && (isspace(data[i]) || data[i] == '#')) {
+            if (data[i] == '#') {
+                while (i < map_size && data[i] != '\n')
+                    i++;
+            }
+            else {
+                i++;
+            }
+        }
+        values[k] = 0;
+        while (i < map_size && isdigit(data[i]))
+            values[k] = values[k] * 10 + (data[i++] - '0');
+    }
+    width = values[0];
+    height = values[1];
+    pgm_max = values[2];
+    pixel_size = (pgm_max > 255 ? 2 : 1);
+    offset = i + 1;
+    return pgm_max > 0;
+}
+
+double Raster::get(uint col, uint row) const {
+    const uint8_t* p = data + offset + ((size_t)row * width + col) * pixel_size;
+    switch (format) {
+        case RASTER_F32: {
+            float f;
+            memcpy(&f, p, 4);
+            return f;
+        }
+        case RASTER_I16: {
+            int16_t s;
+            memcpy(&s, p, 2);
+            return s;
+        }
+        default:
+            return (pixel_size == 2 ? (p[0] << 8) | p[1] : p[0]);
+    }
+}
+
+void Raster::release_rows(uint r0, uint r1) const {
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = offset + (size_t)r0 * width * pixel_size;
+    size_t end = offset + (size_t)r1 * width * pixel_size;
+
+    // Only whole pages that lie entirely inside the range
+    begin = (begin + page - 1) / page * page;
+    end = end / page * page;
+    if (end > begin)
+        madvise((void*)(data + begin), end - begin, MADV_DONTNEED);
+}
+
+
+// Resamples `raster` onto the N x M grid, x runs along the raster's rows and y
+// along its columns. Threads each stream their own band of source rows.
+template<uint N, uint M, typename T>
+void resample_bathymetry(const Raster& raster, const BathymetryOptions& opts, Field<N,M,T>& h_B, ThreadPool& pool) {
+    const uint W = raster.get_width(), H = raster.get_height();
+    const double sx = (double)(H - 1) / std::max(N - 1, 1u);
+    const double sy = (double)(W - 1) / std::max(M - 1, 1u);
+
+    pool.parallel_for(0, N, [&](uint x0, uint x1) {
+        uint released = (uint)std::floor(x0 * sx);
+        for (uint x = x0; x < x1; x++) {
+            uint row_lo = H, row_hi = 0;
+            for (uint y = 0; y < M; y++) {
+                double value;
+                if (opts.resample == RESAMPLE_BILINEAR) {
+                    double r = x * sx, c = y * sy;
+                    uint r0 = std::min((uint)r, H - 1), c0 = std::min((uint)c, W - 1);
+                    uint r1 = std::min(r0 + 1, H - 1), c1 = std::min(c0 + 1, W - 1);
+                    double fr = r - r0, fc = c - c0;
+                    value = (1-fr) * ((1-fc) * raster.get(c0, r0) + fc * raster.get(c1, r0))
+                          +    fr  * ((1-fc) * raster.get(c0, r1) + fc * raster.get(c1, r1));
+                    row_lo = r0;
+                    row_hi = r1 + 1;
+                }
+                else {
+                    // Footprint of the cell, half a cell either side of its centre
+                    uint r0 = (uint)std::max(0.0, std::floor((x - 0.5) * sx + 0.5));
+                    uint r1 = (uint)std::min((double)H, std::floor((x + 0.5) * sx + 0.5) + 1);
+                    uint c0 = (uint)std::max(0.0, std::floor((y - 0.5) * sy + 0.5));
+                    uint c1 = (uint)std::min((double)W, std::floor((y + 0.5) * sy + 0.5) + 1);
+                    double sum = 0;
+                    for (uint r = r0; r < r1; r++) {
+                        for (uint c = c0; c < c1; c++)
+                            sum += raster.get(c, r);
+                    }
+                    value = sum / std::max((r1 - r0) * (c1 - c0), 1u);
+                    row_lo = r0;
+                    row_hi = r1;
+                }
+                h_B[x][y] = opts.offset + opts.scale * value;
+            }
+
+            // Rows behind this one's footprint will not be read again by this thread
+            if (row_lo >= released + opts.tile_rows) {
+                raster.release_rows(released, row_lo);
+                released = row_lo;
+            }
+            if (x + 1 == x1)
+                raster.release_rows(released, row_hi);
+        }
+    });
+}
+
+template<uint N, uint M, typename T>
+bool load_bathymetry(const char* path, const BathymetryOptions& opts, Field<N,M,T>& h_B, ThreadPool& pool) {
+    Raster raster;
+    if (!raster.open(path, opts))
+        return false;
+    resample_bathymetry(raster, opts, h_B, pool);
+    return true;
+}
+
+#endif
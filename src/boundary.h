@@ -0,0 +1,271 @@
+#ifndef __BOUNDARY_H__
+#define __BOUNDARY_H__
+
+#include <algorithm>
+#include <cmath>
+#include <leon/vector.h>
+
+#include "utils/types.h"
+#include "field.h"
+
+// Boundary conditions are template policies of the engine. After the interior
+// update of a layer, `apply` fills the outermost ring of cells (x = 0, N-1 and
+// y = 0, M-1) of the next state; the interior stencil loop never branches on it.
+// `old_*` is the state the step started from. The Vector overloads are the
+// same conditions for the 1D engine, filling cells 0 and N-1.
+//
+// Policies whose ring only reads next to itself are `tileable`: apply_tile
+// does the part of apply inside [x0, x1) x [y0, y1) for the engine's tiled
+// stepper, where a tile on an edge always holds the interior cells next to
+// its stretch of the ring.
+
+struct BoundaryContext {
+    double h_rest; // Undisturbed height of the layer's surface
+    double cx, cy; // Long-wave Courant numbers c*dt/dx and c*dt/dy
+    double dt;     // Time the step covers, rates scale with it
+};
+
+// Closed walls, no flow through or along the edge and zero-gradient height
+struct ReflectiveBoundary {
+    static const bool tileable = true;
+
+    template<uint N, uint M, typename T>
+    void apply(Field<N,M,T>& u, Field<N,M,T>& v, Field<N,M,T>& h,
+               const Field<N,M,T>& old_u, const Field<N,M,T>& old_v, const Field<N,M,T>& old_h,
+               const BoundaryContext& ctx) const {
+        apply_tile(u, v, h, old_u, old_v, old_h, ctx, 0, N, 0, M);
+    }
+
+    template<uint N, uint M, typename T>
+    void apply_tile(Field<N,M,T>& u, Field<N,M,T>& v, Field<N,M,T>& h,
+                    const Field<N,M,T>& old_u, const Field<N,M,T>& old_v, const Field<N,M,T>& old_h,
+                    const BoundaryContext& ctx, uint x0, uint x1, uint y0, uint y1) const {
+        for (uint x = x0; x < x1; x++) {
+            if (y0 == 0) {
+                u[x][0] = v[x][0] = 0;
+                h[x][0] = h[x][1];
+            }
+            if (y1 == M) {
+                u[x][M-1] = v[x][M-1] = 0;
+                h[x][M-1] = h[x][M-2];
+            }
+        }
+        for (uint y = y0; y < y1; y++) {
+            if (x0 == 0) {
+                u[0][y] = v[0][y] = 0;
+                h[0][y] = h[1][y];
+            }
+            if (x1 == N) {
+                u[N-1][y] = v[N-1][y] = 0;
+                h[N-1][y] = h[N-2][y];
+            }
+        }
+    }
+
+    template<uint N>
+    void apply(Vector<N>& u, Vector<N>& h, const Vector<N>& old_u, const Vector<N>& old_h, const BoundaryContext& ctx) const {
+        u[0] = u[N-1] = 0;
+        h[0] = h[1];
+        h[N-1] = h[N-2];
+    }
+};
+
+// Doubly periodic domain, the outer ring are halo cells mirroring the opposite
+// interior edge so the physical domain is x in [1, N-2], y in [1, M-2]
+struct PeriodicBoundary {
+    // The halo is the far side of the domain
+    static const bool tileable = false;
+
+    template<uint N, uint M, typename T>
+    void apply(Field<N,M,T>& u, Field<N,M,T>& v, Field<N,M,T>& h,
+               const Field<N,M,T>& old_u, const Field<N,M,T>& old_v, const Field<N,M,T>& old_h,
+               const BoundaryContext& ctx) const {
+        wrap(u);
+        wrap(v);
+        wrap(h);
+    }
+
+    template<uint N>
+    void apply(Vector<N>& u, Vector<N>& h, const Vector<N>& old_u, const Vector<N>& old_h, const BoundaryContext& ctx) const {
+        u[0] = u[N-2]; u[N-1] = u[1];
+        h[0] = h[N-2]; h[N-1] = h[1];
+    }
+
+    template<uint N, uint M, typename T>
+    static void wrap(Field<N,M,T>& f) {
+        for (uint y = 1; y < M-1; y++) {
+            f[0][y] = f[N-2][y];
+            f[N-1][y] = f[1][y];
+        }
+        for (uint x = 0; x < N; x++) {
+            f[x][0] = f[x][M-2];
+            f[x][M-1] = f[x][1];
+        }
+    }
+};
+
+// Open boundary with a sponge layer: inside `width` cells of the edge the
+// state is relaxed towards rest with a quadratic ramp, so outgoing waves are
+// absorbed instead of reflected back into the domain. The relaxation is a
+// rate, so a shorter step or a subcycled layer damps no more per unit time.
+struct SpongeBoundary {
+    uint width;
+    double strength; // Relaxation rate at the very edge, per unit time
+
+    SpongeBoundary(uint width_ = 8, double strength_ = 5000): width(width_), strength(strength_) {}
+
+    static const bool tileable = true;
+
+    template<uint N, uint M, typename T>
+    void apply(Field<N,M,T>& u, Field<N,M,T>& v, Field<N,M,T>& h,
+               const Field<N,M,T>& old_u, const Field<N,M,T>& old_v, const Field<N,M,T>& old_h,
+               const BoundaryContext& ctx) const {
+        apply_tile(u, v, h, old_u, old_v, old_h, ctx, 0, N, 0, M);
+    }
+
+    template<uint N, uint M, typename T>
+    void apply_tile(Field<N,M,T>& u, Field<N,M,T>& v, Field<N,M,T>& h,
+                    const Field<N,M,T>& old_u, const Field<N,M,T>& old_v, const Field<N,M,T>& old_h,
+                    const BoundaryContext& ctx, uint x0, uint x1, uint y0, uint y1) const {
+        // Zero-gradient edges, the sponge does the absorbing
+        for (uint x = x0; x < x1; x++) {
+            if (y0 == 0) {
+                u[x][0] = u[x][1]; v[x][0] = v[x][1]; h[x][0] = h[x][1];
+            }
+            if (y1 == M) {
+                u[x][M-1] = u[x][M-2]; v[x][M-1] = v[x][M-2]; h[x][M-1] = h[x][M-2];
+            }
+        }
+        for (uint y = y0; y < y1; y++) {
+            if (x0 == 0) {
+                u[0][y] = u[1][y]; v[0][y] = v[1][y]; h[0][y] = h[1][y];
+            }
+            if (x1 == N) {
+                u[N-1][y] = u[N-2][y]; v[N-1][y] = v[N-2][y]; h[N-1][y] = h[N-2][y];
+            }
+        }
+
+        // Only visit the band, full rows near x edges and the two column strips otherwise
+        const uint w = std::min(width, std::min(N, M) / 2);
+        for (uint x = x0; x < x1; x++) {
+            if (x < w || x >= N-w) {
+                for (uint y = y0; y < y1; y++)
+                    relax(u, v, h, x, y, ctx, w);
+            }
+            else {
+                for (uint y = y0; y < std::min(y1, w); y++)
+                    relax(u, v, h, x, y, ctx, w);
+                for (uint y = std::max(y0, M-w); y < y1; y++)
+                    relax(u, v, h, x, y, ctx, w);
+            }
+        }
+    }
+
+    template<uint N>
+    void apply(Vector<N>& u, Vector<N>& h, const Vector<N>& old_u, const Vector<N>& old_h, const BoundaryContext& ctx) const {
+        u[0] = u[1]; u[N-1] = u[N-2];
+        h[0] = h[1]; h[N-1] = h[N-2];
+
+        const uint w = std::min(width, N / 2);
+        for (uint d = 0; d < w; d++) {
+            const double r = double(w - d) / w;
+            const double keep = std::exp(-strength * r * r * ctx.dt);
+            u[d] *= keep;
+            u[N-1-d] *= keep;
+            h[d] = ctx.h_rest + (h[d] - ctx.h_rest) * keep;
+            h[N-1-d] = ctx.h_rest + (h[N-1-d] - ctx.h_rest) * keep;
+        }
+    }
+
+private:
+    template<uint N, uint M, typename T>
+    void relax(Field<N,M,T>& u, Field<N,M,T>& v, Field<N,M,T>& h, uint x, uint y, const BoundaryContext& ctx, uint w) const {
+        const uint d = std::min(std::min(x, N-1-x), std::min(y, M-1-y));
+        const double r = double(w - d) / w;
+        const double keep = std::exp(-strength * r * r * ctx.dt);
+        u[x][y] *= keep;
+        v[x][y] *= keep;
+        h[x][y] = ctx.h_rest + (h[x][y] - ctx.h_rest) * keep;
+    }
+};
+
+// Orlanski/Sommerfeld radiation condition, waves leave the edge cells at the
+// long-wave speed: phi_edge' = phi_edge - C * (phi_edge - phi_inner)
+struct RadiationBoundary {
+    static const bool tileable = true;
+
+    template<uint N, uint M, typename T>
+    void apply(Field<N,M,T>& u, Field<N,M,T>& v, Field<N,M,T>& h,
+               const Field<N,M,T>& old_u, const Field<N,M,T>& old_v, const Field<N,M,T>& old_h,
+               const BoundaryContext& ctx) const {
+        apply_tile(u, v, h, old_u, old_v, old_h, ctx, 0, N, 0, M);
+    }
+
+    template<uint N, uint M, typename T>
+    void apply_tile(Field<N,M,T>& u, Field<N,M,T>& v, Field<N,M,T>& h,
+                    const Field<N,M,T>& old_u, const Field<N,M,T>& old_v, const Field<N,M,T>& old_h,
+                    const BoundaryContext& ctx, uint x0, uint x1, uint y0, uint y1) const {
+        const double cx = std::min(ctx.cx, 1.0);
+        const double cy = std::min(ctx.cy, 1.0);
+        for (uint x = std::max(x0, 1u); x < std::min(x1, N-1); x++) {
+            if (y0 == 0) {
+                radiate(h, old_h, x, 0, x, 1, cy);
+                radiate(v, old_v, x, 0, x, 1, cy);
+                u[x][0] = u[x][1];
+            }
+            if (y1 == M) {
+                radiate(h, old_h, x, M-1, x, M-2, cy);
+                radiate(v, old_v, x, M-1, x, M-2, cy);
+                u[x][M-1] = u[x][M-2];
+            }
+        }
+        for (uint y = std::max(y0, 1u); y < std::min(y1, M-1); y++) {
+            if (x0 == 0) {
+                radiate(h, old_h, 0, y, 1, y, cx);
+                radiate(u, old_u, 0, y, 1, y, cx);
+                v[0][y] = v[1][y];
+            }
+            if (x1 == N) {
+                radiate(h, old_h, N-1, y, N-2, y, cx);
+                radiate(u, old_u, N-1, y, N-2, y, cx);
+                v[N-1][y] = v[N-2][y];
+            }
+        }
+
+        // Corners average the two edges next to them
+        const uint cxs[2] = { 0, N-1 }, cys[2] = { 0, M-1 };
+        for (uint a = 0; a < 2; a++) {
+            for (uint b = 0; b < 2; b++) {
+                const uint x = cxs[a], y = cys[b];
+                if (x >= x0 && x < x1 && y >= y0 && y < y1) {
+                    const uint xi = (x == 0 ? 1 : N-2), yi = (y == 0 ? 1 : M-2);
+                    corner(u, x, y, xi, yi);
+                    corner(v, x, y, xi, yi);
+                    corner(h, x, y, xi, yi);
+                }
+            }
+        }
+    }
+
+    template<uint N>
+    void apply(Vector<N>& u, Vector<N>& h, const Vector<N>& old_u, const Vector<N>& old_h, const BoundaryContext& ctx) const {
+        const double c = std::min(ctx.cx, 1.0);
+        h[0] = old_h[0] - c * (old_h[0] - old_h[1]);
+        h[N-1] = old_h[N-1] - c * (old_h[N-1] - old_h[N-2]);
+        u[0] = old_u[0] - c * (old_u[0] - old_u[1]);
+        u[N-1] = old_u[N-1] - c * (old_u[N-1] - old_u[N-2]);
+    }
+
+private:
+    template<uint N, uint M, typename T>
+    static void radiate(Field<N,M,T>& f, const Field<N,M,T>& old_f, uint x, uint y, uint xi, uint yi, double c) {
+        f[x][y] = old_f[x][y] - c * (old_f[x][y] - old_f[xi][yi]);
+    }
+
+    template<uint N, uint M, typename T>
+    static void corner(Field<N,M,T>& f, uint x, uint y, uint xi, uint yi) {
+        f[x][y] = 0.5 * (f[xi][y] + f[x][yi]);
+    }
+};
+
+#endif
@@ -0,0 +1,513 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "utils/types.h"
+#include "field.h"
+#include "scenario.h"
+#include "boundary.h"
+#include "integrator.h"
+#include "shallow_water_engine.h"
+#include "shallow_water_1d.h"
+
+// Error against cost of every solver variant on problems with a known answer,
+// run at successive resolutions and time steps.
+//
+// Grids are template parameters, so the resolutions are compiled in. Each
+// problem is posed in its own units, X along the grid and tau in time, in
+// which every run solves the same equations: the engines' derivatives are
+// undivided differences over 1/N (twice the derivative for the one-level
+// schemes, kernels.h) and the grid spans N-1 cells, so dt and damp are scaled
+// per grid and scheme to match.
+
+static const double PI = 3.14159265358979323846;
+
+// Step of the problem time an engine step covers, per unit of N * dX
+template<typename Integrator>
+struct TimeScale { static constexpr double value = 2; };
+// Leapfrog spans two steps with the same difference
+template<>
+struct TimeScale<Leapfrog> { static constexpr double value = 1; };
+
+// Largest stable step in problem time for waves of speed c on spacing dX in
+// `dims` dimensions, the runs take fractions of it
+template<typename Integrator>
+double stable_dtau(double dX, double c, double damp, uint dims);
+
+// Centred forward Euler grows every wave by (w dtau)^2 / 2 a step, only the
+// momentum damping holds the shortest ones back, so it only runs problems
+// that have some
+template<>
+double stable_dtau<ForwardEuler>(double dX, double c, double damp, uint dims) {
+    return damp * dX*dX / (dims * c*c);
+}
+
+template<>
+double stable_dtau<Leapfrog>(double dX, double c, double damp, uint dims) {
+    return dX / (sqrt(dims) * c);
+}
+
+// The gravity waves carry no limit, Courant number 4 is where its first order
+// time error usually stops paying for the solve
+template<>
+double stable_dtau<SemiImplicit>(double dX, double c, double damp, uint dims) {
+    return 4 * dX / c;
+}
+
+static const double FRACTIONS[] = { 0.5, 0.25, 0.125 };
+static const uint FRACTION_COUNT = 3;
+
+// The 2D bump has no closed form, its runs are measured against this grid.
+// The explicit step it runs at is already of order dx^2, so the largest
+// fraction of it does.
+static const uint REFERENCE_GRID = 193;
+
+// Errors at or above the problem's amplitude say nothing about the scheme
+static const double DIVERGED_ERROR = 1;
+
+// One run of one variant
+struct Run {
+    std::string problem;
+    std::string variant;
+    uint grid;
+    double dx;         // Grid spacing in problem units
+    double fraction;   // Of the variant's stable step
+    double dtau;       // Step in problem time
+    uint steps;
+    double dt, damp;   // What a scenario needs to repeat it
+    double seconds;    // CPU time of the steps alone
+    double l1, l2, linf; // Of the surface, relative to the problem's amplitude
+    double order;      // Observed L2 order against the next coarser grid
+    const char* status;
+};
+
+// A single layer over a flat floor between reflective walls. X runs over
+// (x - offset) / (N - 1 - 2 offset), so offset 0.5 puts 0 and 1 on the walls
+// the zero-gradient surface sees.
+struct Problem {
+    const char* name;
+    double g, h0;
+    double amplitude; // Errors are relative to it
+    double damp;      // Momentum damping per unit of tau
+    double tau_end;
+    double speed;     // Fastest wave, for the stable step
+    double offset;
+    // Surface above h0 at (X, Y) and tau, NAN past tau 0 if not known
+    double (*surface)(const Problem& p, double X, double Y, double tau);
+};
+
+inline double grid_spacing(const Problem& p, uint n) {
+    return 1.0 / (n - 1 - 2*p.offset);
+}
+
+// Linear standing wave cos(pi X) cos(pi Y) of the closed basin, damped:
+// A'' + damp A' + c^2 k^2 A = 0 with A(0) = amplitude and A'(0) = 0
+static double standing_wave(const Problem& p, double X, double Y, double tau) {
+    const double k2 = 2 * PI*PI;
+    const double w = sqrt(p.g * p.h0 * k2 - p.damp*p.damp / 4);
+    const double a = p.amplitude * exp(-p.damp * tau / 2) * (cos(w * tau) + p.damp / (2*w) * sin(w * tau));
+    return a * cos(PI * X) * cos(PI * Y);
+}
+
+// Gaussian bump in the middle dispersing over the flat floor
+static double gaussian_bump(const Problem& p, double X, double Y, double tau) {
+    if (tau > 0)
+        return NAN;
+    const double sigma = 0.05;
+    const double r2 = (X - 0.5)*(X - 0.5) + (Y - 0.5)*(Y - 0.5);
+    return p.amplitude * exp(-r2 / (2*sigma*sigma));
+}
+
+static Problem make_standing_wave() {
+    // Small enough that the nonlinear terms stay below 1e-4 of it
+    Problem p = { "standing_wave", 1, 1, 1e-4, 1.5, 0, 1, 0.5, standing_wave };
+    const double w = sqrt(p.g * p.h0 * 2*PI*PI - p.damp*p.damp / 4);
+    p.tau_end = 2*PI / w;
+    return p;
+}
+
+static Problem make_gaussian_bump() {
+    // Ends before the front reaches the walls
+    Problem p = { "gaussian_bump", 1, 1, 0.1, 1.5, 0.25, 1.2, 0, gaussian_bump };
+    return p;
+}
+
+// Surface of a 2D run at tau_end
+struct Surface {
+    uint n;
+    std::vector<double> eta;
+};
+
+template<uint N, typename Integrator, typename Real>
+static Run run_2d(const Problem& p, const char* variant, double fraction, const Surface* reference, Surface* out = NULL) {
+    typedef ShallowWaterEngine<N,N,1,ReflectiveBoundary,Integrator,Real> Engine;
+
+    const double dX = grid_spacing(p, N);
+    const double scale = TimeScale<Integrator>::value * N * dX;
+    const uint steps = (uint)ceil(p.tau_end / (fraction * stable_dtau<Integrator>(dX, p.speed, p.damp, 2)));
+
+    Run run;
+    run.problem = p.name;
+    run.variant = variant;
+    run.grid = N;
+    run.dx = dX;
+    run.fraction = fraction;
+    run.dtau = p.tau_end / steps;
+    run.steps = steps;
+    run.dt = run.dtau / scale;
+    run.damp = p.damp * scale;
+    run.order = NAN;
+    run.status = "ok";
+
+    Scenario s;
+    s.grid = N;
+    s.layers = 1;
+    s.dt = run.dt;
+    s.damp = run.damp;
+    s.g = p.g;
+    s.h0 = p.h0;
+    s.hM = p.amplitude;
+    s.bumps.clear();
+    // The solve's error must stay well below the wave's
+    s.solver_tol = 1e-10;
+    s.solver_iterations = 200;
+
+    Engine* engine = new Engine(s);
+    Field<N,N> u(0.0), v(0.0), h;
+    for (uint x = 0; x < N; x++) {
+        for (uint y = 0; y < N; y++)
+            h[x][y] = p.h0 + p.surface(p, (x - p.offset) * dX, (y - p.offset) * dX, 0);
+    }
+    engine->set_state(0, u, v, h);
+
+    clock_t start = clock();
+    engine->advance(steps);
+    run.seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    const Field<N,N,Real>& h_end = engine->get_h(0);
+    if (out != NULL) {
+        out->n = N;
+        out->eta.resize((size_t)N * N);
+        for (uint x = 0; x < N; x++) {
+            for (uint y = 0; y < N; y++)
+                out->eta[(size_t)x * N + y] = h_end[x][y] - p.h0;
+        }
+    }
+
+    // Interior cells, the reference's grid holds every one of them
+    const uint r = (reference != NULL ? (reference->n - 1) / (N - 1) : 0);
+    double sum1 = 0, sum2 = 0, max = 0;
+    for (uint x = 1; x < N-1; x++) {
+        for (uint y = 1; y < N-1; y++) {
+            const double exact = (reference != NULL ? reference->eta[(size_t)x * r * reference->n + y * r]
+                                                    : p.surface(p, (x - p.offset) * dX, (y - p.offset) * dX, p.tau_end));
+            const double e = fabs(h_end[x][y] - p.h0 - exact);
+            if (!(e < INFINITY))
+                run.status = "diverged";
+            sum1 += e;
+            sum2 += e*e;
+            max = std::max(max, e);
+        }
+    }
+    const double cells = (double)(N-2) * (N-2);
+    run.l1 = sum1 / cells / p.amplitude;
+    run.l2 = sqrt(sum2 / cells) / p.amplitude;
+    run.linf = max / p.amplitude;
+    if (!(run.l2 < DIVERGED_ERROR))
+        run.status = "diverged";
+
+    delete engine;
+    return run;
+}
+
+template<typename Integrator, typename Real>
+static void run_grids_2d(const Problem& p, const char* variant, const Surface* reference, std::vector<Run>& runs) {
+    for (uint f = 0; f < FRACTION_COUNT; f++) {
+        runs.push_back(run_2d<25,Integrator,Real>(p, variant, FRACTIONS[f], reference));
+        runs.push_back(run_2d<49,Integrator,Real>(p, variant, FRACTIONS[f], reference));
+        runs.push_back(run_2d<97,Integrator,Real>(p, variant, FRACTIONS[f], reference));
+        fprintf(stderr, "%s %s at %g of the stable step done\n", p.name, variant, FRACTIONS[f]);
+    }
+}
+
+static void run_problem_2d(const Problem& p, const Surface* reference, std::vector<Run>& runs) {
+    run_grids_2d<ForwardEuler,double>(p, "explicit/double", reference, runs);
+    run_grids_2d<ForwardEuler,float>(p, "explicit/float", reference, runs);
+    run_grids_2d<SemiImplicit,double>(p, "semi_implicit/double", reference, runs);
+    run_grids_2d<SemiImplicit,float>(p, "semi_implicit/float", reference, runs);
+}
+
+
+// Dam break of test.cpp's 10 units of water onto 5 along the 1D transect,
+// against Stoker's solution: a rarefaction back into the deep side and a
+// bore into the shallow one, with X from 0 to 1 over the grid and the dam in
+// the middle. Ends before either reaches a wall. Stoker's solution is
+// undamped, so only leapfrog runs it; centred forward Euler needs damping to
+// stay stable at all.
+struct DamBreak {
+    double g, h_left, h_right;
+    double tau_end;
+    double h_mid, u_mid, shock; // The state between the waves and the bore's speed
+
+    DamBreak(double g_, double h_left_, double h_right_, double tau_end_);
+
+    double speed() const { return std::max(sqrt(g * h_left), u_mid + sqrt(g * h_mid)); }
+    double depth(double X, double tau) const;
+};
+
+DamBreak::DamBreak(double g_, double h_left_, double h_right_, double tau_end_):
+        g(g_), h_left(h_left_), h_right(h_right_), tau_end(tau_end_) {
+    // The middle depth where the velocity behind the rarefaction matches the
+    // one behind the bore
+    double lo = h_right, hi = h_left;
+    for (uint i = 0; i < 100; i++) {
+        const double h = 0.5 * (lo + hi);
+        const double u_rarefaction = 2 * (sqrt(g * h_left) - sqrt(g * h));
+        const double u_bore = (h - h_right) * sqrt(g * (h + h_right) / (2 * h * h_right));
+        (u_rarefaction > u_bore ? lo : hi) = h;
+    }
+    h_mid = 0.5 * (lo + hi);
+    u_mid = 2 * (sqrt(g * h_left) - sqrt(g * h_mid));
+    shock = h_mid * u_mid / (h_mid - h_right);
+}
+
+double DamBreak::depth(double X, double tau) const {
+    const double c_left = sqrt(g * h_left);
+    if (tau <= 0)
+        return (X < 0.5 ? h_left : (X > 0.5 ? h_right : 0.5 * (h_left + h_right)));
+    const double s = (X - 0.5) / tau;
+    if (s <= -c_left)
+        return h_left;
+    if (s <= u_mid - sqrt(g * h_mid))
+        return (2*c_left - s) * (2*c_left - s) / (9 * g);
+    if (s <= shock)
+        return h_mid;
+    return h_right;
+}
+
+template<uint N, typename Integrator>
+static Run run_dam_break(const DamBreak& d, const char* variant, double fraction) {
+    const double dX = 1.0 / (N - 1);
+    const double scale = TimeScale<Integrator>::value * N * dX;
+    const uint steps = (uint)ceil(d.tau_end / (fraction * stable_dtau<Integrator>(dX, d.speed(), 0, 1)));
+
+    Run run;
+    run.problem = "dam_break";
+    run.variant = variant;
+    run.grid = N;
+    run.dx = dX;
+    run.fraction = fraction;
+    run.dtau = d.tau_end / steps;
+    run.steps = steps;
+    run.dt = run.dtau / scale;
+    run.damp = 0;
+    run.order = NAN;
+    run.status = "ok";
+
+    Scenario s;
+    s.dt = run.dt;
+    s.damp = 0;
+    s.g = d.g;
+    s.h0 = d.h_left;
+    s.bumps.clear();
+
+    ShallowWater1D<N,ReflectiveBoundary,Integrator> engine(s);
+    Vector<N> u(0.0), h(0.0);
+    for (uint x = 0; x < N; x++)
+        h[x] = d.depth(x * dX, 0);
+    engine.set_state(u, h);
+
+    clock_t start = clock();
+    engine.advance(steps);
+    run.seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    double sum1 = 0, sum2 = 0, max = 0;
+    for (uint x = 1; x < N-1; x++) {
+        const double e = fabs(engine.get_h()[x] - d.depth(x * dX, d.tau_end));
+        if (!(e < INFINITY))
+            run.status = "diverged";
+        sum1 += e;
+        sum2 += e*e;
+        max = std::max(max, e);
+    }
+    const double amplitude = d.h_left - d.h_right;
+    run.l1 = sum1 / (N-2) / amplitude;
+    run.l2 = sqrt(sum2 / (N-2)) / amplitude;
+    run.linf = max / amplitude;
+    if (!(run.l2 < DIVERGED_ERROR))
+        run.status = "diverged";
+    return run;
+}
+
+template<typename Integrator>
+static void run_grids_1d(const DamBreak& d, const char* variant, std::vector<Run>& runs) {
+    for (uint f = 0; f < FRACTION_COUNT; f++) {
+        runs.push_back(run_dam_break<101,Integrator>(d, variant, FRACTIONS[f]));
+        runs.push_back(run_dam_break<201,Integrator>(d, variant, FRACTIONS[f]));
+        runs.push_back(run_dam_break<401,Integrator>(d, variant, FRACTIONS[f]));
+        runs.push_back(run_dam_break<801,Integrator>(d, variant, FRACTIONS[f]));
+        runs.push_back(run_dam_break<1601,Integrator>(d, variant, FRACTIONS[f]));
+    }
+    fprintf(stderr, "dam_break %s done\n", variant);
+}
+
+
+// Order of each run against the same variant and fraction one grid coarser
+static void observed_orders(std::vector<Run>& runs) {
+    for (uint i = 0; i < runs.size(); i++) {
+        const Run* coarser = NULL;
+        for (uint j = 0; j < runs.size(); j++) {
+            const Run& c = runs[j];
+            if (c.problem == runs[i].problem && c.variant == runs[i].variant && c.fraction == runs[i].fraction &&
+                c.grid < runs[i].grid && (coarser == NULL || c.grid > coarser->grid))
+                coarser = &c;
+        }
+        if (coarser != NULL && strcmp(runs[i].status, "ok") == 0 && strcmp(coarser->status, "ok") == 0 && runs[i].l2 > 0 && coarser->l2 > 0)
+            runs[i].order = log(coarser->l2 / runs[i].l2) / log(coarser->dx / runs[i].dx);
+    }
+}
+
+static bool write_csv(const char* path, const std::vector<Run>& runs) {
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "ERROR Failed to open output file: %s!\n", path);
+        return false;
+    }
+    fprintf(out, "problem,variant,grid,dx,fraction,dtau,steps,dt,damp,seconds,l1,l2,linf,order,status\n");
+    for (uint i = 0; i < runs.size(); i++) {
+        const Run& r = runs[i];
+        fprintf(out, "%s,%s,%u,%.9g,%g,%.9g,%u,%.9g,%.9g,%.6f,%.6g,%.6g,%.6g,%.3f,%s\n",
+                r.problem.c_str(), r.variant.c_str(), r.grid, r.dx, r.fraction, r.dtau, r.steps, r.dt, r.damp,
+                r.seconds, r.l1, r.l2, r.linf, r.order, r.status);
+    }
+    fclose(out);
+    return true;
+}
+
+// Gnuplot script drawing L2 error against CPU seconds, one panel per problem
+// and one series per variant, with the data inline: `gnuplot convergence.gp`
+// writes convergence.svg
+static bool write_plot(const std::string& stem, const std::vector<std::string>& problems, const std::vector<Run>& runs) {
+    std::string path = stem + ".gp";
+    FILE* out = fopen(path.c_str(), "w");
+    if (out == NULL) {
+        fprintf(stderr, "ERROR Failed to open output file: %s!\n", path.c_str());
+        return false;
+    }
+
+    std::vector<std::string> series; // problem + " " + variant of each data block
+    for (uint i = 0; i < runs.size(); i++) {
+        const std::string key = runs[i].problem + " " + runs[i].variant;
+        if (std::find(series.begin(), series.end(), key) == series.end())
+            series.push_back(key);
+    }
+    for (uint b = 0; b < series.size(); b++) {
+        fprintf(out, "$d%u << EOD\n", b);
+        for (uint i = 0; i < runs.size(); i++) {
+            if (runs[i].problem + " " + runs[i].variant == series[b] && strcmp(runs[i].status, "ok") == 0)
+                fprintf(out, "%.6g %.6g\n", std::max(runs[i].seconds, 1e-6), runs[i].l2);
+        }
+        fprintf(out, "EOD\n");
+    }
+
+    fprintf(out, "set terminal svg size %u,500\n", 500 * (uint)problems.size());
+    fprintf(out, "set output '%s.svg'\n", stem.c_str());
+    fprintf(out, "set logscale xy\nset format y '%%.0e'\nset key bottom left\n");
+    fprintf(out, "set xlabel 'CPU seconds'\nset ylabel 'L2 error / amplitude'\n");
+    fprintf(out, "set multiplot layout 1,%u\n", (uint)problems.size());
+    for (uint p = 0; p < problems.size(); p++) {
+        fprintf(out, "set title '%s' noenhanced\nplot", problems[p].c_str());
+        bool first = true;
+        for (uint b = 0; b < series.size(); b++) {
+            if (series[b].compare(0, problems[p].size() + 1, problems[p] + " ") != 0)
+                continue;
+            fprintf(out, "%s $d%u with points pt 7 title '%s' noenhanced", first ? "" : ",", b, series[b].c_str() + problems[p].size() + 1);
+            first = false;
+        }
+        fprintf(out, "\n");
+    }
+    fprintf(out, "unset multiplot\n");
+    fclose(out);
+    return true;
+}
+
+// Usage: convergence [-o convergence.csv] [-e target error] [-p problem]
+//
+// Runs standing_wave, gaussian_bump and dam_break (or the one named) and
+// prints the cheapest run of each whose L2 error relative to the problem's
+// amplitude is under the target, 1e-2 by default. The runs go to the CSV, a
+// gnuplot script of error against cost next to it.
+int main(int argc, char** argv) {
+    const char* out_path = "convergence.csv";
+    double target = 1e-2;
+    std::string only;
+    for (int a = 1; a + 1 < argc; a++) {
+        if (strcmp(argv[a], "-o") == 0)
+            out_path = argv[++a];
+        else if (strcmp(argv[a], "-e") == 0)
+            target = atof(argv[++a]);
+        else if (strcmp(argv[a], "-p") == 0)
+            only = argv[++a];
+    }
+    std::string out_stem = out_path;
+    if (out_stem.size() > 4 && out_stem.compare(out_stem.size() - 4, 4, ".csv") == 0)
+        out_stem.resize(out_stem.size() - 4);
+
+    std::vector<Run> runs;
+    std::vector<std::string> problems;
+
+    if (only.empty() || only == "standing_wave") {
+        Problem p = make_standing_wave();
+        run_problem_2d(p, NULL, runs);
+        problems.push_back(p.name);
+    }
+    if (only.empty() || only == "gaussian_bump") {
+        Problem p = make_gaussian_bump();
+        Surface reference;
+        const Run r = run_2d<REFERENCE_GRID,ForwardEuler,double>(p, "explicit/double", FRACTIONS[0], NULL, &reference);
+        fprintf(stderr, "gaussian_bump reference on %u in %.2fs\n", REFERENCE_GRID, r.seconds);
+        run_problem_2d(p, &reference, runs);
+        problems.push_back(p.name);
+    }
+    if (only.empty() || only == "dam_break") {
+        DamBreak d(1, 10, 5, 0.1);
+        run_grids_1d<Leapfrog>(d, "leapfrog/double", runs);
+        problems.push_back("dam_break");
+    }
+    if (problems.empty()) {
+        fprintf(stderr, "ERROR Unknown problem: %s!\n", only.c_str());
+        return 1;
+    }
+
+    observed_orders(runs);
+    if (!write_csv(out_path, runs) || !write_plot(out_stem, problems, runs))
+        return 1;
+
+    printf("%-14s %-21s %5s %8s %9s %9s %6s %8s\n", "problem", "variant", "grid", "fraction", "seconds", "L2", "order", "status");
+    for (uint i = 0; i < runs.size(); i++) {
+        const Run& r = runs[i];
+        printf("%-14s %-21s %5u %8g %9.4f %9.3g %6.2f %8s\n", r.problem.c_str(), r.variant.c_str(), r.grid, r.fraction, r.seconds, r.l2, r.order, r.status);
+    }
+
+    printf("\nCheapest run under an L2 error of %g:\n", target);
+    for (uint p = 0; p < problems.size(); p++) {
+        const Run* best = NULL;
+        for (uint i = 0; i < runs.size(); i++) {
+            const Run& r = runs[i];
+            if (r.problem == problems[p] && strcmp(r.status, "ok") == 0 && r.l2 <= target && (best == NULL || r.seconds < best->seconds))
+                best = &r;
+        }
+        if (best == NULL)
+            printf("  %-14s none\n", problems[p].c_str());
+        else
+            printf("  %-14s %s on %u, dt %.4g damp %.4g (%u steps), L2 %.3g in %.4fs\n", problems[p].c_str(), best->variant.c_str(),
+                   best->grid, best->dt, best->damp, best->steps, best->l2, best->seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,200 @@
+#ifndef __FIELD_H__
+#define __FIELD_H__
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+
+#include "utils/types.h"
+#include "utils/numa.h"
+
+// Expression templates for whole-field arithmetic. `a - b - c` builds a tree
+// of lightweight nodes instead of temporaries; assigning it to a Field
+// evaluates every cell in one fused loop. Nodes can also be read lazily with
+// the stencil accessors, so e.g. the layer thickness never needs to exist as
+// a grid of its own.
+//
+// Every expression exposes rows/cols and operator() over the row-major flat
+// index x*cols + y.
+template<typename E, typename T>
+struct FieldExpr {
+    const E& self() const { return static_cast<const E&>(*this); }
+
+    T at(uint x, uint y) const { return self()((size_t)x*E::cols + y); }
+
+    // Undivided central differences, f[x+1] - f[x-1] and f[y+1] - f[y-1]
+    T dx(uint x, uint y) const { return at(x+1, y) - at(x-1, y); }
+    T dy(uint x, uint y) const { return at(x, y+1) - at(x, y-1); }
+};
+
+template<uint N, uint M, typename T = double>
+class Field : public FieldExpr<Field<N,M,T>, T> {
+public:
+    typedef T value_type;
+    static const uint rows = N;
+    static const uint cols = M;
+    static const size_t size = (size_t)N * M;
+
+    Field() { allocate(); fill(0); }
+    Field(T v) { allocate(); fill(v); }
+    // Fresh pages backed as `huge` asks and not yet touched, so each lands on
+    // the node of the thread that first writes it (utils/numa.h). The cells
+    // are undefined until then.
+    explicit Field(HugePages huge) {
+        data = (T*)map_pages(size * sizeof(T), huge, mapped);
+        if (data == NULL)
+            throw std::bad_alloc();
+    }
+    Field(const Field& f) { allocate(); memcpy(data, f.data, size * sizeof(T)); }
+    template<typename E>
+    Field(const FieldExpr<E,T>& e) { allocate(); assign(e.self()); }
+    ~Field() { release(); }
+
+    Field& operator = (const Field& f) {
+        if (this != &f)
+            memcpy(data, f.data, size * sizeof(T));
+        return *this;
+    }
+    template<typename E>
+    Field& operator = (const FieldExpr<E,T>& e) { assign(e.self()); return *this; }
+    Field& operator = (T v) { fill(v); return *this; }
+
+    template<typename E>
+    Field& operator += (const FieldExpr<E,T>& e) {
+        const E& ex = e.self();
+        for (size_t i = 0; i < size; i++)
+            data[i] += ex(i);
+        return *this;
+    }
+    template<typename E>
+    Field& operator -= (const FieldExpr<E,T>& e) {
+        const E& ex = e.self();
+        for (size_t i = 0; i < size; i++)
+            data[i] -= ex(i);
+        return *this;
+    }
+
+    // Exchanges storage, how the engine rotates time levels without copying
+    void swap(Field& f) {
+        std::swap(data, f.data);
+        std::swap(mapped, f.mapped);
+    }
+
+    void fill(T v) { std::fill(data, data + size, v); }
+
+    // f[x][y] like Matrix, f(i) for the flat index
+    T* operator [] (uint x) { return data + (size_t)x * M; }
+    const T* operator [] (uint x) const { return data + (size_t)x * M; }
+    T& operator () (size_t i) { return data[i]; }
+    const T& operator () (size_t i) const { return data[i]; }
+
+    T* get_data() { return data; }
+    const T* get_data() const { return data; }
+
+private:
+    T* data;
+    size_t mapped = 0; // Length of the mapping, 0 if malloc'd
+
+    void allocate() {
+        void* p = NULL;
+        // Cache-line aligned so rows vectorize cleanly
+        if (posix_memalign(&p, 64, std::max(size * sizeof(T), (size_t)64)) != 0)
+            throw std::bad_alloc();
+        data = (T*)p;
+    }
+    void release() {
+        if (mapped > 0)
+            unmap_pages(data, mapped);
+        else
+            free(data);
+    }
+
+    template<typename E>
+    void assign(const E& e) {
+        for (size_t i = 0; i < size; i++)
+            data[i] = e(i);
+    }
+};
+
+template<uint N, uint M, typename T> const uint Field<N,M,T>::rows;
+template<uint N, uint M, typename T> const uint Field<N,M,T>::cols;
+template<uint N, uint M, typename T> const size_t Field<N,M,T>::size;
+
+
+// Fields are held by reference inside expressions, everything else by value
+template<typename E>
+struct ExprStorage { typedef E type; };
+template<uint N, uint M, typename T>
+struct ExprStorage<Field<N,M,T> > { typedef const Field<N,M,T>& type; };
+
+// A scalar broadcast over the grid
+template<typename T>
+struct FieldScalar : public FieldExpr<FieldScalar<T>, T> {
+    typedef T value_type;
+    static const uint rows = 0;
+    static const uint cols = 0;
+
+    T value;
+    FieldScalar(T v): value(v) {}
+    T operator () (size_t i) const { return value; }
+};
+
+struct OpAdd { template<typename T> static T apply(T a, T b) { return a + b; } };
+struct OpSub { template<typename T> static T apply(T a, T b) { return a - b; } };
+struct OpMul { template<typename T> static T apply(T a, T b) { return a * b; } };
+struct OpDiv { template<typename T> static T apply(T a, T b) { return a / b; } };
+
+template<typename A, typename B, typename Op, typename T>
+struct FieldBinary : public FieldExpr<FieldBinary<A,B,Op,T>, T> {
+    static const uint rows = (A::rows > 0 ? A::rows : B::rows);
+    static const uint cols = (A::cols > 0 ? A::cols : B::cols);
+
+    typename ExprStorage<A>::type a;
+    typename ExprStorage<B>::type b;
+
+    FieldBinary(const A& a_, const B& b_): a(a_), b(b_) {}
+    T operator () (size_t i) const { return Op::apply(a(i), b(i)); }
+};
+
+// Reads an expression of one precision as another, e.g. float state summed in double
+template<typename E, typename From, typename To>
+struct FieldCast : public FieldExpr<FieldCast<E,From,To>, To> {
+    static const uint rows = E::rows;
+    static const uint cols = E::cols;
+
+    typename ExprStorage<E>::type e;
+
+    FieldCast(const E& e_): e(e_) {}
+    To operator () (size_t i) const { return To(e(i)); }
+};
+
+template<typename To, typename E, typename T>
+FieldCast<E,T,To> field_cast(const FieldExpr<E,T>& e) {
+    return FieldCast<E,T,To>(e.self());
+}
+
+#define FIELD_BINARY_OPERATOR(op, Op) \
+    template<typename A, typename B, typename T> \
+    FieldBinary<A,B,Op,T> operator op (const FieldExpr<A,T>& a, const FieldExpr<B,T>& b) { \
+        return FieldBinary<A,B,Op,T>(a.self(), b.self()); \
+    } \
+    template<typename A, typename T> \
+    FieldBinary<A,FieldScalar<T>,Op,T> operator op (const FieldExpr<A,T>& a, typename FieldScalar<T>::value_type s) { \
+        return FieldBinary<A,FieldScalar<T>,Op,T>(a.self(), FieldScalar<T>(s)); \
+    } \
+    template<typename B, typename T> \
+    FieldBinary<FieldScalar<T>,B,Op,T> operator op (typename FieldScalar<T>::value_type s, const FieldExpr<B,T>& b) { \
+        return FieldBinary<FieldScalar<T>,B,Op,T>(FieldScalar<T>(s), b.self()); \
+    }
+
+FIELD_BINARY_OPERATOR(+, OpAdd)
+FIELD_BINARY_OPERATOR(-, OpSub)
+FIELD_BINARY_OPERATOR(*, OpMul)
+FIELD_BINARY_OPERATOR(/, OpDiv)
+
+#undef FIELD_BINARY_OPERATOR
+
+#endif
@@ -0,0 +1,330 @@
+#ifndef __FRAME_EXPORT_H__
+#define __FRAME_EXPORT_H__
+
+#ifndef GLFW_INCLUDE_GLCOREARB
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/types.h"
+#include "utils/trace.h"
+
+enum ImageFormat {
+    IMAGE_PPM, // Binary P6, fastest to write
+    IMAGE_PNG  // Stored (uncompressed) deflate, no zlib needed; recompress with ffmpeg or optipng
+};
+
+// Longest a readback may take before capture() gives up waiting, in ns
+static const GLuint64 FRAME_FENCE_TIMEOUT = 5000000000ull;
+
+// Writes a bottom-up RGBA image, as glReadPixels returns it, as a top-down RGB file
+bool write_image(const char* path, ImageFormat format, const unsigned char* rgba, uint w, uint h);
+
+// Saves the framebuffer bound for reading as a numbered image sequence. Each
+// capture() starts an asynchronous glReadPixels into the next pixel buffer
+// object of a ring and fences it; a buffer is only mapped once its fence has
+// signalled, normally `ring` - 1 frames later, so the render loop never waits
+// on the GPU. Mapped pixels are copied into a bounded pool of images that a
+// writer thread encodes and saves.
+class FrameExporter {
+public:
+    // `pattern` has one %u for the frame number, the extension (.ppm or .png) picks the format
+    FrameExporter(uint w, uint h, const std::string& pattern_, uint ring_ = 3, uint queue = 4);
+    ~FrameExporter() { finish(); }
+
+    void capture();
+    // Saves every frame still in flight and stops the writer
+    void finish();
+    void remove();
+
+    uint get_captured() const { return next_frame; }
+    // Times capture() waited on a fence or on the writer
+    unsigned long get_stalls() const { return stalls; }
+    bool has_failed() const { return failed; }
+
+private:
+    uint width, height;
+    std::string pattern;
+    ImageFormat format;
+
+    // Readback ring, slots [first, first + pending) are in flight
+    uint ring;
+    std::vector<GLuint> pbos;
+    std::vector<GLsync> fences;
+    std::vector<uint> frames;
+    uint first = 0, pending = 0;
+    uint next_frame = 0;
+
+    // Encoder side
+    std::vector<std::vector<unsigned char> > images;
+    std::vector<uint> free_images;
+    std::deque<std::pair<uint, uint> > queue; // (frame, image)
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable queued, freed;
+    bool closing = false;
+    bool failed = false;
+    unsigned long stalls = 0;
+
+    bool retire(bool wait);
+    void write_loop();
+};
+
+static uint32_t png_crc(const unsigned char* data, size_t n, uint32_t crc = 0xffffffffu) {
+    static uint32_t table[256];
+    static bool init = false;
+    if (!init) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (uint k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        init = true;
+    }
+    for (size_t i = 0; i < n; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static void put_be32(std::vector<unsigned char>& out, uint32_t v) {
+    out.push_back(v >> 24);
+    out.push_back(v >> 16);
+    out.push_back(v >> 8);
+    out.push_back(v);
+}
+
+static void write_png_chunk(FILE* file, const char* type, const unsigned char* data, size_t n) {
+    std::vector<unsigned char> head;
+    put_be32(head, n);
+    head.insert(head.end(), type, type + 4);
+    std::vector<unsigned char> tail;
+    put_be32(tail, png_crc(data, n, png_crc(&head[4], 4)) ^ 0xffffffffu);
+
+    fwrite(head.data(), 1, head.size(), file);
+    fwrite(data, 1, n, file);
+    fwrite(tail.data(), 1, tail.size(), file);
+}
+
+bool write_image(const char* path, ImageFormat format, const unsigned char* rgba, uint w, uint h) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR Failed to open image file: %s!\n", path);
+        return false;
+    }
+
+    // Rows flipped and alpha dropped, with room for PNG's filter byte in front of each row
+    const bool png = (format == IMAGE_PNG);
+    const size_t stride = (size_t)w * 3 + (png ? 1 : 0);
+    std::vector<unsigned char> rows(stride * h);
+    for (uint y = 0; y < h; y++) {
+        const unsigned char* in = rgba + (size_t)(h - 1 - y) * w * 4;
+        unsigned char* out = &rows[y * stride];
+        if (png)
+            *out++ = 0;
+        for (uint x = 0; x < w; x++, in += 4, out += 3) {
+            out[0] = in[0];
+            out[1] = in[1];
+            out[2] = in[2];
+        }
+    }
+
+    if (!png) {
+        fprintf(file, "P6\n%u %u\n255\n", w, h);
+        fwrite(rows.data(), 1, rows.size(), file);
+    }
+    else {
+        static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        fwrite(signature, 1, 8, file);
+
+        std::vector<unsigned char> ihdr;
+        put_be32(ihdr, w);
+        put_be32(ihdr, h);
+        const unsigned char rest[5] = { 8, 2, 0, 0, 0 }; // 8 bit RGB, deflate, no interlace
+        ihdr.insert(ihdr.end(), rest, rest + 5);
+        write_png_chunk(file, "IHDR", ihdr.data(), ihdr.size());
+
+        // zlib stream of stored blocks, at most 65535 bytes each
+        std::vector<unsigned char> z;
+        z.reserve(rows.size() + rows.size() / 65535 * 5 + 16);
+        z.push_back(0x78);
+        z.push_back(0x01);
+        uint32_t a = 1, b = 0;
+        for (size_t pos = 0; pos < rows.size(); ) {
+            const size_t n = std::min(rows.size() - pos, (size_t)65535);
+            z.push_back(pos + n == rows.size() ? 1 : 0);
+            z.push_back(n & 0xff);
+            z.push_back(n >> 8);
+            z.push_back(~n & 0xff);
+            z.push_back((~n >> 8) & 0xff);
+            z.insert(z.end(), rows.begin() + pos, rows.begin() + pos + n);
+            for (size_t i = pos; i < pos + n; i++) {
+                a = (a + rows[i]) % 65521;
+                b = (b + a) % 65521;
+            }
+            pos += n;
+        }
+        put_be32(z, (b << 16) | a);
+        write_png_chunk(file, "IDAT", z.data(), z.size());
+        write_png_chunk(file, "IEND", NULL, 0);
+    }
+
+    const bool ok = !ferror(file);
+    fclose(file);
+    if (!ok)
+        fprintf(stderr, "ERROR Failed to write image file: %s!\n", path);
+    return ok;
+}
+
+FrameExporter::FrameExporter(uint w, uint h, const std::string& pattern_, uint ring_, uint queue_size):
+        width(w), height(h), pattern(pattern_), ring(std::max(ring_, 1u)) {
+    const size_t ext = pattern.rfind('.');
+    format = (ext != std::string::npos && pattern.compare(ext, std::string::npos, ".png") == 0 ? IMAGE_PNG : IMAGE_PPM);
+
+    const size_t bytes = (size_t)width * height * 4;
+    pbos.resize(ring);
+    fences.assign(ring, (GLsync)0);
+    frames.assign(ring, 0);
+    glGenBuffers(ring, pbos.data());
+    for (uint i = 0; i < ring; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    images.resize(std::max(queue_size, 1u));
+    for (uint i = 0; i < images.size(); i++) {
+        images[i].resize(bytes);
+        free_images.push_back(i);
+    }
+    writer = std::thread(&FrameExporter::write_loop, this);
+}
+
+void FrameExporter::capture() {
+    TRACE_SCOPE("capture");
+    // Hand over whatever has already landed, and make room if the ring is full
+    while (pending > 0 && retire(pending == ring))
+        ;
+
+    const uint slot = (first + pending) % ring;
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    frames[slot] = next_frame++;
+    pending++;
+}
+
+// Copies the oldest readback out of its PBO, false if it isn't ready and `wait` is off
+bool FrameExporter::retire(bool wait) {
+    const uint slot = first;
+    GLenum state = glClientWaitSync(fences[slot], 0, 0);
+    if (state == GL_TIMEOUT_EXPIRED) {
+        if (!wait)
+            return false;
+        stalls++;
+        state = glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, FRAME_FENCE_TIMEOUT);
+    }
+    glDeleteSync(fences[slot]);
+    fences[slot] = 0;
+    first = (first + 1) % ring;
+    pending--;
+    if (state == GL_WAIT_FAILED || state == GL_TIMEOUT_EXPIRED) {
+        fprintf(stderr, "ERROR Readback of frame %u failed!\n", frames[slot]);
+        return true;
+    }
+
+    uint image;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (free_images.empty()) {
+            stalls++;
+            freed.wait(lock, [&]() { return !free_images.empty(); });
+        }
+        image = free_images.back();
+        free_images.pop_back();
+    }
+
+    const size_t bytes = (size_t)width * height * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+    const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    if (pixels != NULL) {
+        memcpy(images[image].data(), pixels, bytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pixels != NULL)
+            queue.push_back(std::make_pair(frames[slot], image));
+        else {
+            fprintf(stderr, "ERROR Failed to map readback of frame %u!\n", frames[slot]);
+            free_images.push_back(image);
+        }
+    }
+    queued.notify_one();
+    return true;
+}
+
+void FrameExporter::finish() {
+    if (!writer.joinable())
+        return;
+    while (pending > 0)
+        retire(true);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    queued.notify_one();
+    writer.join();
+}
+
+void FrameExporter::remove() {
+    finish();
+    glDeleteBuffers(ring, pbos.data());
+}
+
+void FrameExporter::write_loop() {
+    TRACE_THREAD("frame writer");
+    std::vector<char> path(pattern.size() + 32);
+    while (true) {
+        std::pair<uint, uint> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queued.wait(lock, [&]() { return closing || !queue.empty(); });
+            if (queue.empty())
+                break;
+            job = queue.front();
+            queue.pop_front();
+        }
+
+        TRACE_SCOPE("write image");
+        snprintf(path.data(), path.size(), pattern.c_str(), job.first);
+        const bool ok = write_image(path.data(), format, images[job.second].data(), width, height);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            free_images.push_back(job.second);
+            failed = failed || !ok;
+        }
+        freed.notify_one();
+    }
+}
+
+#endif
@@ -0,0 +1,330 @@
+#ifndef __FRAME_RING_H__
+#define __FRAME_RING_H__
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+#include "utils/types.h"
+#include "utils/trace.h"
+#include "field.h"
+#include "scenario.h"
+
+// Live frames of a running simulation in POSIX shared memory, so a viewer in
+// another process can attach and detach at any time without the solver
+// noticing. The segment is a header, the floor, then a ring of slots each
+// holding the height of every layer as float32, ready for the meshes.
+//
+// Every slot is a seqlock: the writer makes its sequence odd, copies the
+// frame in and makes it even again, and a reader keeps a copy only if the
+// sequence was the same even number before and after. The writer never waits
+// for a reader; with several slots it fills the one after the newest, so a
+// reader copying the newest frame is only overrun by a writer lapping the
+// whole ring meanwhile, and then just tries again.
+
+static const char FRAME_RING_MAGIC[8] = "SWERING";
+static const uint32_t FRAME_RING_VERSION = 1;
+
+struct FrameRingHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t n, m, layers;
+    uint32_t slots;
+    uint64_t slot_bytes;         // Stride between slots, the frame follows each slot's header
+    double dt, h0, hM;           // Of the scenario, hM sets the viewer's colour scale
+    std::atomic<uint64_t> latest; // Frames published, the newest is in slot (latest-1) % slots
+    std::atomic<uint32_t> closed; // The publisher has finished
+};
+
+struct FrameSlot {
+    std::atomic<uint64_t> seq;
+    uint64_t frame; // Number of the frame, from 0
+    uint64_t step;  // Solver time step it shows
+};
+
+// Header and slots start on their own cache lines
+static const size_t FRAME_RING_ALIGN = 64;
+
+inline size_t frame_ring_round(size_t bytes) {
+    return (bytes + FRAME_RING_ALIGN - 1) / FRAME_RING_ALIGN * FRAME_RING_ALIGN;
+}
+
+// Writing end, owned by the simulation. Publishing a frame is one copy of
+// the heights into the next slot, converting to float on the way for double
+// engines.
+template<uint N, uint M, uint L>
+class FramePublisher {
+public:
+    FramePublisher() {}
+    ~FramePublisher() { close(); }
+
+    // Creates the segment `name`, e.g. "/swe", with the floor fixed for the
+    // whole run. One an earlier run left behind is unlinked, not reused, so
+    // a viewer still mapping it keeps a consistent old ring.
+    template<typename T>
+    bool open(const char* name, const Scenario& s, const Field<N,M,T>& h_B, uint slots = 4);
+    // Marks the ring closed and removes the name, attached viewers keep the last frame
+    void close();
+
+    bool is_open() const { return header != NULL; }
+
+    template<typename Engine>
+    void publish(const Engine& engine);
+
+    unsigned long get_published() const { return header != NULL ? header->latest.load(std::memory_order_relaxed) : 0; }
+
+private:
+    std::string name;
+    FrameRingHeader* header = NULL;
+    size_t bytes = 0;
+
+    FrameSlot* slot(uint64_t k) {
+        return (FrameSlot*)((char*)header + frame_ring_round(sizeof(FrameRingHeader)) +
+                            frame_ring_round(N * M * sizeof(float)) + (k % header->slots) * header->slot_bytes);
+    }
+
+    template<typename T>
+    static void copy(float* out, const Field<N,M,T>& f) {
+        const T* in = f.get_data();
+        for (size_t c = 0; c < (size_t)N * M; c++)
+            out[c] = in[c];
+    }
+    static void copy(float* out, const Field<N,M,float>& f) { memcpy(out, f.get_data(), N * M * sizeof(float)); }
+};
+
+template<uint N, uint M, uint L>
+template<typename T>
+bool FramePublisher<N,M,L>::open(const char* name_, const Scenario& s, const Field<N,M,T>& h_B, uint slots) {
+    close();
+    slots = std::max(slots, 2u);
+
+    const size_t frame_bytes = (size_t)L * N * M * sizeof(float);
+    const size_t slot_bytes = frame_ring_round(sizeof(FrameSlot)) + frame_ring_round(frame_bytes);
+    const size_t total = frame_ring_round(sizeof(FrameRingHeader)) + frame_ring_round(N * M * sizeof(float)) + slots * slot_bytes;
+
+    shm_unlink(name_);
+    int fd = shm_open(name_, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR Failed to create shared memory: %s!\n", name_);
+        return false;
+    }
+    if (ftruncate(fd, total) != 0) {
+        fprintf(stderr, "ERROR Failed to size shared memory: %s!\n", name_);
+        ::close(fd);
+        shm_unlink(name_);
+        return false;
+    }
+    void* p = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "ERROR Failed to map shared memory: %s!\n", name_);
+        shm_unlink(name_);
+        return false;
+    }
+
+    // Fresh pages are zero, readers ignore the segment until the magic is in
+    name = name_;
+    bytes = total;
+    header = (FrameRingHeader*)p;
+    header->version = FRAME_RING_VERSION;
+    header->n = N;
+    header->m = M;
+    header->layers = L;
+    header->slots = slots;
+    header->slot_bytes = slot_bytes;
+    header->dt = s.dt;
+    header->h0 = s.h0;
+    header->hM = s.hM;
+    copy((float*)((char*)p + frame_ring_round(sizeof(FrameRingHeader))), h_B);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, FRAME_RING_MAGIC, sizeof(FRAME_RING_MAGIC));
+    return true;
+}
+
+template<uint N, uint M, uint L>
+void FramePublisher<N,M,L>::close() {
+    if (header == NULL)
+        return;
+    header->closed.store(1, std::memory_order_release);
+    munmap(header, bytes);
+    shm_unlink(name.c_str());
+    header = NULL;
+}
+
+template<uint N, uint M, uint L>
+template<typename Engine>
+void FramePublisher<N,M,L>::publish(const Engine& engine) {
+    if (header == NULL)
+        return;
+    TRACE_SCOPE("publish frame");
+    const uint64_t k = header->latest.load(std::memory_order_relaxed);
+    FrameSlot* s = slot(k);
+    float* out = (float*)((char*)s + frame_ring_round(sizeof(FrameSlot)));
+
+    const uint64_t seq = s->seq.load(std::memory_order_relaxed);
+    s->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s->frame = k;
+    s->step = engine.get_t();
+    for (uint i = 0; i < L; i++)
+        copy(out + (size_t)i * N * M, engine.get_h(i));
+    s->seq.store(seq + 2, std::memory_order_release);
+
+    header->latest.store(k + 1, std::memory_order_release);
+}
+
+
+// Reading end, used by the viewer. Sizes come from the segment, so one
+// subscriber attaches to a publisher of any grid or layer count.
+class FrameSubscriber {
+public:
+    FrameSubscriber() {}
+    ~FrameSubscriber() { detach(); }
+
+    // False while there is no such segment or it isn't set up yet, without
+    // an error, so a viewer can keep trying
+    bool attach(const char* name);
+    void detach();
+
+    bool is_attached() const { return header != NULL; }
+    // The publisher closed the ring, no new frames will come
+    bool is_closed() const { return header->closed.load(std::memory_order_acquire) != 0; }
+    // `name` now holds another segment than the one mapped. A publisher that
+    // crashed never closes its ring, but the next run replaces it.
+    bool is_replaced(const char* name) const;
+
+    uint get_n() const { return header->n; }
+    uint get_m() const { return header->m; }
+    uint get_layers() const { return header->layers; }
+    double get_dt() const { return header->dt; }
+    double get_h0() const { return header->h0; }
+    double get_hM() const { return header->hM; }
+    const float* get_floor() const { return (const float*)((const char*)header + frame_ring_round(sizeof(FrameRingHeader))); }
+
+    // Copies the newest frame into `out` (layers * n * m floats) if it is
+    // newer than the one read last. False if there is none, or the writer
+    // kept overrunning it.
+    bool read_latest(float* out, uint64_t& step);
+
+    unsigned long get_retries() const { return retries; }
+
+private:
+    FrameRingHeader* header = NULL;
+    size_t bytes = 0;
+    dev_t dev = 0;     // Identity of the mapped segment
+    ino_t ino = 0;
+    uint64_t last = 0; // Frames published when we last read
+    unsigned long retries = 0;
+
+    const FrameSlot* slot(uint64_t k) const {
+        return (const FrameSlot*)((const char*)header + frame_ring_round(sizeof(FrameRingHeader)) +
+                                  frame_ring_round((size_t)header->n * header->m * sizeof(float)) + (k % header->slots) * header->slot_bytes);
+    }
+
+    static bool fits(const FrameRingHeader* h, size_t size);
+};
+
+// Whether the floor and every slot the header declares lie within the `size`
+// bytes mapped, so a damaged or foreign segment can't send reads past the end
+bool FrameSubscriber::fits(const FrameRingHeader* h, size_t size) {
+    if (h->n == 0 || h->m == 0 || h->layers == 0 || h->slots == 0)
+        return false;
+    const size_t cells = (size_t)h->n * h->m;
+    if (cells > size / sizeof(float) || h->layers > size / sizeof(float) / cells)
+        return false;
+    const size_t head = frame_ring_round(sizeof(FrameRingHeader)) + frame_ring_round(cells * sizeof(float));
+    const size_t slot_min = frame_ring_round(sizeof(FrameSlot)) + frame_ring_round(h->layers * cells * sizeof(float));
+    if (head > size || h->slot_bytes < slot_min)
+        return false;
+    return h->slots <= (size - head) / h->slot_bytes;
+}
+
+bool FrameSubscriber::attach(const char* name) {
+    detach();
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FrameRingHeader)) {
+        ::close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    FrameRingHeader* h = (FrameRingHeader*)p;
+    if (memcmp(h->magic, FRAME_RING_MAGIC, sizeof(FRAME_RING_MAGIC)) != 0) {
+        munmap(p, st.st_size);
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (h->version != FRAME_RING_VERSION) {
+        fprintf(stderr, "ERROR Frame ring version %u, expected %u!\n", h->version, FRAME_RING_VERSION);
+        munmap(p, st.st_size);
+        return false;
+    }
+    if (!fits(h, st.st_size)) {
+        fprintf(stderr, "ERROR Frame ring %s is smaller than its header says!\n", name);
+        munmap(p, st.st_size);
+        return false;
+    }
+    header = h;
+    bytes = st.st_size;
+    dev = st.st_dev;
+    ino = st.st_ino;
+    last = 0;
+    return true;
+}
+
+bool FrameSubscriber::is_replaced(const char* name) const {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    const bool other = (fstat(fd, &st) == 0 && (st.st_dev != dev || st.st_ino != ino));
+    ::close(fd);
+    return other;
+}
+
+void FrameSubscriber::detach() {
+    if (header == NULL)
+        return;
+    munmap(header, bytes);
+    header = NULL;
+}
+
+bool FrameSubscriber::read_latest(float* out, uint64_t& step) {
+    const size_t frame_bytes = (size_t)header->layers * header->n * header->m * sizeof(float);
+    for (uint attempt = 0; attempt < 4; attempt++) {
+        const uint64_t latest = header->latest.load(std::memory_order_acquire);
+        if (latest == last)
+            return false;
+        const FrameSlot* s = slot(latest - 1);
+
+        const uint64_t seq = s->seq.load(std::memory_order_acquire);
+        if (seq % 2 == 0) {
+            memcpy(out, (const char*)s + frame_ring_round(sizeof(FrameSlot)), frame_bytes);
+            step = s->step;
+            const uint64_t frame = s->frame;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s->seq.load(std::memory_order_relaxed) == seq && frame == latest - 1) {
+                last = latest;
+                return true;
+            }
+        }
+        retries++;
+    }
+    return false;
+}
+
+#endif
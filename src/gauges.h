@@ -0,0 +1,293 @@
+#ifndef __GAUGES_H__
+#define __GAUGES_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/types.h"
+#include "utils/thread_pool.h"
+
+// Virtual tide gauges, h, u and v of the top `layers` layers sampled at fixed
+// stations after each step. Bilinear weights are resolved when a station is added, so
+// a sample is four loads per value. Stations are split into one contiguous
+// range per pool worker and each worker appends rows to its own ring buffer;
+// a writer thread drains full rows from all rings and appends them to a
+// columnar file, so the step loop never touches the disk.
+//
+// File layout, little-endian:
+//
+//     header   char magic[8] = "SWEGAUGE", uint32 version, stations, layers,
+//              uint32 values = 3 (h, u, v), double dt
+//     stations stations x { char name[32]; float x, y; }
+//     chunks   { uint32 rows, uint32 0, uint32 step[rows],
+//                float column[rows] for each station, layer, value }
+//
+// so every column of a chunk is one contiguous series.
+static const uint GAUGE_VALUES = 3;
+static const uint GAUGE_NAME_LENGTH = 32;
+
+template<uint N, uint M, uint L>
+class GaugeSet {
+public:
+    // Records layers [0, layers_), ring capacity in rows is rounded up to a power of two
+    GaugeSet(uint layers_ = 1, uint capacity_ = 4096);
+    ~GaugeSet() { close(); }
+
+    // Position in the same normalised [0, 1] coordinates as Scenario bumps,
+    // only before open()
+    uint add(const std::string& name, double x, double y);
+
+    // Splits the stations over `pool`'s workers for sample(), NULL samples on the caller
+    bool open(const char* path, double dt, ThreadPool* pool = NULL);
+    // Drains every buffered row and closes the file
+    void close();
+
+    template<typename Engine>
+    void sample(const Engine& engine);
+
+    uint size() const { return stations.size(); }
+    // Times sample() had to wait for the writer to free a ring
+    unsigned long get_stalls() const { return stalls; }
+
+private:
+    struct Station {
+        std::string name;
+        float x, y;
+        uint index;  // Flat index of the lower-left grid point
+        float w[4];  // Weights of index, +1, +M, +M+1
+    };
+
+    // Single producer (one pool worker) single consumer (the writer) ring of rows
+    struct Ring {
+        uint lo, hi;                 // Stations of this ring
+        std::vector<float> values;   // capacity x (hi - lo) x layers x GAUGE_VALUES
+        std::vector<uint32_t> steps; // capacity
+        std::atomic<unsigned long> head, tail;
+
+        Ring(): head(0), tail(0) {}
+    };
+
+    std::vector<Station> stations;
+    std::vector<Ring*> rings;
+    uint layers;
+    uint capacity;
+    ThreadPool* pool = NULL;
+
+    FILE* file = NULL;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool closing = false;
+    std::atomic<unsigned long> stalls;
+
+    void write_loop();
+    bool flush(std::vector<float>& columns, std::vector<uint32_t>& steps);
+};
+
+template<uint N, uint M, uint L>
+GaugeSet<N,M,L>::GaugeSet(uint layers_, uint capacity_): layers(std::min(std::max(layers_, 1u), L)), stalls(0) {
+    capacity = 2;
+    while (capacity < capacity_)
+        capacity *= 2;
+}
+
+template<uint N, uint M, uint L>
+uint GaugeSet<N,M,L>::add(const std::string& name, double x, double y) {
+    Station s;
+    s.name = name;
+    s.x = std::min(std::max(x, 0.0), 1.0);
+    s.y = std::min(std::max(y, 0.0), 1.0);
+
+    const double gx = s.x * (N-1), gy = s.y * (M-1);
+    const uint x0 = std::min((uint)gx, N-2), y0 = std::min((uint)gy, M-2);
+    const float fx = gx - x0, fy = gy - y0;
+    s.index = x0 * M + y0;
+    s.w[0] = (1-fx) * (1-fy);
+    s.w[1] = (1-fx) * fy;
+    s.w[2] = fx * (1-fy);
+    s.w[3] = fx * fy;
+
+    stations.push_back(s);
+    return stations.size() - 1;
+}
+
+template<uint N, uint M, uint L>
+bool GaugeSet<N,M,L>::open(const char* path, double dt, ThreadPool* pool_) {
+    close();
+
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR Failed to open gauge file: %s!\n", path);
+        return false;
+    }
+
+    const uint32_t header[4] = { 1, (uint32_t)stations.size(), layers, GAUGE_VALUES };
+    fwrite("SWEGAUGE", 1, 8, file);
+    fwrite(header, sizeof(uint32_t), 4, file);
+    fwrite(&dt, sizeof(double), 1, file);
+    for (uint i = 0; i < stations.size(); i++) {
+        char name[GAUGE_NAME_LENGTH] = { 0 };
+        strncpy(name, stations[i].name.c_str(), GAUGE_NAME_LENGTH - 1);
+        fwrite(name, 1, GAUGE_NAME_LENGTH, file);
+        fwrite(&stations[i].x, sizeof(float), 1, file);
+        fwrite(&stations[i].y, sizeof(float), 1, file);
+    }
+
+    // Same split as ThreadPool::parallel_for, one ring per worker
+    pool = pool_;
+    const uint workers = (pool != NULL ? pool->size() : 1);
+    const uint n = stations.size();
+    for (uint k = 0; k < workers; k++) {
+        Ring* ring = new Ring();
+        ring->lo = (unsigned long)n * k / workers;
+        ring->hi = (unsigned long)n * (k+1) / workers;
+        ring->values.resize((size_t)capacity * (ring->hi - ring->lo) * layers * GAUGE_VALUES);
+        ring->steps.resize(capacity);
+        rings.push_back(ring);
+    }
+
+    closing = false;
+    writer = std::thread(&GaugeSet::write_loop, this);
+    return true;
+}
+
+template<uint N, uint M, uint L>
+void GaugeSet<N,M,L>::close() {
+    if (file == NULL)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    wake.notify_one();
+    writer.join();
+
+    fclose(file);
+    file = NULL;
+    for (uint k = 0; k < rings.size(); k++)
+        delete rings[k];
+    rings.clear();
+}
+
+template<uint N, uint M, uint L>
+template<typename Engine>
+void GaugeSet<N,M,L>::sample(const Engine& engine) {
+    if (file == NULL)
+        return;
+
+    const uint32_t step = engine.get_t();
+    auto record = [&](uint k) {
+        Ring& ring = *rings[k];
+        const unsigned long head = ring.head.load(std::memory_order_relaxed);
+        if (head - ring.tail.load(std::memory_order_acquire) >= capacity) {
+            stalls++;
+            wake.notify_one();
+            while (head - ring.tail.load(std::memory_order_acquire) >= capacity)
+                std::this_thread::yield();
+        }
+
+        // Field by field, so each pass streams one grid through the cache. With
+        // more workers than stations some rings have none, but still count steps.
+        const size_t row = head & (capacity - 1);
+        if (ring.hi > ring.lo) {
+            const uint stride = layers * GAUGE_VALUES;
+            float* out = &ring.values[row * (ring.hi - ring.lo) * stride];
+            for (uint i = 0; i < layers; i++) {
+                const typename Engine::real_type* fields[GAUGE_VALUES] = {
+                    engine.get_h(i).get_data(), engine.get_u(i).get_data(), engine.get_v(i).get_data()
+                };
+                for (uint f = 0; f < GAUGE_VALUES; f++) {
+                    float* o = out + i * GAUGE_VALUES + f;
+                    for (uint s = ring.lo; s < ring.hi; s++, o += stride) {
+                        const Station& st = stations[s];
+                        const typename Engine::real_type* c = fields[f] + st.index;
+                        *o = st.w[0] * c[0] + st.w[1] * c[1] + st.w[2] * c[M] + st.w[3] * c[M+1];
+                    }
+                }
+            }
+        }
+        ring.steps[row] = step;
+        ring.head.store(head + 1, std::memory_order_release);
+    };
+
+    if (pool != NULL)
+        pool->run_on_all(record);
+    else
+        record(0);
+
+    // Rows are taken in bulk, only nudge the writer once half a ring is waiting
+    Ring& first = *rings[0];
+    if (first.head.load(std::memory_order_relaxed) - first.tail.load(std::memory_order_relaxed) == capacity / 2)
+        wake.notify_one();
+}
+
+template<uint N, uint M, uint L>
+void GaugeSet<N,M,L>::write_loop() {
+    std::vector<float> columns;
+    std::vector<uint32_t> steps;
+    while (true) {
+        bool done;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait_for(lock, std::chrono::milliseconds(100));
+            done = closing;
+        }
+        // Rows sampled before close() was called are all visible by now
+        while (flush(columns, steps))
+            ;
+        if (done)
+            break;
+    }
+    fflush(file);
+}
+
+// Writes one chunk of every row completed in all rings, false if there was none
+template<uint N, uint M, uint L>
+bool GaugeSet<N,M,L>::flush(std::vector<float>& columns, std::vector<uint32_t>& steps) {
+    unsigned long rows = capacity;
+    for (uint k = 0; k < rings.size(); k++)
+        rows = std::min(rows, rings[k]->head.load(std::memory_order_acquire) - rings[k]->tail.load(std::memory_order_relaxed));
+    if (rows == 0)
+        return false;
+
+    const uint width = stations.size() * layers * GAUGE_VALUES;
+    columns.resize((size_t)rows * width);
+    steps.resize(rows);
+
+    // Transpose ring rows into columns, column c of the chunk is columns[c*rows, (c+1)*rows)
+    for (uint k = 0; k < rings.size(); k++) {
+        Ring& ring = *rings[k];
+        const unsigned long tail = ring.tail.load(std::memory_order_relaxed);
+        const uint ring_width = (ring.hi - ring.lo) * layers * GAUGE_VALUES;
+        const uint first_column = ring.lo * layers * GAUGE_VALUES;
+        for (unsigned long r = 0; r < rows; r++) {
+            const size_t row = (tail + r) & (capacity - 1);
+            if (ring_width > 0) {
+                const float* in = &ring.values[row * ring_width];
+                for (uint c = 0; c < ring_width; c++)
+                    columns[(size_t)(first_column + c) * rows + r] = in[c];
+            }
+            if (k == 0)
+                steps[r] = ring.steps[row];
+        }
+        ring.tail.store(tail + rows, std::memory_order_release);
+    }
+
+    const uint32_t chunk_header[2] = { (uint32_t)rows, 0 };
+    fwrite(chunk_header, sizeof(uint32_t), 2, file);
+    fwrite(steps.data(), sizeof(uint32_t), rows, file);
+    fwrite(columns.data(), sizeof(float), columns.size(), file);
+    return true;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __INTEGRATOR_H__
+#define __INTEGRATOR_H__
+
+// Time integrators as template policies, `next` from the current and previous
+// values of a cell and its tendency (kernels.h)
+
+// Two-level scheme, what the 2D solver has always used
+struct ForwardEuler {
+    static const bool filtered = false;
+    static const bool implicit = false;
+
+    template<typename T>
+    static T advance(T cur, T prev, T dt, T tendency) { return cur - dt * tendency; }
+
+    template<typename T>
+    static T filter(T prev, T cur, T next) { return cur; }
+};
+
+// Three-level leapfrog. Tendencies from undivided central differences are
+// twice the derivative, so stepping prev by dt covers the full 2*dt interval.
+// The Robert-Asselin filter on the middle level damps the computational mode.
+struct Leapfrog {
+    static const bool filtered = true;
+    static const bool implicit = false;
+
+    template<typename T>
+    static T advance(T cur, T prev, T dt, T tendency) { return prev - dt * tendency; }
+
+    template<typename T>
+    static T filter(T prev, T cur, T next) { return cur + T(0.05) * (prev - 2*cur + next); }
+};
+
+// Forward Euler for advection and damping, backward Euler for each layer's own
+// surface gradient and thickness divergence. Those carry the gravity waves, so
+// dt is no longer bound by sqrt(g*h), only by the flow speed. The engine
+// solves the Helmholtz problem this leaves for the new surface (multigrid.h).
+struct SemiImplicit {
+    static const bool filtered = false;
+    static const bool implicit = true;
+
+    template<typename T>
+    static T advance(T cur, T prev, T dt, T tendency) { return cur - dt * tendency; }
+
+    template<typename T>
+    static T filter(T prev, T cur, T next) { return cur; }
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+// Per-cell tendencies of the shallow water equations, shared by the 1D and 2D
+// engines. Derivatives are passed in as undivided central differences over
+// the grid spacing, e.g. (q[x+1] - q[x-1]) / dx; the 1D engine passes zero
+// for every y term.
+
+// Rate of change of a velocity component q: advection, pressure gradient and
+// linear damping (the caller subtracts dt times this)
+template<typename T>
+inline T momentum_tendency(T q, T u, T v, T dq_dx, T dq_dy, T dp_ds, T inv_density, T damp) {
+    return u*dq_dx  +  v*dq_dy  +  inv_density*dp_ds  +  damp*q;
+}
+
+// Rate of change of the surface height from the thickness flux divergence
+template<typename T>
+inline T continuity_tendency(T eta, T u, T v, T deta_dx, T deta_dy, T du_dx, T dv_dy) {
+    return u*deta_dx  +  v*deta_dy  +  eta*(du_dx + dv_dy);
+}
+
+#endif
@@ -3,6 +3,9 @@
 
 #include <GLFW/glfw3.h>
 #include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <leon/vector.h>
 #include <leon/transform.h>
 #include <leon/camera.h>
@@ -15,12 +18,22 @@
 #include "utils/opengl/obj_loader.h"
 #include "utils/opengl/mesh_gen.h"
 #include "utils/opengl/displacement_mesh.h"
+#include "utils/opengl/uniform_buffer.h"
 #include "utils/window.h"
 #include "utils/key.h"
 #include "utils/input.h"
+#include "utils/trace.h"
 #include "shallow_water_model.h"
+#include "particles.h"
+#include "particle_renderer.h"
+#include "bathymetry.h"
+#include "scenario.h"
+#include "simulation_clock.h"
+#include "frame_export.h"
+#include "roofline.h"
 
 static const uint WIDTH = 1680, HEIGHT = 945;
+static const uint GRID = 75, LAYERS = 3;
 
 void update() {
     if (Input::get_key_down(Key::A)) {
@@ -32,61 +45,151 @@ void render() {
 
 }
 
-int main(void) {
-    if (!initGLFW())
+// Usage: a.out [scenario.scn] [-x frames/%05u.png] [-n frames] [-s 1920x1080] [-r]
+//
+// -x renders offscreen at -s and saves -n frames (.png or .ppm) instead of
+// opening a window, the simulation runs unpaused at 10 steps per frame.
+// -r prints a roofline report of the step and surface kernels and exits.
+//
+// In the window, D drops a bump on the water under the cursor and holding S
+// drags a patch of low pressure along with it.
+int main(int argc, char** argv) {
+    TRACE_THREAD("main");
+    ScenarioFile scenario_file;
+    const char* export_pattern = NULL;
+    uint export_frames = 600;
+    uint width = WIDTH, height = HEIGHT;
+    bool roofline = false;
+    int a = 1;
+    if (argc > 1 && argv[1][0] != '-') {
+        if (!load_scenario(argv[1], scenario_file))
+            return 1;
+        a = 2;
+    }
+    for (; a < argc; a++) {
+        if (strcmp(argv[a], "-r") == 0)
+            roofline = true;
+        else if (a + 1 == argc)
+            break;
+        else if (strcmp(argv[a], "-x") == 0)
+            export_pattern = argv[++a];
+        else if (strcmp(argv[a], "-n") == 0)
+            export_frames = std::max(1, atoi(argv[++a]));
+        else if (strcmp(argv[a], "-s") == 0 && sscanf(argv[++a], "%ux%u", &width, &height) != 2) {
+            std::cerr << "Size must look like 1920x1080" << std::endl;
+            return 1;
+        }
+    }
+    const bool offscreen = (export_pattern != NULL || roofline);
+    const Scenario& scenario = scenario_file.base;
+    if (scenario.grid != GRID || scenario.layers != LAYERS) {
+        std::cerr << "The viewer is built for a " << GRID << "x" << GRID << " grid with " << LAYERS << " layers" << std::endl;
+        return 1;
+    }
+
+    if (!initGLFW(3, 2, 1, true, offscreen))
         return 1;
 
     double t = 0;
 
-    Window window("Title", WIDTH, HEIGHT);
+    Window window("Title", width, height, Color(0), 1, offscreen);
 
 	std::cout << "----------------------------------------------------" << std::endl;
 	std::cout << "         OpenGL Version: " << glGetString(GL_VERSION) << std::endl;
 	std::cout << "----------------------------------------------------" << std::endl;
 
 
-    const double h_B = 1;
-    const double h_M = 0.4; // max height diff
+    const double h_B = scenario.h0;
+    const double h_M = scenario.hM; // max height diff
 
     Shader lit_displacement_shader(load_file_as_string("res/displacement_lit.vert"), load_file_as_string("res/lit.frag"));
     Shader unlit_displacement_shader(load_file_as_string("res/displacement.vert"), load_file_as_string("res/default.frag"));
     Shader default_shader(load_file_as_string("res/default.vert"), load_file_as_string("res/default.frag"));
     Shader ocean_shader(load_file_as_string("res/ocean.vert"), load_file_as_string("res/ocean.frag"));
+    Shader particle_shader(load_file_as_string("res/particles.vert"), load_file_as_string("res/particles.frag"));
+    Shader pick_shader(load_file_as_string("res/displacement.vert"), load_file_as_string("res/pick.frag"));
+
+    // Ground, then one per layer from the top
+    Shader* surface_shaders[LAYERS+1] = { &unlit_displacement_shader, &ocean_shader, &lit_displacement_shader, &lit_displacement_shader };
+    ShallowWaterModel<GRID,GRID,LAYERS> swm(scenario, surface_shaders);
 
-    ShallowWaterModel<75,75,3> swm(0.0001, h_M, h_B, 3, (Shader*[]){&unlit_displacement_shader, &ocean_shader, &lit_displacement_shader, &lit_displacement_shader, &lit_displacement_shader, &lit_displacement_shader});
+    ThreadPool pool;
+
+    if (!scenario.bathymetry.empty()) {
+        Field<GRID,GRID> bathymetry;
+        if (!load_bathymetry(scenario.bathymetry.c_str(), scenario.bathymetry_opts, bathymetry, pool))
+            return 1;
+        swm.set_bathymetry(bathymetry);
+    }
+
+    // Single threaded like the probes, the surfaces stay on the CPU
+    if (roofline) {
+        typedef ShallowWaterModel<GRID,GRID,LAYERS>::Engine Engine;
+        typedef Engine::real_type Real;
+        Engine& engine = swm.get_engine();
+        const double cells = (double)GRID * GRID;
+
+        const MachineRoofs roofs = probe_machine();
+        PerfCounters counters;
+        std::vector<KernelReport> kernels;
+        kernels.push_back(measure_kernel("step", cells, step_cost(GRID, GRID, LAYERS, sizeof(Real), false, scenario.min_depth > 0, engine.get_substeps()),
+                                         counters, [&]() { engine.step(); }));
+        // Every row rewritten, as when the whole surface moves
+        kernels.push_back(measure_kernel("displacement pack", cells, packing_cost(GRID, GRID, LAYERS, sizeof(Real)),
+                                         counters, [&]() { swm.invalidate_surfaces(); for (uint i = 0; i < LAYERS; i++) swm.pack_displacements(i, 0.5); }));
+        kernels.push_back(measure_kernel("normals", cells, normals_cost(GRID, GRID, LAYERS, sizeof(Real)),
+                                         counters, [&]() { for (uint i = 0; i < LAYERS; i++) swm.update_normals(i); }));
+        print_roofline(stdout, roofs, kernels, counters.is_available());
+
+        glfwTerminate();
+        return 0;
+    }
+
+    // Drifters on the top layer, stepped once every particle_every solver steps
+    ParticleSystem<GRID,GRID> particles;
+    for (uint i = 0; i < scenario.particles.size(); i++) {
+        const ParticlePatch& patch = scenario.particles[i];
+        particles.seed_disc(patch.count, patch.x, patch.y, patch.radius, i);
+    }
+    ParticleRenderer<GRID,GRID> particle_renderer(&particle_shader);
+    particle_shader.set_uniform("color", Vec(0.95, 0.45, 0.10, 1.0));
+    particle_renderer.upload(particles, swm.get_engine().get_h(0), &pool);
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    uint particle_steps = 0;
 
     Vec3f lightPos = Vecf(0, 1, -10) * 5;
 
-    Camera cam(perspective(70.0f, (float)WIDTH/HEIGHT, 0.1f, 1000.0f), Transform(Vecf(0, -h_B, -3)), Vecf(0, -h_B, 0));
+    Camera cam(perspective(70.0f, (float)width/height, 0.1f, 1000.0f), Transform(Vecf(0, -h_B, -3)), Vecf(0, -h_B, 0));
     Model<> sun(load_obj("res/sphere.obj"));
 
-    lit_displacement_shader.set_uniform("projMatrix", cam.get_proj_mat());
-    lit_displacement_shader.set_uniform("viewMatrix", *cam.get_transform());
+    // Camera and light state shared by every shader through the `Frame` block
+    UniformBuffer<FrameUniforms> frame_buffer(FRAME_BLOCK_BINDING);
+    FrameUniforms frame;
+    frame.set_proj(cam.get_proj_mat());
+    frame.set_light_direction(Vecf(0, 1, -10).norm());
+    frame.set_light_ambient(Vecf(1.0, 1.0, 1.0));
+    frame.set_light_diffuse(Vecf(1.0, 1.0, 1.0));
+    frame.set_light_specular(Vecf(1.0, 0.9, 0.7));
+
     lit_displacement_shader.set_uniform("color", Vec(0.00, 0.28, 0.73, 1.0));
-    lit_displacement_shader.set_uniform("lightDirection", Vec(0, 1, -10).norm());
     lit_displacement_shader.set_uniform("ambientLight", 0.3f);
 
-    unlit_displacement_shader.set_uniform("projMatrix", cam.get_proj_mat());
-    unlit_displacement_shader.set_uniform("viewMatrix", *cam.get_transform());
-
-    default_shader.set_uniform("projMatrix", cam.get_proj_mat());
-    default_shader.set_uniform("viewMatrix", *cam.get_transform());
-
-    ocean_shader.set_uniform("projMatrix", cam.get_proj_mat());
-    ocean_shader.set_uniform("viewMatrix", *cam.get_transform());
-    ocean_shader.set_uniform("viewPos", cam.get_transform().get_pos());
-    ocean_shader.set_uniform("lightDirection", Vec(0, 1, -10).norm());
-    ocean_shader.set_uniform("light.ambient", Vec(1.0, 1.0, 1.0));
-    ocean_shader.set_uniform("light.diffuse", Vec(1.0, 1.0, 1.0));
-    ocean_shader.set_uniform("light.specular", Vec(1.0, 0.9, 0.7));
     ocean_shader.set_uniform("heightMax", h_B+h_M/3);
     ocean_shader.set_uniform("heightMin", h_B-h_M/20);
 
     sun.get_transform().scale(0.5);
     sun.get_transform().set_pos(lightPos);
 
+    Uniform<Matrix4f> sun_model_matrix = default_shader.get_uniform_handle<Matrix4f>("modelMatrix");
+
     bool wireframe = false;
-    bool paused = true;
+    bool paused = !offscreen;
+
+    FrameExporter* exporter = (offscreen ? new FrameExporter(width, height, export_pattern) : NULL);
+
+    // Same pace as the old 10 steps per frame at 60Hz, but independent of the frame rate
+    SimulationClock sim_clock(swm.get_dt(), 10 * 60 * swm.get_dt());
+    sim_clock.set_paused(paused);
 
     window.set_bg_color(Color(0.49, 0.73, 0.91));
     window.loop([&]() -> void {
@@ -111,24 +214,83 @@ int main(void) {
             else
                 glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
         }
-        if (Input::get_key_down(Key::P))
+        if (Input::get_key_down(Key::P)) {
             paused = !paused;
+            sim_clock.set_paused(paused);
+        }
         if (Input::get_key_down(Key::SPACEBAR))
             swm.update();
 
-        default_shader.set_uniform("viewMatrix", *cam.get_transform());
-        default_shader.set_uniform("modelMatrix", *sun.get_transform());
+        // Disturbances where the cursor meets the water
+        const bool dragging_pressure = Input::get_key(Key::S);
+        if (Input::get_key_down(Key::D) || dragging_pressure) {
+            double px, py;
+            const Vec2 mouse = Input::get_mouse_pos();
+            const bool hit = swm.pick_surface(&pick_shader, mouse[0], mouse[1], px, py);
+            if (hit && Input::get_key_down(Key::D))
+                swm.drop(px, py, 0.5 * h_M, scenario.sigma);
+            // Low pressure, so the water bulges up under the cursor
+            if (hit && dragging_pressure)
+                swm.set_pressure(px, py, -0.1 * scenario.g * h_M, scenario.sigma);
+            else
+                swm.clear_pressure();
+        }
+        if (Input::get_key_up(Key::S))
+            swm.clear_pressure();
+
+        frame.set_view(*cam.get_transform());
+        frame.set_view_pos(cam.get_transform().get_pos());
+        frame_buffer.update(frame);
+
+        default_shader.enable();
+        sun_model_matrix.set(*sun.get_transform());
         sun.render();
 
-        ocean_shader.set_uniform("viewPos", cam.get_transform().get_pos());
+        if (!paused) {
+            // Exported frames are evenly spaced in simulated time, however long they take to render
+            if (offscreen) {
+                swm.update();
+                particle_steps += 10;
+            }
+            else {
+                sim_clock.advance([&]() -> void { swm.advance(1); particle_steps++; });
+                swm.sync_surfaces(sim_clock.get_alpha());
+            }
 
-        if (!paused)
-            swm.update();
-        swm.render(*cam.get_transform());
+            if (particle_steps >= scenario.particle_every && particles.size() > 0) {
+                const auto& engine = swm.get_engine();
+                const double dt = particle_steps * swm.get_dt();
+                if (scenario.particle_scheme == PARTICLES_RK4)
+                    particles.advect<RK4>(engine.get_u(0), engine.get_v(0), dt, &pool);
+                else
+                    particles.advect<RK2>(engine.get_u(0), engine.get_v(0), dt, &pool);
+                particle_renderer.upload(particles, engine.get_h(0), &pool);
+                particle_steps = 0;
+            }
+        }
+        swm.render();
+        particle_renderer.render();
+
+        if (exporter != NULL) {
+            exporter->capture();
+            if (exporter->get_captured() == export_frames)
+                window.close();
+        }
 
         t++;
     });
 
+    if (exporter != NULL) {
+        exporter->remove();
+        std::cout << "Saved " << exporter->get_captured() << " frames, " << exporter->get_stalls() << " stalls" << std::endl;
+        delete exporter;
+    }
+    particle_renderer.remove();
+    frame_buffer.remove();
+
     glfwTerminate();
+
+    // Only with SWE_TRACE, every frame of the session
+    TRACE_SAVE("trace.json");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,341 @@
+#ifndef __MULTIGRID_H__
+#define __MULTIGRID_H__
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "utils/types.h"
+#include "utils/thread_pool.h"
+
+// Conjugate gradients preconditioned by a geometric multigrid V-cycle, for the
+// variable coefficient Helmholtz problem
+//
+//     x - div(k grad x) = b
+//
+// on an nx x ny grid of cells with zero flux through the outer edge, in the
+// 5-point form x_c - sum_f k_f (x_nb - x_c) = b_c over the four faces f of a
+// cell. Nothing is assembled: every level keeps its unknowns and face
+// coefficients on a grid padded with one ring of cells, so the layout of level
+// 0 is that of an (nx+2) x (ny+2) Field and no loop needs bounds checks.
+//
+// Coarse cells merge 2 x 2 cells (a single row or column at an odd edge). Their
+// operator is the Galerkin one of piecewise constant interpolation with the
+// couplings halved, which is what rediscretizing at twice the spacing gives,
+// so coarse levels stay 5-point for any grid size. The hierarchy is allocated
+// once; update() only recomputes coefficients. The V-cycle is symmetric
+// (red-black on the way down, black-red on the way up), so it is a valid CG
+// preconditioner, which recovers the convergence piecewise constant
+// interpolation alone lacks.
+class HelmholtzMultigrid {
+public:
+    HelmholtzMultigrid() {}
+    HelmholtzMultigrid(uint nx, uint ny) { resize(nx, ny); }
+
+    void resize(uint nx, uint ny);
+
+    // Level 0 in padded coordinates, cell (x, y) for x in [1, nx], y in [1, ny]
+    // is at [x*(ny+2) + y]. kx there couples (x, y) with (x+1, y) and ky couples
+    // (x, y) with (x, y+1); faces onto the padding must stay zero. x is the
+    // initial guess and then the solution.
+    double* get_x() { return solution.data(); }
+    double* get_b() { return rhs.data(); }
+    double* get_kx() { return levels[0].kx.data(); }
+    double* get_ky() { return levels[0].ky.data(); }
+
+    // After changing level 0's coefficients, coarsens them down the hierarchy
+    void update(ThreadPool* pool = NULL);
+
+    // Iterates from the current x until the residual's RMS is below tol times
+    // the RMS of b, returns the number of iterations (one V-cycle each)
+    uint solve(double tol, uint max_iterations, ThreadPool* pool = NULL);
+
+    double get_residual() const { return residual; }
+    uint get_levels() const { return levels.size(); }
+
+private:
+    struct Level {
+        uint nx, ny, stride;
+        std::vector<double> x, b, r;
+        std::vector<double> mass, kx, ky, inv_diag;
+
+        size_t at(uint x, uint y) const { return (size_t)x * stride + y; }
+    };
+
+    std::vector<Level> levels;
+    std::vector<double> solution, rhs, p, q; // Level 0 CG vectors
+    double residual = 0;
+
+    uint smooth_sweeps = 2;
+    uint coarse_sweeps = 16;
+
+    // Levels smaller than this aren't worth waking the pool for
+    static const uint PARALLEL_CELLS = 4096;
+
+    template<typename F>
+    static void for_rows(const Level& l, ThreadPool* pool, const F& f);
+    template<typename F>
+    static double sum_rows(const Level& l, ThreadPool* pool, const F& f);
+
+    void apply(const Level& l, const double* x, double* out, ThreadPool* pool) const;
+    void smooth(Level& l, uint sweeps, bool reverse, ThreadPool* pool);
+    void cycle(uint i, ThreadPool* pool);
+};
+
+void HelmholtzMultigrid::resize(uint nx, uint ny) {
+    levels.clear();
+    while (true) {
+        Level l;
+        l.nx = nx;
+        l.ny = ny;
+        l.stride = ny + 2;
+        const size_t size = (size_t)(nx + 2) * (ny + 2);
+        l.x.assign(size, 0);
+        l.b.assign(size, 0);
+        l.r.assign(size, 0);
+        l.mass.assign(size, 1);
+        l.kx.assign(size, 0);
+        l.ky.assign(size, 0);
+        l.inv_diag.assign(size, 1);
+        levels.push_back(l);
+
+        if (nx <= 3 || ny <= 3)
+            break;
+        nx = (nx + 1) / 2;
+        ny = (ny + 1) / 2;
+    }
+
+    const size_t size = levels[0].x.size();
+    solution.assign(size, 0);
+    rhs.assign(size, 0);
+    p.assign(size, 0);
+    q.assign(size, 0);
+}
+
+template<typename F>
+void HelmholtzMultigrid::for_rows(const Level& l, ThreadPool* pool, const F& f) {
+    if (pool != NULL && l.nx * l.ny >= PARALLEL_CELLS)
+        pool->parallel_for(1, l.nx + 1, f);
+    else
+        f(1, l.nx + 1);
+}
+
+// Same split as for_rows, with one partial sum per worker
+template<typename F>
+double HelmholtzMultigrid::sum_rows(const Level& l, ThreadPool* pool, const F& f) {
+    if (pool == NULL || l.nx * l.ny < PARALLEL_CELLS)
+        return f(1, l.nx + 1);
+
+    const uint workers = pool->size();
+    std::vector<double> sums(workers, 0.0);
+    pool->run_on_all([&](uint k) {
+        sums[k] = f(1 + (unsigned long)l.nx * k / workers, 1 + (unsigned long)l.nx * (k+1) / workers);
+    });
+    double sum = 0;
+    for (uint k = 0; k < workers; k++)
+        sum += sums[k];
+    return sum;
+}
+
+void HelmholtzMultigrid::update(ThreadPool* pool) {
+    for (uint i = 0; i < levels.size(); i++) {
+        Level& l = levels[i];
+        if (i > 0) {
+            // Mass sums over the merged cells, couplings over the covered faces and are halved
+            const Level& f = levels[i-1];
+            for_rows(l, pool, [&](uint x0, uint x1) {
+                for (uint X = x0; X < x1; X++) {
+                    const uint x = 2*X - 1;
+                    const uint cols = (x + 1 <= f.nx ? 2 : 1);
+                    for (uint Y = 1; Y <= l.ny; Y++) {
+                        const uint y = 2*Y - 1;
+                        const uint rows = (y + 1 <= f.ny ? 2 : 1);
+                        double mass = 0, kx = 0, ky = 0;
+                        for (uint a = 0; a < cols; a++) {
+                            for (uint c = 0; c < rows; c++)
+                                mass += f.mass[f.at(x + a, y + c)];
+                        }
+                        // Faces on the right and top edge, zero at the outer edge of the grid
+                        for (uint c = 0; c < rows; c++)
+                            kx += f.kx[f.at(x + cols - 1, y + c)];
+                        for (uint a = 0; a < cols; a++)
+                            ky += f.ky[f.at(x + a, y + rows - 1)];
+                        l.mass[l.at(X,Y)] = mass;
+                        l.kx[l.at(X,Y)] = 0.5 * kx;
+                        l.ky[l.at(X,Y)] = 0.5 * ky;
+                    }
+                }
+            });
+        }
+        for_rows(l, pool, [&](uint x0, uint x1) {
+            for (uint x = x0; x < x1; x++) {
+                for (uint y = 1; y <= l.ny; y++) {
+                    const size_t c = l.at(x,y);
+                    l.inv_diag[c] = 1 / (l.mass[c] + l.kx[c - l.stride] + l.kx[c] + l.ky[c - 1] + l.ky[c]);
+                }
+            }
+        });
+    }
+}
+
+// out = A x
+void HelmholtzMultigrid::apply(const Level& l, const double* x, double* out, ThreadPool* pool) const {
+    const uint s = l.stride;
+    const double* __restrict mass = l.mass.data();
+    const double* __restrict kx = l.kx.data();
+    const double* __restrict ky = l.ky.data();
+    for_rows(l, pool, [&](uint x0, uint x1) {
+        for (uint i = x0; i < x1; i++) {
+            for (uint j = 1; j <= l.ny; j++) {
+                const size_t c = (size_t)i * s + j;
+                out[c] = mass[c] * x[c] - kx[c-s] * (x[c-s] - x[c]) - kx[c] * (x[c+s] - x[c])
+                                        - ky[c-1] * (x[c-1] - x[c]) - ky[c] * (x[c+1] - x[c]);
+            }
+        }
+    });
+}
+
+// Red-black Gauss-Seidel, cells of one colour only read the other, so rows run
+// in parallel. `reverse` visits black first, the adjoint sweep.
+void HelmholtzMultigrid::smooth(Level& l, uint sweeps, bool reverse, ThreadPool* pool) {
+    const uint s = l.stride;
+    double* __restrict x = l.x.data();
+    const double* __restrict b = l.b.data();
+    const double* __restrict kx = l.kx.data();
+    const double* __restrict ky = l.ky.data();
+    const double* __restrict inv_diag = l.inv_diag.data();
+    for (uint sweep = 0; sweep < sweeps; sweep++) {
+        for (uint k = 0; k < 2; k++) {
+            const uint colour = (reverse ? 1 - k : k);
+            for_rows(l, pool, [&](uint x0, uint x1) {
+                for (uint i = x0; i < x1; i++) {
+                    for (uint j = 2 - ((i + colour) & 1); j <= l.ny; j += 2) {
+                        const size_t c = (size_t)i * s + j;
+                        x[c] = (b[c] + kx[c-s] * x[c-s] + kx[c] * x[c+s] + ky[c-1] * x[c-1] + ky[c] * x[c+1]) * inv_diag[c];
+                    }
+                }
+            });
+        }
+    }
+}
+
+// One V-cycle on A x = b of level i from x = 0
+void HelmholtzMultigrid::cycle(uint i, ThreadPool* pool) {
+    Level& l = levels[i];
+    std::fill(l.x.begin(), l.x.end(), 0.0);
+    if (i + 1 == levels.size()) {
+        smooth(l, coarse_sweeps, false, pool);
+        smooth(l, coarse_sweeps, true, pool);
+        return;
+    }
+    smooth(l, smooth_sweeps, false, pool);
+
+    apply(l, l.x.data(), l.r.data(), pool);
+    Level& c = levels[i+1];
+    for_rows(c, pool, [&](uint x0, uint x1) {
+        for (uint X = x0; X < x1; X++) {
+            const uint x = 2*X - 1;
+            const uint cols = (x + 1 <= l.nx ? 2 : 1);
+            for (uint Y = 1; Y <= c.ny; Y++) {
+                const uint y = 2*Y - 1;
+                const uint rows = (y + 1 <= l.ny ? 2 : 1);
+                double sum = 0;
+                for (uint a = 0; a < cols; a++) {
+                    for (uint k = 0; k < rows; k++)
+                        sum += l.b[l.at(x + a, y + k)] - l.r[l.at(x + a, y + k)];
+                }
+                c.b[c.at(X,Y)] = sum;
+            }
+        }
+    });
+
+    cycle(i + 1, pool);
+
+    for_rows(l, pool, [&](uint x0, uint x1) {
+        for (uint x = x0; x < x1; x++) {
+            for (uint y = 1; y <= l.ny; y++)
+                l.x[l.at(x,y)] += c.x[c.at((x + 1) / 2, (y + 1) / 2)];
+        }
+    });
+    smooth(l, smooth_sweeps, true, pool);
+}
+
+uint HelmholtzMultigrid::solve(double tol, uint max_iterations, ThreadPool* pool) {
+    Level& l = levels[0];
+    double* x = solution.data();
+    double* r = l.b.data();
+    double* z = l.x.data();
+
+    // r = b - A x lives in level 0's b, which the V-cycle preconditions into z
+    apply(l, x, r, pool);
+    double r_sq = sum_rows(l, pool, [&](uint x0, uint x1) {
+        double sum = 0;
+        for (uint i = x0; i < x1; i++) {
+            for (uint j = 1; j <= l.ny; j++) {
+                const size_t c = l.at(i,j);
+                r[c] = rhs[c] - r[c];
+                sum += r[c] * r[c];
+            }
+        }
+        return sum;
+    });
+    double b_sq = sum_rows(l, pool, [&](uint x0, uint x1) {
+        double sum = 0;
+        for (uint i = x0; i < x1; i++) {
+            for (uint j = 1; j <= l.ny; j++)
+                sum += rhs[l.at(i,j)] * rhs[l.at(i,j)];
+        }
+        return sum;
+    });
+    const double target = tol * tol * std::max(b_sq, 1e-300);
+
+    uint iterations = 0;
+    double rz = 0;
+    while (r_sq > target && iterations < max_iterations) {
+        cycle(0, pool);
+        const double rz_next = sum_rows(l, pool, [&](uint x0, uint x1) {
+            double sum = 0;
+            for (uint i = x0; i < x1; i++) {
+                for (uint j = 1; j <= l.ny; j++)
+                    sum += r[l.at(i,j)] * z[l.at(i,j)];
+            }
+            return sum;
+        });
+        const double beta = (iterations > 0 ? rz_next / rz : 0);
+        rz = rz_next;
+        for_rows(l, pool, [&](uint x0, uint x1) {
+            for (uint i = x0; i < x1; i++) {
+                for (uint j = 1; j <= l.ny; j++)
+                    p[l.at(i,j)] = z[l.at(i,j)] + beta * p[l.at(i,j)];
+            }
+        });
+
+        apply(l, p.data(), q.data(), pool);
+        const double pq = sum_rows(l, pool, [&](uint x0, uint x1) {
+            double sum = 0;
+            for (uint i = x0; i < x1; i++) {
+                for (uint j = 1; j <= l.ny; j++)
+                    sum += p[l.at(i,j)] * q[l.at(i,j)];
+            }
+            return sum;
+        });
+        const double alpha = rz / pq;
+        r_sq = sum_rows(l, pool, [&](uint x0, uint x1) {
+            double sum = 0;
+            for (uint i = x0; i < x1; i++) {
+                for (uint j = 1; j <= l.ny; j++) {
+                    const size_t c = l.at(i,j);
+                    x[c] += alpha * p[c];
+                    r[c] -= alpha * q[c];
+                    sum += r[c] * r[c];
+                }
+            }
+            return sum;
+        });
+        iterations++;
+    }
+    residual = std::sqrt(r_sq / ((double)l.nx * l.ny));
+    return iterations;
+}
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef __PARTICLE_RENDERER_H__
+#define __PARTICLE_RENDERER_H__
+
+#include <GLFW/glfw3.h>
+#include <leon/transform.h>
+
+#include "utils/types.h"
+#include "utils/thread_pool.h"
+#include "utils/opengl/constants.h"
+#include "utils/opengl/shader.h"
+#include "field.h"
+#include "particles.h"
+
+// Draws a ParticleSystem as GL points riding on a surface. Positions are
+// streamed every upload: the buffer is orphaned and mapped, and the workers
+// write world positions straight into the mapping, so there is no staging copy.
+template<uint N, uint M>
+class ParticleRenderer {
+public:
+    ParticleRenderer(Shader* shader_, float point_size = 2);
+
+    // `surface` is the height field the particles float on, usually h[0]
+    template<typename T>
+    void upload(const ParticleSystem<N,M>& particles, const Field<N,M,T>& surface, ThreadPool* pool = NULL);
+    void render();
+    void remove();
+
+    Transform& get_transform() { return transform; }
+
+private:
+    GLuint vao, vbo;
+    size_t count = 0;
+
+    Shader* shader;
+    Uniform<Matrix4f> model_matrix;
+    Transform transform;
+};
+
+template<uint N, uint M>
+ParticleRenderer<N,M>::ParticleRenderer(Shader* shader_, float point_size): shader(shader_) {
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STREAM_DRAW);
+    glEnableVertexAttribArray(VERTEX_ATTRIB);
+    glVertexAttribPointer(VERTEX_ATTRIB, 3, GL_FLOAT, false, 0, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    model_matrix = shader->get_uniform_handle<Matrix4f>("modelMatrix");
+    shader->set_uniform("pointSize", point_size);
+
+    // Same footprint as the surface meshes
+    transform.scale(5, 1, 5);
+}
+
+template<uint N, uint M>
+template<typename T>
+void ParticleRenderer<N,M>::upload(const ParticleSystem<N,M>& particles, const Field<N,M,T>& surface, ThreadPool* pool) {
+    count = particles.size();
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, count * 3 * sizeof(float), NULL, GL_STREAM_DRAW);
+    float* out = (float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, count * 3 * sizeof(float),
+                                          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (out == NULL) {
+        fprintf(stderr, "ERROR Failed to map particle buffer!\n");
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        count = 0;
+        return;
+    }
+
+    // Grid x runs along the mesh's z and grid y along its x, see gen_plane
+    const float* px = particles.get_x();
+    const float* py = particles.get_y();
+    auto fill = [&](uint lo, uint hi) {
+        float height[PARTICLE_BLOCK];
+        for (uint b = lo; b < hi; b += PARTICLE_BLOCK) {
+            const uint n = std::min(PARTICLE_BLOCK, hi - b);
+            sample_bilinear(surface, px + b, py + b, height, n);
+            for (uint k = 0; k < n; k++) {
+                float* v = out + 3 * (size_t)(b + k);
+                v[0] = py[b+k] / (M-1) - 0.5f;
+                v[1] = height[k];
+                v[2] = px[b+k] / (N-1) - 0.5f;
+            }
+        }
+    };
+    if (pool != NULL)
+        pool->parallel_for(0, count, fill);
+    else
+        fill(0, count);
+
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+template<uint N, uint M>
+void ParticleRenderer<N,M>::render() {
+    if (count == 0)
+        return;
+    shader->enable();
+    model_matrix.set(*transform);
+    glBindVertexArray(vao);
+    glDrawArrays(GL_POINTS, 0, count);
+    glBindVertexArray(0);
+}
+
+template<uint N, uint M>
+void ParticleRenderer<N,M>::remove() {
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+}
+
+#endif
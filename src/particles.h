@@ -0,0 +1,305 @@
+#ifndef __PARTICLES_H__
+#define __PARTICLES_H__
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "utils/types.h"
+#include "utils/thread_pool.h"
+#include "field.h"
+
+// Lagrangian drifters advected by a layer's u/v. Positions are stored as
+// structure of arrays in grid units, x in [0, N-1] along u and y in [0, M-1]
+// along v, so interpolation needs no scaling. Particles are processed in
+// blocks of PARTICLE_BLOCK: each RK stage samples the whole block in one
+// branch-free loop over contiguous floats, which the compiler turns into
+// gathers and packed arithmetic. GCC only vectorizes the float to int
+// conversion with -fno-trapping-math.
+static const uint PARTICLE_BLOCK = 256;
+
+// Bilinear interpolation of f at n positions, clamped to the grid
+template<uint N, uint M, typename T>
+inline void sample_bilinear(const Field<N,M,T>& f, const float* __restrict px, const float* __restrict py, float* __restrict out, uint n) {
+    const T* data = f.get_data();
+    for (uint k = 0; k < n; k++) {
+        // Clamps on values and signed conversions, so the loop if-converts
+        float x = px[k], y = py[k];
+        x = std::min(std::max(x, 0.0f), float(N-1));
+        y = std::min(std::max(y, 0.0f), float(M-1));
+        const int x0 = (int)std::min(x, float(N-2));
+        const int y0 = (int)std::min(y, float(M-2));
+        const float fx = x - x0, fy = y - y0;
+        const int i = x0 * (int)M + y0;
+        out[k] = (1-fx) * ((1-fy) * float(data[i])   + fy * float(data[i+1]))
+               +    fx  * ((1-fy) * float(data[i+M]) + fy * float(data[i+M+1]));
+    }
+}
+
+// Tracer time steppers over one block. `velocity(px, py, vx, vy, n)` writes
+// the displacement per unit time in grid units; the velocity field is held
+// fixed over the step.
+struct RK2 {
+    template<typename Velocity>
+    static void step(float* px, float* py, uint n, float dt, const Velocity& velocity) {
+        float kx[PARTICLE_BLOCK], ky[PARTICLE_BLOCK];
+        float mx[PARTICLE_BLOCK], my[PARTICLE_BLOCK];
+
+        // Midpoint rule
+        velocity(px, py, kx, ky, n);
+        for (uint k = 0; k < n; k++) {
+            mx[k] = px[k] + 0.5f*dt * kx[k];
+            my[k] = py[k] + 0.5f*dt * ky[k];
+        }
+        velocity(mx, my, kx, ky, n);
+        for (uint k = 0; k < n; k++) {
+            px[k] += dt * kx[k];
+            py[k] += dt * ky[k];
+        }
+    }
+};
+
+struct RK4 {
+    template<typename Velocity>
+    static void step(float* px, float* py, uint n, float dt, const Velocity& velocity) {
+        float kx[PARTICLE_BLOCK], ky[PARTICLE_BLOCK];
+        float sx[PARTICLE_BLOCK], sy[PARTICLE_BLOCK];
+        float ax[PARTICLE_BLOCK], ay[PARTICLE_BLOCK];
+
+        // k1
+        velocity(px, py, kx, ky, n);
+        for (uint k = 0; k < n; k++) {
+            ax[k] = kx[k];
+            ay[k] = ky[k];
+            sx[k] = px[k] + 0.5f*dt * kx[k];
+            sy[k] = py[k] + 0.5f*dt * ky[k];
+        }
+        // k2
+        velocity(sx, sy, kx, ky, n);
+        for (uint k = 0; k < n; k++) {
+            ax[k] += 2*kx[k];
+            ay[k] += 2*ky[k];
+            sx[k] = px[k] + 0.5f*dt * kx[k];
+            sy[k] = py[k] + 0.5f*dt * ky[k];
+        }
+        // k3
+        velocity(sx, sy, kx, ky, n);
+        for (uint k = 0; k < n; k++) {
+            ax[k] += 2*kx[k];
+            ay[k] += 2*ky[k];
+            sx[k] = px[k] + dt * kx[k];
+            sy[k] = py[k] + dt * ky[k];
+        }
+        // k4
+        velocity(sx, sy, kx, ky, n);
+        for (uint k = 0; k < n; k++) {
+            px[k] += dt/6 * (ax[k] + kx[k]);
+            py[k] += dt/6 * (ay[k] + ky[k]);
+        }
+    }
+};
+
+template<uint N, uint M>
+class ParticleSystem {
+public:
+    ParticleSystem(uint sort_every_ = 16): sort_every(sort_every_) {}
+
+    // Position in the same normalised [0, 1] coordinates as Scenario bumps
+    void add(float x, float y);
+    // `count` particles uniformly over a disc, radius also normalised
+    void seed_disc(uint count, float x, float y, float radius, uint seed = 0);
+    void clear();
+
+    // Moves every particle over `dt` through the velocity field (u, v)
+    template<typename Scheme, typename T>
+    void advect(const Field<N,M,T>& u, const Field<N,M,T>& v, double dt, ThreadPool* pool = NULL);
+
+    // Reorders the arrays by grid cell, so a block reads few distinct rows of u/v
+    void sort_by_cell(ThreadPool* pool = NULL);
+
+    size_t size() const { return px.size(); }
+    const float* get_x() const { return px.data(); }
+    const float* get_y() const { return py.data(); }
+    // Original index of each particle, stable across sorts
+    const uint32_t* get_ids() const { return ids.data(); }
+
+private:
+    std::vector<float> px, py;
+    std::vector<uint32_t> ids;
+    std::vector<float> scratch_x, scratch_y;
+    std::vector<uint32_t> scratch_ids;
+    // Cell of every particle, and the counters of sort_by_cell
+    std::vector<uint> keys, scratch_keys;
+    std::vector<uint> bucket_offsets, cell_offsets;
+
+    uint sort_every;
+    uint steps_since_sort = 0;
+
+    template<typename F>
+    static void for_ranges(ThreadPool* pool, uint n, const F& f);
+};
+
+template<uint N, uint M>
+void ParticleSystem<N,M>::add(float x, float y) {
+    px.push_back(x * (N-1));
+    py.push_back(y * (M-1));
+    ids.push_back(ids.size());
+}
+
+template<uint N, uint M>
+void ParticleSystem<N,M>::seed_disc(uint count, float x, float y, float radius, uint seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0, 1);
+    px.reserve(px.size() + count);
+    py.reserve(py.size() + count);
+    ids.reserve(ids.size() + count);
+    for (uint k = 0; k < count; k++) {
+        const float r = radius * std::sqrt(unit(rng));
+        const float a = 2 * M_PI * unit(rng);
+        add(std::min(std::max(x + r * std::cos(a), 0.0f), 1.0f),
+            std::min(std::max(y + r * std::sin(a), 0.0f), 1.0f));
+    }
+}
+
+template<uint N, uint M>
+void ParticleSystem<N,M>::clear() {
+    px.clear();
+    py.clear();
+    ids.clear();
+}
+
+template<uint N, uint M>
+template<typename F>
+void ParticleSystem<N,M>::for_ranges(ThreadPool* pool, uint n, const F& f) {
+    if (pool != NULL)
+        pool->parallel_for(0, n, f);
+    else
+        f(0, n);
+}
+
+template<uint N, uint M>
+template<typename Scheme, typename T>
+void ParticleSystem<N,M>::advect(const Field<N,M,T>& u, const Field<N,M,T>& v, double dt, ThreadPool* pool) {
+    if (++steps_since_sort >= sort_every) {
+        sort_by_cell(pool);
+        steps_since_sort = 0;
+    }
+
+    // Domain is [0, 1] over N grid spacings (see the engine's dx), so one unit
+    // of velocity moves N cells per unit time
+    const float scale_x = N, scale_y = M;
+    auto velocity = [&](const float* x, const float* y, float* vx, float* vy, uint n) {
+        sample_bilinear(u, x, y, vx, n);
+        sample_bilinear(v, x, y, vy, n);
+        for (uint k = 0; k < n; k++) {
+            vx[k] *= scale_x;
+            vy[k] *= scale_y;
+        }
+    };
+
+    float* x = px.data();
+    float* y = py.data();
+    for_ranges(pool, px.size(), [&](uint lo, uint hi) {
+        for (uint b = lo; b < hi; b += PARTICLE_BLOCK) {
+            const uint n = std::min(PARTICLE_BLOCK, hi - b);
+            Scheme::step(x + b, y + b, n, (float)dt, velocity);
+
+            // Walls are closed, keep everything inside the grid
+            for (uint k = b; k < b + n; k++) {
+                x[k] = std::min(std::max(x[k], 0.0f), float(N-1));
+                y[k] = std::min(std::max(y[k], 0.0f), float(M-1));
+            }
+        }
+    });
+}
+
+// Parallel counting sort in two stable passes, with counters for the grid
+// once plus workers² rather than a whole grid per worker. The first pass
+// splits the particles by which worker's range of cells they are in, then
+// every worker sorts its own range by cell.
+template<uint N, uint M>
+void ParticleSystem<N,M>::sort_by_cell(ThreadPool* pool) {
+    const uint n = px.size();
+    const uint cells = N * M;
+    const uint workers = (pool != NULL ? pool->size() : 1);
+
+    keys.resize(n);
+    scratch_keys.resize(n);
+    scratch_x.resize(n);
+    scratch_y.resize(n);
+    scratch_ids.resize(n);
+    bucket_offsets.assign((size_t)workers * workers, 0);
+    cell_offsets.resize(cells);
+    std::vector<uint> bucket_start(workers + 1);
+
+    // Worker b owns the cells [first_cell(b), first_cell(b+1))
+    auto bucket = [&](uint c) { return (uint)((unsigned long)c * workers / cells); };
+    auto first_cell = [&](uint b) { return (uint)(((unsigned long)b * cells + workers - 1) / workers); };
+    auto per_worker = [&](const std::function<void(uint)>& f) {
+        if (pool != NULL)
+            pool->run_on_all(f);
+        else
+            f(0);
+    };
+
+    // Every worker keys its contiguous chunk of the particles and counts them per bucket
+    per_worker([&](uint w) {
+        uint* count = &bucket_offsets[(size_t)w * workers];
+        for (uint k = (unsigned long)n * w / workers; k < (unsigned long)n * (w+1) / workers; k++) {
+            keys[k] = std::min((uint)px[k], N-1) * M + std::min((uint)py[k], M-1);
+            count[bucket(keys[k])]++;
+        }
+    });
+
+    // Exclusive prefix over (bucket, worker), so each worker's run of a bucket
+    // is placed after the runs of lower workers and the split stays stable
+    uint offset = 0;
+    for (uint b = 0; b < workers; b++) {
+        bucket_start[b] = offset;
+        for (uint w = 0; w < workers; w++) {
+            uint& count = bucket_offsets[(size_t)w * workers + b];
+            const uint k = count;
+            count = offset;
+            offset += k;
+        }
+    }
+    bucket_start[workers] = offset;
+
+    per_worker([&](uint w) {
+        uint* next = &bucket_offsets[(size_t)w * workers];
+        for (uint k = (unsigned long)n * w / workers; k < (unsigned long)n * (w+1) / workers; k++) {
+            const uint dst = next[bucket(keys[k])]++;
+            scratch_keys[dst] = keys[k];
+            scratch_x[dst] = px[k];
+            scratch_y[dst] = py[k];
+            scratch_ids[dst] = ids[k];
+        }
+    });
+
+    // Worker b counts, places and moves back only the particles of its cells
+    per_worker([&](uint b) {
+        const uint lo = first_cell(b);
+        uint* next = cell_offsets.data() + lo;
+        std::fill(next, cell_offsets.data() + first_cell(b+1), 0);
+        for (uint k = bucket_start[b]; k < bucket_start[b+1]; k++)
+            next[scratch_keys[k] - lo]++;
+        uint offset = bucket_start[b];
+        for (uint c = 0; c < first_cell(b+1) - lo; c++) {
+            const uint k = next[c];
+            next[c] = offset;
+            offset += k;
+        }
+        for (uint k = bucket_start[b]; k < bucket_start[b+1]; k++) {
+            const uint dst = next[scratch_keys[k] - lo]++;
+            px[dst] = scratch_x[k];
+            py[dst] = scratch_y[k];
+            ids[dst] = scratch_ids[k];
+        }
+    });
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __PRECISION_MONITOR_H__
+#define __PRECISION_MONITOR_H__
+
+#include <algorithm>
+#include <cmath>
+
+#include "utils/types.h"
+#include "utils/thread_pool.h"
+#include "field.h"
+#include "scenario.h"
+#include "shallow_water_engine.h"
+
+// How far a reduced precision run has drifted from the double reference
+struct PrecisionReport {
+    uint t = 0;
+    double max_error = 0;    // Largest |h - h_ref| over every layer surface
+    double rms_error = 0;    // Root mean square of h - h_ref over every layer surface
+    double energy_error = 0; // |E - E_ref| / E_ref
+};
+
+// Runs a double precision engine from the same scenario alongside one of any
+// precision, stepping it lazily up to the other's time step when compared.
+// All differences are accumulated in double.
+template<uint N, uint M, uint L = 1, typename Boundary = ReflectiveBoundary, typename Integrator = ForwardEuler, typename Sources = NoSources>
+class PrecisionMonitor {
+public:
+    typedef ShallowWaterEngine<N,M,L,Boundary,Integrator,double,Sources> Reference;
+
+    PrecisionMonitor(const Scenario& scenario, Boundary boundary = Boundary(), Sources sources = Sources()): reference(scenario, boundary, sources) {}
+
+    template<typename T>
+    void set_bathymetry(const Field<N,M,T>& h_B) { reference.set_bathymetry(h_B); }
+    void set_thread_pool(ThreadPool* pool) { reference.set_thread_pool(pool); }
+
+    template<typename Real>
+    PrecisionReport compare(const ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>& engine);
+
+    const PrecisionReport& get_worst() const { return worst; }
+    const Reference& get_reference() const { return reference; }
+
+private:
+    Reference reference;
+    PrecisionReport worst;
+};
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Sources>
+template<typename Real>
+PrecisionReport PrecisionMonitor<N,M,L,Boundary,Integrator,Sources>::compare(const ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>& engine) {
+    if (reference.get_t() < engine.get_t())
+        reference.advance(engine.get_t() - reference.get_t());
+
+    PrecisionReport report;
+    report.t = engine.get_t();
+
+    double sum_sq = 0;
+    for (uint i = 0; i < L; i++) {
+        const Field<N,M,Real>& h = engine.get_h(i);
+        const Field<N,M,double>& h_ref = reference.get_h(i);
+        for (size_t k = 0; k < Field<N,M,double>::size; k++) {
+            const double d = h(k) - h_ref(k);
+            report.max_error = std::max(report.max_error, std::fabs(d));
+            sum_sq += d*d;
+        }
+    }
+    report.rms_error = std::sqrt(sum_sq / ((double)L * N * M));
+
+    const double E_ref = reference.calc_total_energy();
+    report.energy_error = (E_ref != 0 ? std::fabs(engine.calc_total_energy() - E_ref) / E_ref : 0);
+
+    worst.t = report.t;
+    worst.max_error = std::max(worst.max_error, report.max_error);
+    worst.rms_error = std::max(worst.rms_error, report.rms_error);
+    worst.energy_error = std::max(worst.energy_error, report.energy_error);
+    return report;
+}
+
+#endif
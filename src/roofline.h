@@ -0,0 +1,328 @@
+#ifndef __ROOFLINE_H__
+#define __ROOFLINE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "utils/types.h"
+
+// How close the solver kernels run to what the machine can do. The roofs are
+// measured at startup: a STREAM triad for bandwidth, once over arrays far
+// larger than any cache and once over a cache-sized working set, and
+// independent vector multiply-add chains for the arithmetic peak of the
+// instruction set this binary was built for (-march=native raises it). Bytes
+// and flops of each kernel are counted analytically, so the report shows
+// achieved GB/s and GFLOP/s against
+//
+//     roof = min(peak flops, arithmetic intensity * bandwidth)
+//
+// Byte counts are compulsory traffic, every field streamed once per pass
+// and no write-allocate, the same convention as STREAM.
+
+// Bytes and flops of one call of a kernel
+struct KernelCost {
+    double bytes = 0;
+    double flops = 0;
+};
+
+struct MachineRoofs {
+    double dram_bandwidth = 0;  // Bytes/s, triad over DRAM-sized arrays
+    double cache_bandwidth = 0; // Bytes/s, triad over ROOFLINE_CACHE_BYTES
+    double peak_flops = 0;      // Flops/s, double
+};
+
+// Working sets of the bandwidth probes
+static const size_t ROOFLINE_DRAM_BYTES = (size_t)3 << 26; // 3 x 64 MB
+static const size_t ROOFLINE_CACHE_BYTES = (size_t)3 << 16; // 3 x 64 KB, about one 150x150 grid in double
+// Each probe and kernel runs for at least this long
+static const double ROOFLINE_MIN_SECONDS = 0.2;
+
+// Calls f until ROOFLINE_MIN_SECONDS have passed, mean seconds per call
+template<typename F>
+double time_per_call(const F& f) {
+    f(); // Warm up caches and page in
+    uint calls = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    do {
+        f();
+        calls++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < ROOFLINE_MIN_SECONDS);
+    return elapsed / calls;
+}
+
+// a = b + s * c, 24 bytes and 2 flops per element
+static double probe_triad(size_t bytes) {
+    const size_t n = std::max(bytes / (3 * sizeof(double)), (size_t)1024);
+    std::vector<double> a(n, 0), b(n, 1), c(n, 2);
+    const double s = 1.0000001;
+    double* pa = a.data();
+    const double* pb = b.data();
+    const double* pc = c.data();
+    const double seconds = time_per_call([&]() {
+        for (size_t i = 0; i < n; i++)
+            pa[i] = pb[i] + s * pc[i];
+    });
+    // Keeps the stores observable
+    if (a[n/2] == 42)
+        printf(" ");
+    return 3 * sizeof(double) * n / seconds;
+}
+
+// Widest vector of the instruction set this binary was built for
+#if defined(__AVX512F__)
+typedef double RooflineVector __attribute__((vector_size(64)));
+#elif defined(__AVX__)
+typedef double RooflineVector __attribute__((vector_size(32)));
+#else
+typedef double RooflineVector __attribute__((vector_size(16)));
+#endif
+
+// Eight independent x = x * a + b chains of full vectors, enough to keep
+// both the multiply and add latencies covered
+static double probe_peak_flops() {
+    const uint LANES = sizeof(RooflineVector) / sizeof(double);
+    const uint ITERATIONS = 1 << 16;
+    RooflineVector x0 = RooflineVector{} + 1.0, x1 = x0 + 1e-3, x2 = x1 + 1e-3, x3 = x2 + 1e-3;
+    RooflineVector x4 = x3 + 1e-3, x5 = x4 + 1e-3, x6 = x5 + 1e-3, x7 = x6 + 1e-3;
+    const RooflineVector a = RooflineVector{} + 0.999999, b = RooflineVector{} + 1e-7;
+    const double seconds = time_per_call([&]() {
+        for (uint k = 0; k < ITERATIONS; k++) {
+            x0 = x0 * a + b;  x1 = x1 * a + b;  x2 = x2 * a + b;  x3 = x3 * a + b;
+            x4 = x4 * a + b;  x5 = x5 * a + b;  x6 = x6 * a + b;  x7 = x7 * a + b;
+        }
+    });
+    const RooflineVector sum = x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7;
+    if (sum[0] == 42)
+        printf(" ");
+    return 2.0 * 8 * LANES * ITERATIONS / seconds;
+}
+
+MachineRoofs probe_machine() {
+    MachineRoofs roofs;
+    roofs.dram_bandwidth = probe_triad(ROOFLINE_DRAM_BYTES);
+    roofs.cache_bandwidth = probe_triad(ROOFLINE_CACHE_BYTES);
+    roofs.peak_flops = probe_peak_flops();
+    return roofs;
+}
+
+
+// Analytic costs, per call over an N x M grid.
+//
+// Explicit step(), per layer i:
+//   pressure   h[0] into p, then p += h[j] for j < i+1: reads Real and double, writes double; 1 or 2 flops
+//   wet spans  thickness from two surfaces, one flag byte written and read back (min_depth > 0 only)
+//   stencil    u, v, h, the surface below and p read, next u, v, h written; 49 flops, see below
+//   filter     prev, cur and next of u, v, h read, cur written, 4 flops each (Leapfrog only)
+// Stencil flops of a wet cell: 4 velocity differences and their divisions (8),
+// pressure gradient (4), thickness at 5 points and its gradient (9), two
+// momentum tendencies (14), continuity tendency (6), three updates (6) and
+// the positivity clamp (2). ForwardEuler never reads the previous level.
+//
+// Split into `substeps`, layer 0's pressure, wet spans and stencil run that
+// many times, each adding h[0] into the double surface mean (Real and double
+// read, double written; 1 flop). Once a step u, v, h of layer 0 are copied
+// aside, the mean is cleared and scaled (1 flop), and the other layers'
+// pressure starts from the mean instead of h[0].
+KernelCost step_cost(uint N, uint M, uint L, size_t real_bytes, bool filtered, bool drying, uint substeps) {
+    const double cells = (double)N * M;
+    const double s = real_bytes;
+    const bool split = (substeps > 1);
+    KernelCost cost;
+    for (uint i = 0; i < L; i++) {
+        const double passes = (i == 0 ? substeps : 1);
+        KernelCost layer;
+        layer.bytes += cells * ((split && i > 0 ? 8 : s) + 8) + cells * i * (s + 16);
+        layer.flops += cells * (1 + 2.0 * i);
+        if (drying) {
+            layer.bytes += cells * (2 * s + 2);
+            layer.flops += cells * 2;
+        }
+        layer.bytes += cells * ((filtered ? 10 : 7) * s + 8);
+        layer.flops += cells * 49;
+        if (filtered) {
+            layer.bytes += cells * 12 * s;
+            layer.flops += cells * 3 * 4;
+        }
+        if (split && i == 0) {
+            layer.bytes += cells * (s + 16);
+            layer.flops += cells;
+        }
+        cost.bytes += passes * layer.bytes;
+        cost.flops += passes * layer.flops;
+    }
+    if (split) {
+        cost.bytes += cells * (6 * s + 8 + 16);
+        cost.flops += cells;
+    }
+    return cost;
+}
+
+// Normals of every surface: h read once, 3 floats written; 2 differences,
+// 6 products, and normalising (3 squares, 2 adds, a square root, 3 divisions)
+KernelCost normals_cost(uint N, uint M, uint L, size_t real_bytes) {
+    KernelCost cost;
+    cost.bytes = (double)L * N * M * (real_bytes + 12);
+    cost.flops = (double)L * N * M * 17;
+    return cost;
+}
+
+// Displacement packing of every surface: prev + alpha (h - prev) into a
+// scratch field (2 reads, a write, 3 flops), then copied into the vertex
+// array as 3 floats
+KernelCost packing_cost(uint N, uint M, uint L, size_t real_bytes) {
+    KernelCost cost;
+    cost.bytes = (double)L * N * M * (4 * real_bytes + 12);
+    cost.flops = (double)L * N * M * 3;
+    return cost;
+}
+
+
+// Cycles, instructions and last level cache misses of the calling thread,
+// through perf_event_open where the kernel allows it (perf_event_paranoid
+// <= 2, and not blocked by a container's seccomp profile)
+class PerfCounters {
+public:
+    enum { CYCLES, INSTRUCTIONS, CACHE_MISSES, COUNT };
+
+    PerfCounters();
+    ~PerfCounters();
+
+    bool is_available() const { return available; }
+
+    void start();
+    // Counts since start(), false if they couldn't be read
+    bool stop(uint64_t counts[COUNT]);
+
+private:
+    int fds[COUNT];
+    bool available = false;
+};
+
+#ifdef __linux__
+PerfCounters::PerfCounters() {
+    const uint64_t configs[COUNT] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+    available = true;
+    for (uint k = 0; k < COUNT; k++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[k];
+        attr.disabled = (k == 0);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        fds[k] = syscall(SYS_perf_event_open, &attr, 0, -1, (k == 0 ? -1 : fds[0]), 0);
+        available = available && fds[k] >= 0;
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (uint k = 0; k < COUNT; k++) {
+        if (fds[k] >= 0)
+            close(fds[k]);
+    }
+}
+
+void PerfCounters::start() {
+    if (!available)
+        return;
+    ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+bool PerfCounters::stop(uint64_t counts[COUNT]) {
+    if (!available)
+        return false;
+    ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    uint64_t values[1 + COUNT];
+    if (read(fds[0], values, sizeof(values)) != (ssize_t)sizeof(values) || values[0] != COUNT)
+        return false;
+    for (uint k = 0; k < COUNT; k++)
+        counts[k] = values[1 + k];
+    return true;
+}
+#else
+PerfCounters::PerfCounters() {
+    for (uint k = 0; k < COUNT; k++)
+        fds[k] = -1;
+}
+PerfCounters::~PerfCounters() {}
+void PerfCounters::start() {}
+bool PerfCounters::stop(uint64_t counts[COUNT]) { return false; }
+#endif
+
+
+// One kernel's line of the report
+struct KernelReport {
+    std::string name;
+    double cells = 0;   // Per call, the per-cell columns divide by this
+    KernelCost cost;
+    double seconds = 0; // Per call
+    bool counted = false;
+    uint64_t counts[PerfCounters::COUNT];
+};
+
+// Times f and reads the counters over the same calls
+template<typename F>
+KernelReport measure_kernel(const std::string& name, double cells, const KernelCost& cost, PerfCounters& counters, const F& f) {
+    KernelReport report;
+    report.name = name;
+    report.cells = cells;
+    report.cost = cost;
+
+    counters.start();
+    uint calls = 0;
+    report.seconds = time_per_call([&]() { f(); calls++; });
+    report.counted = counters.stop(report.counts);
+    if (report.counted) {
+        // time_per_call's calls, the warm-up included
+        for (uint k = 0; k < PerfCounters::COUNT; k++)
+            report.counts[k] /= calls;
+    }
+    return report;
+}
+
+void print_roofline(FILE* out, const MachineRoofs& roofs, const std::vector<KernelReport>& kernels, bool counters) {
+    fprintf(out, "Bandwidth %.1f GB/s (DRAM, %zu MB triad), %.1f GB/s (cache, %zu KB triad), peak %.2f GFLOP/s\n",
+            roofs.dram_bandwidth * 1e-9, ROOFLINE_DRAM_BYTES >> 20, roofs.cache_bandwidth * 1e-9, ROOFLINE_CACHE_BYTES >> 10, roofs.peak_flops * 1e-9);
+    fprintf(out, "%-20s %10s %10s %6s %8s %7s %8s %10s %11s", "kernel", "bytes/cell", "flops/cell", "AI", "ns/cell", "GB/s", "GFLOP/s", "%roof DRAM", "%roof cache");
+    if (counters)
+        fprintf(out, " %6s %13s", "IPC", "LLC miss/cell");
+    fprintf(out, "\n");
+
+    for (uint k = 0; k < kernels.size(); k++) {
+        const KernelReport& r = kernels[k];
+        const double intensity = r.cost.flops / r.cost.bytes;
+        const double achieved_flops = r.cost.flops / r.seconds;
+        const double roof_dram = std::min(roofs.peak_flops, intensity * roofs.dram_bandwidth);
+        const double roof_cache = std::min(roofs.peak_flops, intensity * roofs.cache_bandwidth);
+        fprintf(out, "%-20s %10.1f %10.1f %6.2f %8.2f %7.2f %8.2f %9.0f%% %10.0f%%",
+                r.name.c_str(), r.cost.bytes / r.cells, r.cost.flops / r.cells, intensity, r.seconds / r.cells * 1e9,
+                r.cost.bytes / r.seconds * 1e-9, achieved_flops * 1e-9, 100 * achieved_flops / roof_dram, 100 * achieved_flops / roof_cache);
+        if (counters && r.counted) {
+            fprintf(out, " %6.2f %13.3f", (double)r.counts[PerfCounters::INSTRUCTIONS] / std::max(r.counts[PerfCounters::CYCLES], (uint64_t)1),
+                    r.counts[PerfCounters::CACHE_MISSES] / r.cells);
+        }
+        fprintf(out, "\n");
+    }
+    if (!counters)
+        fprintf(out, "Hardware counters unavailable (perf_event_open denied or not Linux)\n");
+}
+
+#endif
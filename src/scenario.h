@@ -0,0 +1,389 @@
+#ifndef __SCENARIO_H__
+#define __SCENARIO_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils/types.h"
+#include "utils/numa.h"
+#include "bathymetry.h"
+#include "async_writer.h"
+
+enum ParticleScheme {
+    PARTICLES_RK2,
+    PARTICLES_RK4
+};
+
+enum TimeScheme {
+    SCHEME_EXPLICIT,      // Forward Euler, dt limited by the gravity wave speed
+    SCHEME_SEMI_IMPLICIT  // Implicit surface terms and a multigrid solve per layer and step
+};
+
+enum Precision {
+    PRECISION_DOUBLE,
+    PRECISION_FLOAT  // float32 state, checked against a double reference
+};
+
+// Everything that used to be hardcoded in the model constructor and main.
+//
+// Scenario files are `key = value` lines, '#' starts a comment. Keys in the
+// [sweep] section list values to sweep over, either comma separated
+// (`damp = 1, 2, 3`) or as an inclusive range `start:stop:step`:
+//
+//     name   = two_bumps
+//     layers = 3
+//     dt     = 0.0001
+//     bump   = 0.714 0.75      # x y [amplitude], repeatable
+//     bump   = 0.123 0.5643
+//     particles = 100000 0.5 0.5 0.2 # count x y radius, repeatable
+//     gauge  = harbour 0.2 0.8 # name x y, repeatable
+//
+//     [sweep]
+//     damp  = 1, 2, 3
+//     sigma = 0.03:0.07:0.01
+struct Bump {
+    double x, y;
+    double amplitude; // Relative to hM
+};
+
+// Drifters seeded uniformly over a disc, in the same coordinates as bumps
+struct ParticlePatch {
+    uint count;
+    double x, y, radius;
+};
+
+// Fixed station recording h, u and v, same coordinates as bumps
+struct GaugeStation {
+    std::string name;
+    double x, y;
+};
+
+struct Scenario {
+    std::string name = "default";
+
+    uint grid = 75;   // N = M, must match a compiled size
+    uint layers = 3;
+
+    double dt = 0.0001;
+    uint barotropic_substeps = 1; // Split explicit multi-layer step: the top layer subcycles at dt / n
+    double damp = 3;
+    double g = 1;
+    double h0 = 1;    // Rest height of the top surface
+    double hM = 0.4;  // Bump height
+    double sigma = 0.05;
+    double min_depth = 1e-4; // Thinner layers are dry, 0 treats every cell as wet
+    std::vector<Bump> bumps = { {5.0/7, 3.0/4, 1}, {0.123, 0.5643, 1} };
+    std::vector<double> densities; // Of each layer top to bottom, default 1 + i/3
+
+    // Momentum sources (sources.h), all off by default
+    double coriolis_f0 = 0, coriolis_beta = 0;
+    double bottom_drag = 0;          // Quadratic drag coefficient of the floor
+    double wind_stress[2] = { 0, 0 }; // Uniform surface stress, x and y
+
+    uint steps = 1000;
+    uint output_every = 0; // Steps between saved frames, 0 only saves the end
+    uint output_queue = 8; // Frames buffered for the writer thread
+    WritePolicy output_policy = WRITE_BLOCK; // When frames outrun the disk
+    std::string publish;   // Shared memory ring for live viewers (frame_ring.h), e.g. /swe
+    uint publish_every = 10; // Steps between published frames
+    uint threads = 1;      // Threads given to this run's solver
+    uint tile_size = 0;    // Tiles of the barrier-free task graph in cells, 0 steps row-parallel
+    std::vector<uint> cpu_map; // CPUs of the solver's threads in order, e.g. 0-7,16-23; empty leaves them unpinned
+    HugePages huge_pages = HUGE_PAGES_NONE; // Backing of the fields, placed by the threads stepping them
+    bool numa_report = false;  // Prints how much field memory is on another node than its thread
+    Precision precision = PRECISION_DOUBLE;
+
+    TimeScheme scheme = SCHEME_EXPLICIT;
+    double solver_tol = 1e-8;    // Semi-implicit solve, relative to the right hand side
+    uint solver_iterations = 50; // Cap per solve
+
+    std::vector<ParticlePatch> particles;
+    uint particle_every = 10; // Solver steps per particle step
+    ParticleScheme particle_scheme = PARTICLES_RK2;
+
+    std::vector<GaugeStation> gauges;
+    uint gauge_layers = 1; // Layers recorded at each gauge, from the top
+
+    std::string bathymetry;
+    BathymetryOptions bathymetry_opts;
+
+    double get_density(uint i) const { return i < densities.size() ? densities[i] : 1 + i/3.0; }
+    bool has_sources() const { return coriolis_f0 != 0 || coriolis_beta != 0 || bottom_drag != 0 || wind_stress[0] != 0 || wind_stress[1] != 0; }
+
+    bool set(const std::string& key, const std::string& value);
+};
+
+bool Scenario::set(const std::string& key, const std::string& value) {
+    std::istringstream in(value);
+    if      (key == "name")      in >> name;
+    else if (key == "grid")      in >> grid;
+    else if (key == "layers")    in >> layers;
+    else if (key == "dt")        in >> dt;
+    else if (key == "barotropic_substeps") in >> barotropic_substeps;
+    else if (key == "damp")      in >> damp;
+    else if (key == "g")         in >> g;
+    else if (key == "h0")        in >> h0;
+    else if (key == "hM")        in >> hM;
+    else if (key == "sigma")     in >> sigma;
+    else if (key == "min_depth") in >> min_depth;
+    else if (key == "steps")     in >> steps;
+    else if (key == "output_every") in >> output_every;
+    else if (key == "threads")   in >> threads;
+    else if (key == "tile_size") in >> tile_size;
+    else if (key == "bump") {
+        Bump b = { 0, 0, 1 };
+        in >> b.x >> b.y;
+        if (!(in >> b.amplitude))
+            b.amplitude = 1;
+        bumps.push_back(b);
+        return true;
+    }
+    else if (key == "densities") {
+        densities.clear();
+        double d;
+        while (in >> d)
+            densities.push_back(d);
+        return true;
+    }
+    else if (key == "coriolis") {
+        if (!(in >> coriolis_f0))
+            return false;
+        if (!(in >> coriolis_beta))
+            coriolis_beta = 0;
+        return true;
+    }
+    else if (key == "bottom_drag") in >> bottom_drag;
+    else if (key == "wind_stress") in >> wind_stress[0] >> wind_stress[1];
+    else if (key == "solver_tol") in >> solver_tol;
+    else if (key == "solver_iterations") in >> solver_iterations;
+    else if (key == "scheme") {
+        if      (value == "explicit")      scheme = SCHEME_EXPLICIT;
+        else if (value == "semi_implicit") scheme = SCHEME_SEMI_IMPLICIT;
+        else return false;
+        return true;
+    }
+    else if (key == "particle_every") in >> particle_every;
+    else if (key == "gauge_layers") in >> gauge_layers;
+    else if (key == "output_queue") in >> output_queue;
+    else if (key == "publish") {
+        publish = value;
+        return true;
+    }
+    else if (key == "publish_every") in >> publish_every;
+    else if (key == "numa_report") in >> numa_report;
+    else if (key == "cpu_map") {
+        cpu_map = parse_cpu_map(value);
+        return !cpu_map.empty();
+    }
+    else if (key == "huge_pages") {
+        if      (value == "none")        huge_pages = HUGE_PAGES_NONE;
+        else if (value == "transparent") huge_pages = HUGE_PAGES_TRANSPARENT;
+        else if (value == "explicit")    huge_pages = HUGE_PAGES_EXPLICIT;
+        else return false;
+        return true;
+    }
+    else if (key == "output_policy") {
+        if      (value == "block")   output_policy = WRITE_BLOCK;
+        else if (value == "drop")    output_policy = WRITE_DROP;
+        else if (value == "coarsen") output_policy = WRITE_COARSEN;
+        else return false;
+        return true;
+    }
+    else if (key == "particles") {
+        ParticlePatch patch;
+        in >> patch.count >> patch.x >> patch.y >> patch.radius;
+        if (in.fail())
+            return false;
+        particles.push_back(patch);
+        return true;
+    }
+    else if (key == "gauge") {
+        GaugeStation g;
+        in >> g.name >> g.x >> g.y;
+        if (in.fail())
+            return false;
+        gauges.push_back(g);
+        return true;
+    }
+    else if (key == "particle_scheme") {
+        if      (value == "rk2") particle_scheme = PARTICLES_RK2;
+        else if (value == "rk4") particle_scheme = PARTICLES_RK4;
+        else return false;
+        return true;
+    }
+    else if (key == "precision") {
+        if      (value == "double") precision = PRECISION_DOUBLE;
+        else if (value == "float")  precision = PRECISION_FLOAT;
+        else return false;
+        return true;
+    }
+    else if (key == "bathymetry") {
+        bathymetry = value;
+        return true;
+    }
+    else if (key == "bathymetry_format") {
+        if      (value == "f32") bathymetry_opts.format = RASTER_F32;
+        else if (value == "i16") bathymetry_opts.format = RASTER_I16;
+        else if (value == "pgm") bathymetry_opts.format = RASTER_PGM;
+        else return false;
+        return true;
+    }
+    else if (key == "bathymetry_resample") {
+        if      (value == "bilinear") bathymetry_opts.resample = RESAMPLE_BILINEAR;
+        else if (value == "area")     bathymetry_opts.resample = RESAMPLE_AREA;
+        else return false;
+        return true;
+    }
+    else if (key == "bathymetry_scale")  in >> bathymetry_opts.scale;
+    else if (key == "bathymetry_offset") in >> bathymetry_opts.offset;
+    else if (key == "bathymetry_width")  in >> bathymetry_opts.width;
+    else if (key == "bathymetry_height") in >> bathymetry_opts.height;
+    else
+        return false;
+    return !in.fail();
+}
+
+
+// One swept key and the values it takes
+struct SweepAxis {
+    std::string key;
+    std::vector<std::string> values;
+};
+
+struct ScenarioFile {
+    Scenario base;
+    std::vector<SweepAxis> sweep;
+
+    // Cartesian product of the sweep axes applied on top of the base scenario,
+    // false if a value doesn't apply
+    bool expand(std::vector<Scenario>& jobs) const;
+};
+
+// Values one range such as 0.1:1:0.05 may expand to, a typo in the step
+// shouldn't queue millions of jobs
+static const uint MAX_SWEEP_VALUES = 1000;
+
+namespace {
+    std::string trim(const std::string& s) {
+        size_t b = s.find_first_not_of(" \t\r");
+        size_t e = s.find_last_not_of(" \t\r");
+        return (b == std::string::npos ? "" : s.substr(b, e - b + 1));
+    }
+
+    bool parse_sweep_values(const std::string& value, std::vector<std::string>& out) {
+        if (value.find(':') != std::string::npos) {
+            double start, stop, step;
+            if (sscanf(value.c_str(), "%lf:%lf:%lf", &start, &stop, &step) != 3 || !(step > 0) || !(stop >= start))
+                return false;
+            const double steps = std::floor((stop - start) / step + 1e-9);
+            if (!(steps < MAX_SWEEP_VALUES))
+                return false;
+            uint count = (uint)steps + 1;
+            for (uint i = 0; i < count; i++) {
+                char buf[64];
+                snprintf(buf, sizeof(buf), "%.10g", start + i * step);
+                out.push_back(buf);
+            }
+            return true;
+        }
+        std::istringstream in(value);
+        std::string item;
+        while (std::getline(in, item, ','))
+            out.push_back(trim(item));
+        return !out.empty();
+    }
+}
+
+// Scenario file syntax from any stream, `path` only names it in errors
+bool parse_scenario(std::istream& input, const char* path, ScenarioFile& file) {
+    bool in_sweep = false;
+    bool bumps_given = false;
+    std::string line;
+    for (uint n = 1; std::getline(input, line); n++) {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+        if (line[0] == '[') {
+            in_sweep = (line == "[sweep]");
+            continue;
+        }
+
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            fprintf(stderr, "ERROR %s:%u: expected 'key = value'!\n", path, n);
+            return false;
+        }
+        std::string key = trim(line.substr(0, eq));
+        std::string value = trim(line.substr(eq + 1));
+
+        if (in_sweep) {
+            SweepAxis axis;
+            axis.key = key;
+            if (!parse_sweep_values(value, axis.values)) {
+                fprintf(stderr, "ERROR %s:%u: bad sweep values for '%s'!\n", path, n, key.c_str());
+                return false;
+            }
+            for (uint k = 0; k < axis.values.size(); k++) {
+                Scenario probe;
+                if (!probe.set(key, axis.values[k])) {
+                    fprintf(stderr, "ERROR %s:%u: bad sweep value '%s' for '%s'!\n", path, n, axis.values[k].c_str(), key.c_str());
+                    return false;
+                }
+            }
+            file.sweep.push_back(axis);
+            continue;
+        }
+
+        // Bumps in a file replace the default pair instead of adding to it
+        if (key == "bump" && !bumps_given) {
+            file.base.bumps.clear();
+            bumps_given = true;
+        }
+        if (!file.base.set(key, value)) {
+            fprintf(stderr, "ERROR %s:%u: bad value for '%s'!\n", path, n, key.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load_scenario(const char* path, ScenarioFile& file) {
+    std::ifstream input(path);
+    if (input.fail()) {
+        fprintf(stderr, "ERROR Failed to open scenario file: %s!\n", path);
+        return false;
+    }
+    return parse_scenario(input, path, file);
+}
+
+bool ScenarioFile::expand(std::vector<Scenario>& jobs) const {
+    jobs.assign(1, base);
+    for (uint a = 0; a < sweep.size(); a++) {
+        std::vector<Scenario> next;
+        for (uint j = 0; j < jobs.size(); j++) {
+            for (uint k = 0; k < sweep[a].values.size(); k++) {
+                Scenario s = jobs[j];
+                // A swept bump is the job's only one, as in the file itself
+                if (sweep[a].key == "bump")
+                    s.bumps.clear();
+                if (!s.set(sweep[a].key, sweep[a].values[k])) {
+                    fprintf(stderr, "ERROR Bad sweep value '%s' for '%s'!\n", sweep[a].values[k].c_str(), sweep[a].key.c_str());
+                    return false;
+                }
+                s.name += "_" + sweep[a].key + "=" + sweep[a].values[k];
+                next.push_back(s);
+            }
+        }
+        jobs.swap(next);
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef __SHALLOW_WATER_1D_H__
+#define __SHALLOW_WATER_1D_H__
+
+#include <algorithm>
+#include <cmath>
+#include <leon/vector.h>
+
+#include "utils/types.h"
+#include "boundary.h"
+#include "integrator.h"
+#include "kernels.h"
+#include "scenario.h"
+
+// Single-layer shallow water along a transect, built from the same kernels,
+// boundary policies and integrators as ShallowWaterEngine with every y term
+// zero. Defaults to the leapfrog scheme test.cpp used.
+//
+// Wetting and drying follow the 2D engine: water thinner than min_depth is
+// dry, land starts with its surface on the floor, a cell exchanges water with
+// a neighbour only over a face that is wet on at least one side, closed faces
+// are walls and dry cells hold no velocity.
+template<uint N, typename Boundary = ReflectiveBoundary, typename Integrator = Leapfrog>
+class ShallowWater1D {
+public:
+    ShallowWater1D(const Scenario& scenario, const Vector<N>& h_B_ = Vector<N>(0.0), Boundary boundary_ = Boundary());
+
+    void step();
+    void advance(uint steps);
+
+    // Overwrites the state at both time levels, e.g. with initial conditions
+    void set_state(const Vector<N>& u_, const Vector<N>& h_);
+
+    const Vector<N>& get_u() const { return u; }
+    const Vector<N>& get_h() const { return h; }
+    const Vector<N>& get_h_B() const { return h_B; }
+
+    double get_dt() const { return dt; }
+    uint get_t() const { return t; }
+
+private:
+    double dt, dx;
+    double g;
+    double damp;
+    double min_depth;
+    uint t = 0;
+
+    Vector<N> u, prev_u;
+    Vector<N> h, prev_h;
+    Vector<N> h_B;
+
+    double rest_h;
+    double wave_speed;
+
+    Boundary boundary;
+};
+
+template<uint N, typename Boundary, typename Integrator>
+ShallowWater1D<N,Boundary,Integrator>::ShallowWater1D(const Scenario& scenario, const Vector<N>& h_B_, Boundary boundary_):
+        dt(scenario.dt), dx(1.0 / N), g(scenario.g), damp(scenario.damp), min_depth(scenario.min_depth),
+        u(0.0), prev_u(0.0), h(0.0), prev_h(0.0), h_B(h_B_), boundary(boundary_) {
+    // Same Gaussian initial condition as the 2D engine, along x only
+    rest_h = scenario.h0;
+    double sigma = scenario.sigma;
+    double mean_h_B = 0;
+    for (uint x = 0; x < N; x++) {
+        double xx = (double)x / (N-1);
+        h[x] = rest_h;
+        for (uint b = 0; b < scenario.bumps.size(); b++) {
+            double d = xx - scenario.bumps[b].x;
+            h[x] += scenario.bumps[b].amplitude * scenario.hM * exp(-d*d/(2*sigma*sigma));
+        }
+        // Land starts dry, no surface below the floor
+        h[x] = std::max(h[x], h_B[x]);
+        prev_h[x] = h[x];
+        mean_h_B += h_B[x] / N;
+    }
+    wave_speed = std::sqrt(std::max(g * (rest_h - mean_h_B), 0.0));
+}
+
+template<uint N, typename Boundary, typename Integrator>
+void ShallowWater1D<N,Boundary,Integrator>::set_state(const Vector<N>& u_, const Vector<N>& h_) {
+    prev_u = u = u_;
+    prev_h = h = h_;
+}
+
+template<uint N, typename Boundary, typename Integrator>
+void ShallowWater1D<N,Boundary,Integrator>::step() {
+    Vector<N> next_u(0.0), next_h(0.0);
+
+    // With min_depth 0 every cell counts as wet, as in the 2D engine
+    auto wet = [&](uint x) { return min_depth <= 0 || h[x] - h_B[x] > min_depth; };
+    // A face is open if the higher surface is above the higher floor
+    auto open = [&](uint x, uint n) { return std::max(h[x], h[n]) > std::max(h_B[x], h_B[n]) + min_depth; };
+
+    for (uint x = 1; x < N-1; x++) {
+        const double eta_c = h[x] - h_B[x];
+        const double du_dx = (u[x+1] - u[x-1]) / dx;
+
+        if (wet(x) && wet(x-1) && wet(x+1)) {
+            const double deta_dx = ((h[x+1] - h_B[x+1]) - (h[x-1] - h_B[x-1])) / dx;
+            const double dp_dx = g * (h[x+1] - h[x-1]) / dx;
+
+            next_u[x] = Integrator::advance(u[x], prev_u[x], dt, momentum_tendency(u[x], u[x], 0.0, du_dx, 0.0, dp_dx, 1.0, damp));
+            next_h[x] = std::max(Integrator::advance(h[x], prev_h[x], dt, continuity_tendency(eta_c, u[x], 0.0, deta_dx, 0.0, du_dx, 0.0)), h_B[x]);
+            continue;
+        }
+
+        // Shoreline or land: closed faces mirror the cell's own values, like a wall
+        const bool open_m = open(x, x-1), open_p = open(x, x+1);
+        if (!(wet(x) || wet(x-1) || wet(x+1)) || !(open_m || open_p)) {
+            next_u[x] = 0;
+            next_h[x] = h[x];
+            continue;
+        }
+        const double h_m = (open_m ? h[x-1] : h[x]), h_p = (open_p ? h[x+1] : h[x]);
+        const double eta_m = (open_m ? h[x-1] - h_B[x-1] : eta_c), eta_p = (open_p ? h[x+1] - h_B[x+1] : eta_c);
+
+        double u_next = Integrator::advance(u[x], prev_u[x], dt, momentum_tendency(u[x], u[x], 0.0, du_dx, 0.0, g * (h_p - h_m) / dx, 1.0, damp));
+        if (!open_m) u_next = std::max(u_next, 0.0);
+        if (!open_p) u_next = std::min(u_next, 0.0);
+        next_u[x] = (wet(x) ? u_next : 0.0);
+        const double h_next = Integrator::advance(h[x], prev_h[x], dt, continuity_tendency(std::max(eta_c, 0.0), u[x], 0.0, (eta_p - eta_m) / dx, 0.0, du_dx, 0.0));
+        next_h[x] = std::max(h_next, h_B[x]);
+    }
+
+    BoundaryContext ctx = { rest_h, wave_speed * dt / dx, 0, dt };
+    boundary.apply(next_u, next_h, u, h, ctx);
+    // Edges copied from a lower neighbour mustn't sink into a higher floor
+    next_h[0] = std::max(next_h[0], h_B[0]);
+    next_h[N-1] = std::max(next_h[N-1], h_B[N-1]);
+
+    if (Integrator::filtered) {
+        for (uint x = 0; x < N; x++) {
+            u[x] = Integrator::filter(prev_u[x], u[x], next_u[x]);
+            h[x] = Integrator::filter(prev_h[x], h[x], next_h[x]);
+        }
+    }
+
+    prev_u = u;
+    prev_h = h;
+    u = next_u;
+    h = next_h;
+    t++;
+}
+
+template<uint N, typename Boundary, typename Integrator>
+void ShallowWater1D<N,Boundary,Integrator>::advance(uint steps) {
+    for (uint i = 0; i < steps; i++)
+        step();
+}
+
+#endif
@@ -0,0 +1,1120 @@
+#ifndef __SHALLOW_WATER_ENGINE_H__
+#define __SHALLOW_WATER_ENGINE_H__
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+#include "utils/types.h"
+#include "utils/thread_pool.h"
+#include "utils/tile_scheduler.h"
+#include "utils/trace.h"
+#include "field.h"
+#include "boundary.h"
+#include "integrator.h"
+#include "kernels.h"
+#include "sources.h"
+#include "multigrid.h"
+#include "scenario.h"
+
+// Faces of a cell in open_faces() masks
+enum {
+    FACE_XM = 1, FACE_XP = 2,
+    FACE_YM = 4, FACE_YP = 8,
+    FACE_ALL = 15
+};
+
+// Undivided differences across a cell whose closed faces mirror its own value, as at a wall
+template<typename F>
+inline double open_dx(const F& f, uint x, uint y, uint faces) {
+    const double c = f.at(x,y);
+    return ((faces & FACE_XP) ? (double)f.at(x+1,y) : c) - ((faces & FACE_XM) ? (double)f.at(x-1,y) : c);
+}
+
+template<typename F>
+inline double open_dy(const F& f, uint x, uint y, uint faces) {
+    const double c = f.at(x,y);
+    return ((faces & FACE_YP) ? (double)f.at(x,y+1) : c) - ((faces & FACE_YM) ? (double)f.at(x,y-1) : c);
+}
+
+// Stops the flow through closed faces
+inline void close_faces(double& u, double& v, uint faces) {
+    if (!(faces & FACE_XM)) u = std::max(u, 0.0);
+    if (!(faces & FACE_XP)) u = std::min(u, 0.0);
+    if (!(faces & FACE_YM)) v = std::max(v, 0.0);
+    if (!(faces & FACE_YP)) v = std::min(v, 0.0);
+}
+
+// CPU side of the multi-layer shallow water model, no rendering state so it
+// can run headless. Layer 0 is the top, h[i] is the height of the surface of
+// layer i above the floor.
+//
+// Real is the precision of the prognostic fields. With float the stencil
+// moves half the bytes; pressure sums and diagnostics still accumulate in
+// double, and PrecisionMonitor (precision_monitor.h) measures the drift.
+//
+// Cells thinner than the scenario's min_depth are dry. Each step first finds
+// the spans of every row that are wet or border a wet cell; the stencil only
+// runs over those, dry cells are held at rest, and the cells along a
+// shoreline are redone with the faces they can't exchange water through
+// treated as walls. No surface drops below the one beneath it.
+//
+// With a TileScheduler the explicit step runs as a task graph instead: each
+// tile of the grid advances one layer of one step per task, as soon as its
+// neighbours have done the tasks before it, so there is no barrier between
+// layers or steps. Each layer keeps three time levels so a tile can write the
+// next one while a neighbour one task behind still reads the current one.
+//
+// Sources adds Coriolis, friction or wind to the momentum tendencies inside
+// the same stencil (sources.h), NoSources compiles to the bare equations.
+//
+// With barotropic_substeps = n > 1 the explicit step is split by speed. Each
+// layer's continuity carries only its own flux and only the top layer feels
+// the full g, so the fast external gravity wave lives in layer 0: it
+// subcycles n times at dt / n, and the layers beneath, bound only by their
+// slow interface waves, take one step of dt against the mean of the top
+// surface over the substeps.
+template<uint N, uint M, uint L = 1, typename Boundary = ReflectiveBoundary, typename Integrator = ForwardEuler, typename Real = double,
+         typename Sources = NoSources>
+class ShallowWaterEngine {
+public:
+    typedef Real real_type;
+
+    ShallowWaterEngine(const Scenario& scenario, Boundary boundary_ = Boundary(), Sources sources_ = Sources());
+
+    void step();
+    void advance(uint steps);
+    // Calls after_step() after every step, e.g. to sample gauges
+    template<typename F>
+    void advance(uint steps, const F& after_step);
+
+    template<typename T>
+    void set_bathymetry(const Field<N,M,T>& h_B_);
+
+    // Overwrites layer i at both time levels, e.g. with initial conditions
+    template<typename T>
+    void set_state(uint i, const Field<N,M,T>& u_, const Field<N,M,T>& v_, const Field<N,M,T>& h_);
+
+    // Adds a Gaussian to the top surface at both time levels, centre and
+    // sigma in the coordinates of the scenario's bumps. Never lowers it
+    // below the surface beneath.
+    void add_drop(double x, double y, double amplitude, double sigma);
+
+    double calc_total_energy() const;
+
+    // Rows [x0, x1) of layer i's surface written since the last call, which
+    // empties the span, x0 == x1 if none. A step writes every row, a drop
+    // only those it reaches.
+    void take_dirty_rows(uint i, uint& x0, uint& x1);
+    // Rows where the surface may differ between h and prev_h
+    void get_moving_rows(uint i, uint& x0, uint& x1) const { x0 = moving_rows[i][0]; x1 = moving_rows[i][1]; }
+
+    const Field<N,M,Real>& get_u(uint i) const { return u[i]; }
+    const Field<N,M,Real>& get_v(uint i) const { return v[i]; }
+    const Field<N,M,Real>& get_h(uint i) const { return h[i]; }
+    const Field<N,M,Real>& get_prev_h(uint i) const { return prev_h[i]; }
+    const Field<N,M,Real>& get_h_B() const { return h_B; }
+
+    Boundary& get_boundary() { return boundary; }
+    Sources& get_sources() { return sources; }
+
+    // Fraction of the interior cells the last layer stepped ran the stencil on,
+    // not updated by tiled steps
+    double get_active_fraction() const { return active_fraction; }
+
+    // Solver iterations of the last step and over all steps, zero unless semi-implicit
+    uint get_solver_iterations() const { return solver_iterations; }
+    unsigned long get_total_solver_iterations() const { return total_solver_iterations; }
+
+    // Splits the rows of each step across `pool`, NULL runs single threaded
+    void set_thread_pool(ThreadPool* pool_) { pool = pool_; }
+
+    // Steps tiles of about tile_size cells square on `scheduler` instead,
+    // NULL goes back to the pool. Only the explicit, unfiltered, unsplit step
+    // with a tileable boundary has a tiled path, anything else ignores this.
+    void set_tile_scheduler(TileScheduler* scheduler, uint tile_size);
+
+    // Moves every field the step streams through to fresh pages backed as
+    // `huge` asks, each row first touched by the pool worker that steps it
+    // (this thread without a pool). Pin the pool first, or a worker may touch
+    // a page on one node and run on another. The state is unchanged.
+    void place_fields(HugePages huge);
+
+    // Bytes of those fields on another NUMA node than the worker stepping
+    // them, out of `total`; both zero where the nodes are unknown
+    size_t count_remote_bytes(size_t& total);
+
+    double get_dt() const { return dt; }
+    uint get_t() const { return t; }
+    // Substeps of the top layer per step, 1 when the step isn't split
+    uint get_substeps() const { return substeps; }
+
+private:
+    typedef std::integral_constant<bool, Boundary::tileable && !Integrator::filtered && !Integrator::implicit> tiles_supported;
+    // Leapfrog's previous level and the implicit solve don't mix with substeps
+    static const bool splittable = !Integrator::filtered && !Integrator::implicit;
+
+    // Time levels of layer `layer` one stencil pass reads and writes
+    struct Levels {
+        uint layer;
+        const Field<N,M,Real> *u, *v, *h, *prev_u, *prev_v, *prev_h;
+        Field<N,M,Real> *next_u, *next_v, *next_h;
+    };
+
+    // Pressure over a tile and its halo, indexed like the whole field
+    struct TilePressure {
+        const double* data;
+        uint x0, y0, cols;
+
+        double at(uint x, uint y) const { return data[(size_t)(x - x0) * cols + (y - y0)]; }
+        double dx(uint x, uint y) const { return at(x+1, y) - at(x-1, y); }
+        double dy(uint x, uint y) const { return at(x, y+1) - at(x, y-1); }
+    };
+
+    // Cells [x0, x1) x [y0, y1) of a tile, the outer ring goes with the tiles along it
+    struct Tile {
+        uint x0, x1, y0, y1;
+    };
+
+    double dt, dx, dy;
+    double g;
+    double damp;
+    uint t = 0;
+
+    Field<N,M,Real> u[L], prev_u[L];
+    Field<N,M,Real> v[L], prev_v[L];
+    Field<N,M,Real> h[L], prev_h[L];
+    Field<N,M,Real> h_B;
+
+    // Scratch, the next time level of the layer being stepped and its pressure
+    Field<N,M,Real> next_u, next_v, next_h;
+    Field<N,M,double> p;
+
+    float densities[L+1];
+    double rest_h[L];
+    double wave_speed[L];
+
+    Boundary boundary;
+    Sources sources;
+    ThreadPool* pool = NULL;
+
+    // Wet/dry state of the layer being stepped: [lo, hi) pairs of y to compute
+    // in each row, and the shoreline cells of each row to redo
+    double min_depth;
+    std::vector<unsigned char> wet, faces;
+    uint dry_cells[N];
+    std::vector<uint> wet_spans[N];
+    std::vector<uint> shore[N];
+    double active_fraction = 1;
+
+    // Tiled stepping: the third time level of every layer and each worker's
+    // pressure and wetness over the tile it is on
+    TileScheduler* scheduler = NULL;
+    uint tiles_x = 0, tiles_y = 0;
+    std::vector<Tile> tiles;
+    std::vector<Field<N,M,Real> > spare_u, spare_v, spare_h;
+    std::vector<std::vector<double> > tile_p;
+    std::vector<std::vector<unsigned char> > tile_wet;
+
+    // Mode splitting: the top layer at the start of the step, which ends up
+    // as its previous level, and its surface averaged over the substeps
+    uint substeps = 1;
+    std::vector<Field<N,M,Real> > split_start;
+    std::vector<Field<N,M,double> > surface_mean;
+
+    // Rows of each layer's surface written since take_dirty_rows, and rows
+    // where its two time levels may differ, both as [x0, x1)
+    uint dirty_rows[L][2];
+    uint moving_rows[L][2];
+
+    HelmholtzMultigrid solver;
+    double solver_tol;
+    uint max_solver_iterations;
+    uint solver_iterations = 0;
+    unsigned long total_solver_iterations = 0;
+
+    template<typename F>
+    void for_rows(const F& rows);
+    template<typename F>
+    void for_all_rows(const F& rows);
+    std::vector<Field<N,M,Real>*> stepped_fields();
+    template<typename T>
+    void place_field(Field<N,M,T>& f, HugePages huge);
+    template<typename T>
+    void count_remote(const Field<N,M,T>& f, std::atomic<size_t>& remote, std::atomic<size_t>& total);
+    template<typename Eta>
+    void find_wet_spans(const Eta& eta);
+    SourceCell source_cell(uint i, uint x, uint y, double thickness, double inv_density) const {
+        SourceCell c = { i, L, x, y, y * dy, thickness, inv_density };
+        return c;
+    }
+    template<typename Eta>
+    uint open_faces(const Field<N,M,Real>& h_i, const Eta& eta, uint x, uint y) const;
+    // The hot loop of both paths, inlined whatever the call count says
+    template<typename P, typename Eta>
+    __attribute__((always_inline)) void wet_cell(const Levels& s, const P& p, const Eta& eta, double inv_density, uint x, uint y) const;
+    template<typename P, typename Eta>
+    void shore_cell(const Levels& s, const P& p, const Eta& eta, double inv_density, uint x, uint y) const;
+    template<typename Eta>
+    void step_layer(uint i, const Eta& eta);
+    template<typename Eta>
+    void step_tile(uint i, const Levels& s, const Field<N,M,Real>* const* surfaces, const Eta& eta, const Tile& tile, uint worker);
+    void advance_tiled(uint steps, std::true_type);
+    void advance_tiled(uint steps, std::false_type) {}
+    template<typename Eta>
+    void step_layer_implicit(uint i, const Eta& eta);
+    void subcycle_top_layer();
+    void finish_layer(uint i);
+    void update_wave_speeds();
+    // The surface layer 0 rests on, layer 1's or the floor
+    const Field<N,M,Real>& below_top() const { return below_top(std::integral_constant<bool, (L > 1)>()); }
+    const Field<N,M,Real>& below_top(std::true_type) const { return h[1]; }
+    const Field<N,M,Real>& below_top(std::false_type) const { return h_B; }
+    void mark_rows(uint i, uint x0, uint x1);
+    void mark_all_rows();
+};
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::ShallowWaterEngine(const Scenario& scenario, Boundary boundary_, Sources sources_):
+        dt(scenario.dt), dx(1.0 / N), dy(1.0 / M), g(scenario.g), damp(scenario.damp), boundary(boundary_), sources(sources_),
+        min_depth(scenario.min_depth), solver_tol(scenario.solver_tol), max_solver_iterations(scenario.solver_iterations) {
+    const double h0 = scenario.h0;
+    const double hM = scenario.hM;
+
+    densities[0] = 0;
+    for (uint i = 1; i < L+1; i++)
+        densities[i] = scenario.get_density(i-1);
+
+    // Initial height
+    double sigma = scenario.sigma;
+    for (uint x = 0; x < N; x++) {
+        for (uint y = 0; y < M; y++) {
+            h[0][x][y] = h0;
+            for (uint b = 0; b < scenario.bumps.size(); b++) {
+                double xx = (double)x / (N-1) - scenario.bumps[b].x;
+                double yy = (double)y / (M-1) - scenario.bumps[b].y;
+                h[0][x][y] += scenario.bumps[b].amplitude * hM * exp(-(xx*xx + yy*yy)/(2*sigma*sigma));
+            }
+            prev_h[0][x][y] = h[0][x][y];
+        }
+    }
+    rest_h[0] = h0;
+
+    // Set sub-surface heights to be flat
+    for (uint i = 1; i < L; i++) {
+        rest_h[i] = (L - i) * h0 / L;
+        for (uint x = 0; x < N; x++) {
+            for (uint y = 0; y < M; y++)
+                prev_h[i][x][y] = h[i][x][y] = rest_h[i];
+        }
+    }
+
+    update_wave_speeds();
+
+    wet.resize(N * M);
+    faces.resize(N * M);
+
+    // Unknowns are the interior cells, so the solver's padded grid is laid out like a Field
+    if (Integrator::implicit)
+        solver.resize(N-2, M-2);
+
+    if (splittable && scenario.barotropic_substeps > 1) {
+        substeps = scenario.barotropic_substeps;
+        split_start.resize(3);
+        surface_mean.resize(1);
+    }
+
+    mark_all_rows();
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename T>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::set_bathymetry(const Field<N,M,T>& h_B_) {
+    h_B = field_cast<Real>(h_B_);
+
+    // Land starts dry: no surface below the floor or below the surface beneath it
+    for (uint x = 0; x < N; x++) {
+        for (uint y = 0; y < M; y++) {
+            Real lower = h_B[x][y];
+            for (uint i = L; i-- > 0; ) {
+                h[i][x][y] = std::max(h[i][x][y], lower);
+                prev_h[i][x][y] = std::max(prev_h[i][x][y], lower);
+                lower = h[i][x][y];
+            }
+        }
+    }
+    update_wave_speeds();
+    mark_all_rows();
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename T>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::set_state(uint i, const Field<N,M,T>& u_, const Field<N,M,T>& v_, const Field<N,M,T>& h_) {
+    prev_u[i] = u[i] = field_cast<Real>(u_);
+    prev_v[i] = v[i] = field_cast<Real>(v_);
+    prev_h[i] = h[i] = field_cast<Real>(h_);
+    mark_rows(i, 0, N);
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::add_drop(double x, double y, double amplitude, double sigma) {
+    // Out to 4 sigma, where the Gaussian is below 1e-3 of its peak
+    const double reach = 4 * sigma;
+    const uint x0 = (uint)std::max(0.0, std::floor((x - reach) * (N-1))), x1 = (uint)std::max(0.0, std::min((double)N, std::ceil((x + reach) * (N-1)) + 1));
+    const uint y0 = (uint)std::max(0.0, std::floor((y - reach) * (M-1))), y1 = (uint)std::max(0.0, std::min((double)M, std::ceil((y + reach) * (M-1)) + 1));
+    for (uint cx = x0; cx < x1; cx++) {
+        for (uint cy = y0; cy < y1; cy++) {
+            const double xx = (double)cx / (N-1) - x, yy = (double)cy / (M-1) - y;
+            const double d = amplitude * exp(-(xx*xx + yy*yy)/(2*sigma*sigma));
+            const double lower = below_top()[cx][cy];
+            h[0][cx][cy] = std::max((double)h[0][cx][cy] + d, lower);
+            prev_h[0][cx][cy] = std::max((double)prev_h[0][cx][cy] + d, lower);
+        }
+    }
+    mark_rows(0, x0, x1);
+}
+
+// Grows both spans of layer i to cover rows [x0, x1)
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::mark_rows(uint i, uint x0, uint x1) {
+    if (x0 >= x1)
+        return;
+    uint* spans[2] = { dirty_rows[i], moving_rows[i] };
+    for (uint k = 0; k < 2; k++) {
+        uint* span = spans[k];
+        if (span[0] >= span[1]) {
+            span[0] = x0;
+            span[1] = x1;
+        }
+        else {
+            span[0] = std::min(span[0], x0);
+            span[1] = std::max(span[1], x1);
+        }
+    }
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::mark_all_rows() {
+    for (uint i = 0; i < L; i++)
+        mark_rows(i, 0, N);
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::take_dirty_rows(uint i, uint& x0, uint& x1) {
+    x0 = dirty_rows[i][0];
+    x1 = dirty_rows[i][1];
+    dirty_rows[i][0] = dirty_rows[i][1] = 0;
+}
+
+// Long-wave speed of each layer from its rest thickness and reduced gravity
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::update_wave_speeds() {
+    double mean_h_B = 0;
+    for (uint x = 0; x < N; x++) {
+        for (uint y = 0; y < M; y++)
+            mean_h_B += h_B[x][y];
+    }
+    mean_h_B /= N * M;
+
+    for (uint i = 0; i < L; i++) {
+        double thickness = rest_h[i] - (i+1 < L ? rest_h[i+1] : mean_h_B);
+        double g_reduced = g * (densities[i+1] - densities[i]) / densities[i+1];
+        wave_speed[i] = std::sqrt(std::max(g_reduced * thickness, 0.0));
+    }
+}
+
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::step() {
+    TRACE_SCOPE("step");
+    solver_iterations = 0;
+    if (substeps > 1)
+        subcycle_top_layer();
+    for (uint i = (substeps > 1 ? 1 : 0); i < L; i++) {
+        // Pressure from this layer and the ones above it, as they stand now. Summed
+        // in double, its gradient is a small difference of large values. When
+        // semi-implicit, the layer's own term is left to the solve. Split, the
+        // top surface is its mean over the substeps, which the slow layers
+        // can't resolve anyway.
+        const uint last = (Integrator::implicit ? i : i + 1);
+        if (last == 0)
+            p.fill(0);
+        else if (substeps > 1)
+            p = (g * (densities[1] - densities[0])) * surface_mean[0];
+        else
+            p = (g * (densities[1] - densities[0])) * field_cast<double>(h[0]);
+        for (uint j = 1; j < last; j++)
+            p += (g * (densities[j+1] - densities[j])) * field_cast<double>(h[j]);
+
+        // Layer thickness is read lazily through the stencil, never stored
+        if (Integrator::implicit) {
+            if (i+1 < L)
+                step_layer_implicit(i, h[i] - h[i+1]);
+            else
+                step_layer_implicit(i, h[i] - h_B);
+        }
+        else {
+            if (i+1 < L)
+                step_layer(i, h[i] - h[i+1]);
+            else
+                step_layer(i, h[i] - h_B);
+        }
+    }
+    total_solver_iterations += solver_iterations;
+    mark_all_rows();
+    t++;
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename F>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::for_rows(const F& rows) {
+    if (pool != NULL)
+        pool->parallel_for(1, N-1, rows);
+    else
+        rows(1, N-1);
+}
+
+// for_rows' split with the outer rows going to the first and last chunks,
+// so each row lands on the worker that steps it
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename F>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::for_all_rows(const F& rows) {
+    for_rows([&](uint x0, uint x1) {
+        rows(x0 == 1 ? 0 : x0, x1 == N-1 ? N : x1);
+    });
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename Eta>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::find_wet_spans(const Eta& eta) {
+    if (min_depth <= 0) {
+        for (uint x = 1; x < N-1; x++) {
+            wet_spans[x].assign({ 1, M-1 });
+            shore[x].clear();
+        }
+        active_fraction = 1;
+        return;
+    }
+
+    // Wetness is read once per cell, then a row whose neighbourhood is all wet is one span
+    const double depth = min_depth;
+    auto mark_row = [&](uint x) {
+        // Flags go through a local buffer, char stores would otherwise alias the field loads
+        unsigned char flags[M];
+        uint dry = 0;
+        for (uint y = 0; y < M; y++) {
+            flags[y] = (eta.at(x,y) > depth);
+            dry += !flags[y];
+        }
+        memcpy(&wet[x * M], flags, M);
+        dry_cells[x] = dry;
+    };
+    mark_row(0);
+    mark_row(N-1);
+    for_rows([&](uint x0, uint x1) {
+        for (uint x = x0; x < x1; x++)
+            mark_row(x);
+    });
+
+    for_rows([&](uint x0, uint x1) {
+        for (uint x = x0; x < x1; x++) {
+            wet_spans[x].clear();
+            shore[x].clear();
+            if (dry_cells[x-1] + dry_cells[x] + dry_cells[x+1] == 0) {
+                wet_spans[x].push_back(1);
+                wet_spans[x].push_back(M-1);
+                continue;
+            }
+
+            const unsigned char* left = &wet[(x-1) * M];
+            const unsigned char* row = &wet[x * M];
+            const unsigned char* right = &wet[(x+1) * M];
+            bool in_span = false;
+            for (uint y = 1; y < M-1; y++) {
+                const bool active = row[y] || row[y-1] || row[y+1] || left[y] || right[y];
+                if (active && !(row[y] && row[y-1] && row[y+1] && left[y] && right[y]))
+                    shore[x].push_back(y);
+                if (active != in_span) {
+                    wet_spans[x].push_back(y);
+                    in_span = active;
+                }
+            }
+            if (in_span)
+                wet_spans[x].push_back(M-1);
+        }
+    });
+
+    uint active = 0;
+    for (uint x = 1; x < N-1; x++) {
+        for (uint k = 0; k < wet_spans[x].size(); k += 2)
+            active += wet_spans[x][k+1] - wet_spans[x][k];
+    }
+    active_fraction = (double)active / ((N-2) * (M-2));
+}
+
+// A cell exchanges water with a neighbour only if the higher of the two
+// surfaces is above the higher of the two floors
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename Eta>
+uint ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::open_faces(const Field<N,M,Real>& h_i, const Eta& eta, uint x, uint y) const {
+    const double h_c = h_i[x][y], lower_c = h_c - eta.at(x,y);
+    const uint nx[4] = { x-1, x+1, x, x }, ny[4] = { y, y, y-1, y+1 };
+    uint open = 0;
+    for (uint k = 0; k < 4; k++) {
+        const double h_n = h_i[nx[k]][ny[k]], lower_n = h_n - eta.at(nx[k], ny[k]);
+        if (std::max(h_c, h_n) > std::max(lower_c, lower_n) + min_depth)
+            open |= 1u << k;
+    }
+    return open;
+}
+
+// Open water, every neighbour is wet
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename P, typename Eta>
+inline void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::wet_cell(const Levels& s, const P& p, const Eta& eta, double inv_density, uint x, uint y) const {
+    const Field<N,M,Real>& u = *s.u;
+    const Field<N,M,Real>& v = *s.v;
+
+    // Loads are Real, the arithmetic is double in registers
+    const double uc = u[x][y], vc = v[x][y];
+    const double du_dx = u.dx(x,y)/dx, du_dy = u.dy(x,y)/dy;
+    const double dv_dx = v.dx(x,y)/dx, dv_dy = v.dy(x,y)/dy;
+    const double h_c = (*s.h)[x][y], eta_c = eta.at(x,y);
+
+    double tu = momentum_tendency(uc, uc, vc, du_dx, du_dy, p.dx(x,y)/dx, inv_density, damp);
+    double tv = momentum_tendency(vc, uc, vc, dv_dx, dv_dy, p.dy(x,y)/dy, inv_density, damp);
+    sources.add(tu, tv, uc, vc, source_cell(s.layer, x, y, eta_c, inv_density));
+    (*s.next_u)[x][y] = Integrator::advance(uc, (double)(*s.prev_u)[x][y], dt, tu);
+    (*s.next_v)[x][y] = Integrator::advance(vc, (double)(*s.prev_v)[x][y], dt, tv);
+
+    const double h_next = Integrator::advance(h_c, (double)(*s.prev_h)[x][y], dt, continuity_tendency(eta_c, uc, vc, eta.dx(x,y)/dx, eta.dy(x,y)/dy, du_dx, dv_dy));
+    (*s.next_h)[x][y] = std::max(h_next, h_c - eta_c);
+}
+
+// Closed faces are walls, a dry cell with none open stays at rest
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename P, typename Eta>
+inline void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::shore_cell(const Levels& s, const P& p, const Eta& eta, double inv_density, uint x, uint y) const {
+    const Field<N,M,Real>& u = *s.u;
+    const Field<N,M,Real>& v = *s.v;
+
+    const double h_c = (*s.h)[x][y], eta_c = eta.at(x,y);
+    const uint open = open_faces(*s.h, eta, x, y);
+    if (open == 0) {
+        (*s.next_u)[x][y] = (*s.next_v)[x][y] = 0;
+        (*s.next_h)[x][y] = h_c;
+        return;
+    }
+
+    const double uc = u[x][y], vc = v[x][y];
+    const double du_dx = u.dx(x,y)/dx, du_dy = u.dy(x,y)/dy;
+    const double dv_dx = v.dx(x,y)/dx, dv_dy = v.dy(x,y)/dy;
+
+    double tu = momentum_tendency(uc, uc, vc, du_dx, du_dy, open_dx(p, x, y, open)/dx, inv_density, damp);
+    double tv = momentum_tendency(vc, uc, vc, dv_dx, dv_dy, open_dy(p, x, y, open)/dy, inv_density, damp);
+    sources.add(tu, tv, uc, vc, source_cell(s.layer, x, y, eta_c, inv_density));
+    double u_next = Integrator::advance(uc, (double)(*s.prev_u)[x][y], dt, tu);
+    double v_next = Integrator::advance(vc, (double)(*s.prev_v)[x][y], dt, tv);
+    close_faces(u_next, v_next, open);
+    (*s.next_u)[x][y] = u_next;
+    (*s.next_v)[x][y] = v_next;
+
+    const double h_next = Integrator::advance(h_c, (double)(*s.prev_h)[x][y], dt, continuity_tendency(std::max(eta_c, 0.0), uc, vc,
+                                              open_dx(eta, x, y, open)/dx, open_dy(eta, x, y, open)/dy, du_dx, dv_dy));
+    (*s.next_h)[x][y] = std::max(h_next, h_c - eta_c);
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename Eta>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::step_layer(uint i, const Eta& eta) {
+    const double inv_density = 1.0 / densities[i+1];
+    find_wet_spans(eta);
+
+    const Levels s = { i, &u[i], &v[i], &h[i], &prev_u[i], &prev_v[i], &prev_h[i], &next_u, &next_v, &next_h };
+    for_rows([&](uint x0, uint x1) {
+        for (uint x = x0; x < x1; x++) {
+            const std::vector<uint>& spans = wet_spans[x];
+            uint y = 1;
+            for (uint k = 0; k < spans.size(); k += 2) {
+                for (; y < spans[k]; y++) {
+                    next_u[x][y] = next_v[x][y] = 0;
+                    next_h[x][y] = h[i][x][y];
+                }
+                for (; y < spans[k+1]; y++)
+                    wet_cell(s, p, eta, inv_density, x, y);
+            }
+            for (; y < M-1; y++) {
+                next_u[x][y] = next_v[x][y] = 0;
+                next_h[x][y] = h[i][x][y];
+            }
+
+            for (uint k = 0; k < shore[x].size(); k++)
+                shore_cell(s, p, eta, inv_density, x, shore[x][k]);
+        }
+    });
+
+    finish_layer(i);
+}
+
+// Predicts u*, v* without the layer's own surface gradient, solves
+//
+//     h' - 4 dt^2 g' div(eta grad h') = h - dt (u.grad(eta) + eta div(u*))
+//
+// for the new surface h' (4 as undivided differences are twice the
+// derivative, see kernels.h) and corrects u' = u* - dt g' grad(h'). The
+// implicit operator uses the compact Laplacian, the correction the same
+// central differences as the explicit step.
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename Eta>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::step_layer_implicit(uint i, const Eta& eta) {
+    const double inv_density = 1.0 / densities[i+1];
+    const double g_reduced = g * (densities[i+1] - densities[i]) * inv_density;
+    const double kx = 4 * dt*dt * g_reduced / (dx*dx);
+    const double ky = 4 * dt*dt * g_reduced / (dy*dy);
+
+    // The divergence of u* reads its outer ring, which keeps the current boundary values
+    for (uint x = 0; x < N; x++) {
+        next_u[x][0] = u[i][x][0];  next_u[x][M-1] = u[i][x][M-1];
+        next_v[x][0] = v[i][x][0];  next_v[x][M-1] = v[i][x][M-1];
+    }
+    for (uint y = 0; y < M; y++) {
+        next_u[0][y] = u[i][0][y];  next_u[N-1][y] = u[i][N-1][y];
+        next_v[0][y] = v[i][0][y];  next_v[N-1][y] = v[i][N-1][y];
+    }
+
+    // Open faces of every cell, as in step_layer; with no dry cells all are open
+    const bool drying = (min_depth > 0);
+    for_rows([&](uint x0, uint x1) {
+        for (uint x = x0; x < x1; x++) {
+            for (uint y = 1; y < M-1; y++)
+                faces[(size_t)x * M + y] = (drying ? open_faces(h[i], eta, x, y) : FACE_ALL);
+        }
+    });
+
+    for_rows([&](uint x0, uint x1) {
+        for (uint x = x0; x < x1; x++) {
+            for (uint y = 1; y < M-1; y++) {
+                const uint open = faces[(size_t)x * M + y];
+                const double uc = u[i][x][y], vc = v[i][x][y];
+                if (open == FACE_ALL) {
+                    double tu = momentum_tendency(uc, uc, vc, u[i].dx(x,y)/dx, u[i].dy(x,y)/dy, p.dx(x,y)/dx, inv_density, damp);
+                    double tv = momentum_tendency(vc, uc, vc, v[i].dx(x,y)/dx, v[i].dy(x,y)/dy, p.dy(x,y)/dy, inv_density, damp);
+                    sources.add(tu, tv, uc, vc, source_cell(i, x, y, eta.at(x,y), inv_density));
+                    next_u[x][y] = Integrator::advance(uc, (double)prev_u[i][x][y], dt, tu);
+                    next_v[x][y] = Integrator::advance(vc, (double)prev_v[i][x][y], dt, tv);
+                    continue;
+                }
+                double u_next = 0, v_next = 0;
+                if (open != 0) {
+                    double tu = momentum_tendency(uc, uc, vc, u[i].dx(x,y)/dx, u[i].dy(x,y)/dy, open_dx(p, x, y, open)/dx, inv_density, damp);
+                    double tv = momentum_tendency(vc, uc, vc, v[i].dx(x,y)/dx, v[i].dy(x,y)/dy, open_dy(p, x, y, open)/dy, inv_density, damp);
+                    sources.add(tu, tv, uc, vc, source_cell(i, x, y, eta.at(x,y), inv_density));
+                    u_next = Integrator::advance(uc, (double)prev_u[i][x][y], dt, tu);
+                    v_next = Integrator::advance(vc, (double)prev_v[i][x][y], dt, tv);
+                    close_faces(u_next, v_next, open);
+                }
+                next_u[x][y] = u_next;
+                next_v[x][y] = v_next;
+            }
+        }
+    });
+
+    // Right hand side, warm start and face coefficients from the thickness,
+    // clamped as a dry cell must not make the operator indefinite, and zero
+    // through closed faces
+    double* b = solver.get_b();
+    double* h_next = solver.get_x();
+    double* k_x = solver.get_kx();
+    double* k_y = solver.get_ky();
+    for_rows([&](uint x0, uint x1) {
+        for (uint x = x0; x < x1; x++) {
+            for (uint y = 1; y < M-1; y++) {
+                const size_t c = (size_t)x * M + y;
+                const uint open = faces[c];
+                const double eta_c = eta.at(x,y);
+                if (open == FACE_ALL)
+                    b[c] = h[i][x][y] - dt * continuity_tendency(eta_c, (double)u[i][x][y], (double)v[i][x][y], eta.dx(x,y)/dx, eta.dy(x,y)/dy,
+                                                                 next_u.dx(x,y)/dx, next_v.dy(x,y)/dy);
+                else
+                    b[c] = h[i][x][y] - dt * continuity_tendency(std::max(eta_c, 0.0), (double)u[i][x][y], (double)v[i][x][y],
+                                                                 open_dx(eta, x, y, open)/dx, open_dy(eta, x, y, open)/dy, next_u.dx(x,y)/dx, next_v.dy(x,y)/dy);
+                h_next[c] = h[i][x][y];
+                k_x[c] = (x+1 < N-1 && (open & FACE_XP) ? kx * std::max(0.5 * (eta_c + eta.at(x+1,y)), 0.0) : 0);
+                k_y[c] = (y+1 < M-1 && (open & FACE_YP) ? ky * std::max(0.5 * (eta_c + eta.at(x,y+1)), 0.0) : 0);
+            }
+        }
+    });
+    solver.update(pool);
+    solver_iterations += solver.solve(solver_tol, max_solver_iterations, pool);
+
+    // Zero flux through the walls of the implicit operator, and never below the surface beneath
+    for (uint x = 1; x < N-1; x++) {
+        for (uint y = 1; y < M-1; y++)
+            next_h[x][y] = std::max(h_next[(size_t)x * M + y], (double)h[i][x][y] - eta.at(x,y));
+        next_h[x][0] = next_h[x][1];
+        next_h[x][M-1] = next_h[x][M-2];
+    }
+    for (uint y = 0; y < M; y++) {
+        next_h[0][y] = next_h[1][y];
+        next_h[N-1][y] = next_h[N-2][y];
+    }
+
+    for_rows([&](uint x0, uint x1) {
+        for (uint x = x0; x < x1; x++) {
+            for (uint y = 1; y < M-1; y++) {
+                const uint open = faces[(size_t)x * M + y];
+                if (open == FACE_ALL) {
+                    next_u[x][y] -= dt * g_reduced * next_h.dx(x,y) / dx;
+                    next_v[x][y] -= dt * g_reduced * next_h.dy(x,y) / dy;
+                }
+                else if (open != 0) {
+                    double u_next = next_u[x][y] - dt * g_reduced * open_dx(next_h, x, y, open) / dx;
+                    double v_next = next_v[x][y] - dt * g_reduced * open_dy(next_h, x, y, open) / dy;
+                    close_faces(u_next, v_next, open);
+                    next_u[x][y] = u_next;
+                    next_v[x][y] = v_next;
+                }
+            }
+        }
+    });
+
+    finish_layer(i);
+}
+
+// The fast part of a split step: layer 0 n times at dt / n over the layer
+// beneath as it stands. The stencil and the boundary read dt, so it is
+// swapped for the substep meanwhile; a sponge relaxes layer 0 by the substep
+// each time and by one long step over all of them.
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::subcycle_top_layer() {
+    TRACE_SCOPE("barotropic substeps");
+    split_start[0] = u[0];
+    split_start[1] = v[0];
+    split_start[2] = h[0];
+    surface_mean[0].fill(0);
+
+    const double long_dt = dt;
+    dt = long_dt / substeps;
+    for (uint k = 0; k < substeps; k++) {
+        p = (g * (densities[1] - densities[0])) * field_cast<double>(h[0]);
+        step_layer(0, h[0] - below_top());
+        surface_mean[0] += field_cast<double>(h[0]);
+    }
+    dt = long_dt;
+    surface_mean[0] = (1.0 / substeps) * surface_mean[0];
+
+    // One step of dt earlier, like every other layer
+    prev_u[0].swap(split_start[0]);
+    prev_v[0].swap(split_start[1]);
+    prev_h[0].swap(split_start[2]);
+}
+
+// Boundary, time filter and rotation of the time levels once next_* hold the new state
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::finish_layer(uint i) {
+    BoundaryContext ctx = { rest_h[i], wave_speed[i] * dt / dx, wave_speed[i] * dt / dy, dt };
+    boundary.apply(next_u, next_v, next_h, u[i], v[i], h[i], ctx);
+
+    if (Integrator::filtered) {
+        for (uint x = 0; x < N; x++) {
+            for (uint y = 0; y < M; y++) {
+                u[i][x][y] = Integrator::filter(prev_u[i][x][y], u[i][x][y], next_u[x][y]);
+                v[i][x][y] = Integrator::filter(prev_v[i][x][y], v[i][x][y], next_v[x][y]);
+                h[i][x][y] = Integrator::filter(prev_h[i][x][y], h[i][x][y], next_h[x][y]);
+            }
+        }
+    }
+
+    // Rotate time levels, prev <- cur <- next and the old prev becomes scratch
+    prev_u[i].swap(u[i]);
+    prev_v[i].swap(v[i]);
+    prev_h[i].swap(h[i]);
+    u[i].swap(next_u);
+    v[i].swap(next_v);
+    h[i].swap(next_h);
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::advance(uint steps) {
+    if (scheduler != NULL) {
+        advance_tiled(steps, tiles_supported());
+        return;
+    }
+    for (uint i = 0; i < steps; i++)
+        step();
+}
+
+// Tiled, the graph drains after every step so after_step sees a whole state
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename F>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::advance(uint steps, const F& after_step) {
+    for (uint i = 0; i < steps; i++) {
+        if (scheduler != NULL)
+            advance_tiled(1, tiles_supported());
+        else
+            step();
+        after_step();
+    }
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::set_tile_scheduler(TileScheduler* scheduler_, uint tile_size) {
+    scheduler = (tiles_supported::value && tile_size > 0 && substeps == 1 ? scheduler_ : NULL);
+    if (scheduler == NULL)
+        return;
+
+    // Tiles split the interior, the ones along an edge take its ring too
+    tile_size = std::min(tile_size, std::max(N, M));
+    tiles_x = (N-2 + tile_size-1) / tile_size;
+    tiles_y = (M-2 + tile_size-1) / tile_size;
+    tiles.resize(tiles_x * tiles_y);
+    for (uint tx = 0; tx < tiles_x; tx++) {
+        for (uint ty = 0; ty < tiles_y; ty++) {
+            Tile& tile = tiles[tx * tiles_y + ty];
+            tile.x0 = (tx == 0 ? 0 : 1 + tx * tile_size);
+            tile.x1 = (tx+1 == tiles_x ? N : 1 + (tx+1) * tile_size);
+            tile.y0 = (ty == 0 ? 0 : 1 + ty * tile_size);
+            tile.y1 = (ty+1 == tiles_y ? M : 1 + (ty+1) * tile_size);
+        }
+    }
+
+    spare_u.resize(L);
+    spare_v.resize(L);
+    spare_h.resize(L);
+    // A tile plus its ring and a halo cell on each side
+    const size_t halo_cells = (size_t)(tile_size + 3) * (tile_size + 3);
+    tile_p.assign(scheduler->size(), std::vector<double>(halo_cells));
+    tile_wet.assign(scheduler->size(), std::vector<unsigned char>(halo_cells));
+}
+
+// Task k = step * L + i of a tile advances layer i. It reads layer i and the
+// one beneath at the current level and the layers above at the next one, all
+// within one cell of the tile, which is what the scheduler's neighbour rule
+// guarantees is final. Level r of every layer lives in slot r % 3 of
+// {u, spare_u, prev_u}, rotated back into place at the end.
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::advance_tiled(uint steps, std::true_type) {
+    TRACE_SCOPE("tiled steps");
+    Field<N,M,Real>* slots_u[L][3];
+    Field<N,M,Real>* slots_v[L][3];
+    Field<N,M,Real>* slots_h[L][3];
+    for (uint i = 0; i < L; i++) {
+        slots_u[i][0] = &u[i];  slots_u[i][1] = &spare_u[i];  slots_u[i][2] = &prev_u[i];
+        slots_v[i][0] = &v[i];  slots_v[i][1] = &spare_v[i];  slots_v[i][2] = &prev_v[i];
+        slots_h[i][0] = &h[i];  slots_h[i][1] = &spare_h[i];  slots_h[i][2] = &prev_h[i];
+    }
+
+    scheduler->run(tiles_x, tiles_y, steps * L, [&](uint worker, uint t, uint k) {
+        const uint r = k / L, i = k % L;
+        const uint cur = r % 3, prev = (r+2) % 3, next = (r+1) % 3;
+        const Levels s = { i, slots_u[i][cur], slots_v[i][cur], slots_h[i][cur],
+                           slots_u[i][prev], slots_v[i][prev], slots_h[i][prev],
+                           slots_u[i][next], slots_v[i][next], slots_h[i][next] };
+
+        // Surfaces the pressure sums, the layers above already stepped
+        const Field<N,M,Real>* surfaces[L];
+        for (uint j = 0; j <= i; j++)
+            surfaces[j] = slots_h[j][j < i ? next : cur];
+
+        if (i+1 < L)
+            step_tile(i, s, surfaces, *slots_h[i][cur] - *slots_h[i+1][cur], tiles[t], worker);
+        else
+            step_tile(i, s, surfaces, *slots_h[i][cur] - h_B, tiles[t], worker);
+    });
+
+    // Put the last level in u, the one before it in prev_u
+    for (uint i = 0; i < L; i++) {
+        if (steps % 3 == 1) {
+            u[i].swap(spare_u[i]);  spare_u[i].swap(prev_u[i]);
+            v[i].swap(spare_v[i]);  spare_v[i].swap(prev_v[i]);
+            h[i].swap(spare_h[i]);  spare_h[i].swap(prev_h[i]);
+        }
+        else if (steps % 3 == 2) {
+            u[i].swap(prev_u[i]);  prev_u[i].swap(spare_u[i]);
+            v[i].swap(prev_v[i]);  prev_v[i].swap(spare_v[i]);
+            h[i].swap(prev_h[i]);  prev_h[i].swap(spare_h[i]);
+        }
+    }
+    mark_all_rows();
+    t += steps;
+}
+
+// One layer on one tile: the same arithmetic as step(), with the pressure and
+// the wet cells found over the tile and the edge strips of its halo only
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename Eta>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::step_tile(uint i, const Levels& s, const Field<N,M,Real>* const* surfaces,
+                                                                   const Eta& eta, const Tile& tile, uint worker) {
+    const double inv_density = 1.0 / densities[i+1];
+    const uint hx0 = (tile.x0 > 0 ? tile.x0-1 : 0), hx1 = std::min(tile.x1+1, N);
+    const uint hy0 = (tile.y0 > 0 ? tile.y0-1 : 0), hy1 = std::min(tile.y1+1, M);
+    const uint cols = hy1 - hy0;
+    // The stencil only reaches across edges, so the halo rows above and below
+    // stop at the tile's columns and never touch a diagonal neighbour's cells
+    auto row_begin = [&](uint x) { return (x < tile.x0 || x >= tile.x1 ? tile.y0 : hy0); };
+    auto row_end = [&](uint x) { return (x < tile.x0 || x >= tile.x1 ? tile.y1 : hy1); };
+
+    // Summed a row and a layer at a time, in the same order as step()
+    double* p_tile = &tile_p[worker][0];
+    for (uint x = hx0; x < hx1; x++) {
+        const uint ya = row_begin(x), yb = row_end(x);
+        double* p_row = p_tile + (size_t)(x - hx0) * cols + (ya - hy0);
+        const double c0 = g * (densities[1] - densities[0]);
+        const Real* h_row = &(*surfaces[0])[x][ya];
+        for (uint c = 0; c < yb - ya; c++)
+            p_row[c] = c0 * (double)h_row[c];
+        for (uint j = 1; j <= i && j < L; j++) {
+            const double c_j = g * (densities[j+1] - densities[j]);
+            h_row = &(*surfaces[j])[x][ya];
+            for (uint c = 0; c < yb - ya; c++)
+                p_row[c] += c_j * (double)h_row[c];
+        }
+    }
+    const TilePressure p = { p_tile, hx0, hy0, cols };
+
+    // Wet flags of the tile and its halo, a tile with no dry cell is all open water
+    unsigned char* wet_tile = &tile_wet[worker][0];
+    bool all_wet = true;
+    if (min_depth > 0) {
+        for (uint x = hx0; x < hx1; x++) {
+            for (uint y = row_begin(x); y < row_end(x); y++) {
+                const bool w = (eta.at(x,y) > min_depth);
+                wet_tile[(size_t)(x - hx0) * cols + (y - hy0)] = w;
+                all_wet = all_wet && w;
+            }
+        }
+    }
+
+    const uint x0 = std::max(tile.x0, 1u), x1 = std::min(tile.x1, N-1);
+    const uint y0 = std::max(tile.y0, 1u), y1 = std::min(tile.y1, M-1);
+    for (uint x = x0; x < x1; x++) {
+        if (all_wet) {
+            for (uint y = y0; y < y1; y++)
+                wet_cell(s, p, eta, inv_density, x, y);
+            continue;
+        }
+        const unsigned char* left = &wet_tile[(size_t)(x-1 - hx0) * cols];
+        const unsigned char* row = &wet_tile[(size_t)(x - hx0) * cols];
+        const unsigned char* right = &wet_tile[(size_t)(x+1 - hx0) * cols];
+        for (uint y = y0; y < y1; y++) {
+            const uint c = y - hy0;
+            if (row[c] && row[c-1] && row[c+1] && left[c] && right[c])
+                wet_cell(s, p, eta, inv_density, x, y);
+            else if (row[c] || row[c-1] || row[c+1] || left[c] || right[c])
+                shore_cell(s, p, eta, inv_density, x, y);
+            else {
+                (*s.next_u)[x][y] = (*s.next_v)[x][y] = 0;
+                (*s.next_h)[x][y] = (*s.h)[x][y];
+            }
+        }
+    }
+
+    BoundaryContext ctx = { rest_h[i], wave_speed[i] * dt / dx, wave_speed[i] * dt / dy, dt };
+    boundary.apply_tile(*s.next_u, *s.next_v, *s.next_h, *s.u, *s.v, *s.h, ctx, tile.x0, tile.x1, tile.y0, tile.y1);
+}
+
+// Row-parallel fields only, the tiled path's spares move between workers
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+std::vector<Field<N,M,Real>*> ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::stepped_fields() {
+    std::vector<Field<N,M,Real>*> fields;
+    for (uint i = 0; i < L; i++) {
+        fields.push_back(&u[i]);
+        fields.push_back(&prev_u[i]);
+        fields.push_back(&v[i]);
+        fields.push_back(&prev_v[i]);
+        fields.push_back(&h[i]);
+        fields.push_back(&prev_h[i]);
+    }
+    fields.push_back(&h_B);
+    fields.push_back(&next_u);
+    fields.push_back(&next_v);
+    fields.push_back(&next_h);
+    for (uint k = 0; k < split_start.size(); k++)
+        fields.push_back(&split_start[k]);
+    return fields;
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename T>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::place_field(Field<N,M,T>& f, HugePages huge) {
+    Field<N,M,T> placed(huge);
+    for_all_rows([&](uint x0, uint x1) {
+        memcpy(placed[x0], f[x0], (size_t)(x1 - x0) * M * sizeof(T));
+    });
+    f.swap(placed);
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::place_fields(HugePages huge) {
+    std::vector<Field<N,M,Real>*> fields = stepped_fields();
+    for (uint k = 0; k < fields.size(); k++)
+        place_field(*fields[k], huge);
+    place_field(p, huge);
+    for (uint k = 0; k < surface_mean.size(); k++)
+        place_field(surface_mean[k], huge);
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+template<typename T>
+void ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::count_remote(const Field<N,M,T>& f, std::atomic<size_t>& remote, std::atomic<size_t>& total) {
+    for_all_rows([&](uint x0, uint x1) {
+        const int node = current_node();
+        const char* begin = (const char*)f.get_data() + (size_t)x0 * M * sizeof(T);
+        const char* end = (const char*)f.get_data() + (size_t)x1 * M * sizeof(T);
+        std::vector<int> nodes;
+        page_nodes(begin, end - begin, nodes);
+
+        // Only the part of each page in these rows
+        const size_t first = (size_t)begin / NODE_PAGE_SIZE * NODE_PAGE_SIZE;
+        size_t local_remote = 0, local_total = 0;
+        for (size_t k = 0; k < nodes.size(); k++) {
+            const size_t lo = std::max((size_t)begin, first + k * NODE_PAGE_SIZE);
+            const size_t hi = std::min((size_t)end, first + (k+1) * NODE_PAGE_SIZE);
+            if (node < 0 || nodes[k] < 0)
+                continue;
+            local_total += hi - lo;
+            if (nodes[k] != node)
+                local_remote += hi - lo;
+        }
+        remote += local_remote;
+        total += local_total;
+    });
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+size_t ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::count_remote_bytes(size_t& total) {
+    std::atomic<size_t> remote(0), all(0);
+    std::vector<Field<N,M,Real>*> fields = stepped_fields();
+    for (uint k = 0; k < fields.size(); k++)
+        count_remote(*fields[k], remote, all);
+    count_remote(p, remote, all);
+    for (uint k = 0; k < surface_mean.size(); k++)
+        count_remote(surface_mean[k], remote, all);
+    total = all;
+    return remote;
+}
+
+// Kinetic energy of every layer plus potential energy of every interface,
+// relative to the interfaces' rest heights
+template<uint N, uint M, uint L, typename Boundary, typename Integrator, typename Real, typename Sources>
+double ShallowWaterEngine<N,M,L,Boundary,Integrator,Real,Sources>::calc_total_energy() const {
+    double E = 0;
+    for (uint i = 0; i < L; i++) {
+        for (uint x = 0; x < N; x++) {
+            for (uint y = 0; y < M; y++) {
+                double eta = h[i][x][y] - (i+1 < L ? h[i+1][x][y] : h_B[x][y]);
+                double dh = h[i][x][y] - rest_h[i];
+                double PE = 0.5 * g * (densities[i+1] - densities[i]) * dh*dh;
+                double KE = 0.5 * densities[i+1] * eta * (u[i][x][y]*u[i][x][y] + v[i][x][y]*v[i][x][y]);
+                E += PE + KE;
+            }
+        }
+    }
+    return E * dx * dy;
+}
+
+#endif
@@ -6,182 +6,148 @@
 #include <leon/matrix.h>
 
 #include "utils/types.h"
+#include "utils/trace.h"
 #include "utils/opengl/model.h"
 #include "utils/opengl/displacement_mesh.h"
 #include "utils/opengl/mesh_gen.h"
 #include "utils/opengl/shader.h"
+#include "field.h"
+#include "sources.h"
+#include "shallow_water_engine.h"
 
 
 
 
-template<uint N, uint M, uint L = 1>
+// The meshes upload float anyway, so the solver state defaults to float too.
+//
+// Surfaces are synced by rows: only the rows the engine wrote since the last
+// sync are interpolated, a row whose heights are the same floats the mesh
+// already has is skipped, normals are redone only on and next to the rows
+// that changed, and only those spans are uploaded. A disturbance on a calm
+// sea costs in proportion to the water it has reached, a drop while paused
+// in proportion to its own rows.
+template<uint N, uint M, uint L = 1, typename Boundary = ReflectiveBoundary, typename Real = float>
 class ShallowWaterModel {
 public:
-    ShallowWaterModel(double dt_, double hM, double h0, double damp_, Shader* shaders_[L+1]);
+    // With a pressure patch the mouse can drag around
+    typedef ShallowWaterEngine<N,M,L,Boundary,ForwardEuler,Real,SurfacePressure<N,M> > Engine;
+
+    ShallowWaterModel(const Scenario& scenario, Shader* shaders_[L+1], Boundary boundary = Boundary());
     ~ShallowWaterModel();
 
     void update();
-    void render(const Matrix4f& viewMat);
+    void advance(uint steps);
+    void sync_surfaces(double alpha = 1);
+    void render();
 
-    Transform& get_transform();
+    // The CPU halves of sync_surfaces, for the roofline report: the vertex
+    // displacements of surface i, then its normals from those
+    void pack_displacements(uint i, double alpha = 1);
+    void update_normals(uint i);
 
-private:
-    double dt, dx, dy;
-    double g = 1;
-    double damp;
-    uint t = 0;
+    // Uploads surface i from N x M row-major heights computed elsewhere, how
+    // the standalone viewer draws frames another process published
+    void show_surface(uint i, const float* h);
+
+    // Makes the next sync of every surface rewrite all of it
+    void invalidate_surfaces();
+
+    // Disturbances at positions in the coordinates of the scenario's bumps,
+    // e.g. from pick_surface. A drop shows at once, paused or not.
+    void drop(double x, double y, double amplitude, double sigma);
+    void set_pressure(double x, double y, double amplitude, double sigma) { engine.get_sources().set(x, y, amplitude, sigma); }
+    void clear_pressure() { engine.get_sources().clear(); }
+
+    // Where window coordinates (mouse_x, mouse_y) hit the top surface, by
+    // drawing it with `pick_shader` (displacement.vert and pick.frag) and
+    // reading the pixel back. Call before the frame is drawn, it clears.
+    bool pick_surface(Shader* pick_shader, double mouse_x, double mouse_y, double& x, double& y);
 
-    Matrix<N,M> u[L], prev_u[L];
-    Matrix<N,M> v[L], prev_v[L];
-    Matrix<N,M> h[L], prev_h[L];
-    Matrix<N,M> h_B;
+    template<typename T>
+    void set_bathymetry(const Field<N,M,T>& h_B);
 
-    float densities[L+1];
+    double get_dt() const { return engine.get_dt(); }
+    Engine& get_engine() { return engine; }
+
+private:
+    Engine engine;
 
     Model<DisplacementMesh>* surfaces[L];
     Model<DisplacementMesh> ground;
 
     Shader* shaders[L+1];
+    Uniform<Matrix4f> model_matrices[L+1];
+
+    // What each mesh shows, rows outside the last packed span kept from before
+    Field<N,M,Real> interpolated[L];
+    double packed_alpha[L];
 
-    void step();
-    void recalculate_normals(Model<DisplacementMesh>& m, const Matrix<N,M>& h);
-    double calc_total_energy() const;
-    Matrix<N,M> get_pressure(uint i);
+    // Rows of the surface last packed that differ from what its mesh had
+    bool changed[N];
+    bool resync[L];
+
+    void recalculate_normals(Model<DisplacementMesh>& m, const Field<N,M,Real>& h, uint x0 = 0, uint x1 = N);
+    void displace_ground();
+    void displace_surface(uint i, uint x0, uint x1);
 };
 
-template<uint N, uint M, uint L>
-ShallowWaterModel<N,M,L>::ShallowWaterModel(double dt_, double hM, double h0, double damp_, Shader* shaders_[L+1]):
-        ground(DisplacementMesh(gen_plane<N-1,M-1>(), GL_STATIC_DRAW)),
-        dt(dt_), dx(1.0 / N), dy(1.0 / M), damp(damp_) {
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+ShallowWaterModel<N,M,L,Boundary,Real>::ShallowWaterModel(const Scenario& scenario, Shader* shaders_[L+1], Boundary boundary):
+        engine(scenario, boundary),
+        ground(DisplacementMesh(gen_plane<N-1,M-1>(), GL_STATIC_DRAW)) {
     // Store shaders
-    for (uint i = 0; i < L+1; i++)
+    for (uint i = 0; i < L+1; i++) {
         shaders[i] = shaders_[i];
+        model_matrices[i] = shaders[i]->template get_uniform_handle<Matrix4f>("modelMatrix");
+    }
 
     // Generate surfaces
     for (uint i = 0; i < L; i++) {
         surfaces[i] = new Model<DisplacementMesh>(DisplacementMesh(gen_plane<N-1,M-1>(), GL_DYNAMIC_DRAW));
         surfaces[i]->get_transform().scale(5, 1, 5);
+        resync[i] = true;
+        packed_alpha[i] = 1;
     }
     ground.get_transform().scale(5, 1, 5);
 
-    densities[0] = 0;
-    for (uint i = 1; i < L+1; i++)
-        densities[i] = 1 + (i-1)/3.0;
+    // Set ground height
+    displace_ground();
+    ground.get_mesh().static_displace();
 
+    sync_surfaces();
+}
 
-    // Set ground height
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+void ShallowWaterModel<N,M,L,Boundary,Real>::displace_ground() {
+    const Field<N,M,Real>& h_B = engine.get_h_B();
     for (uint x = 0; x < N; x++) {
-        double xx = (double)x / (N-1) - 0.1;
-        double xx2 = (double)x / (N-1) - 0.9;
-        for (uint y = 0; y < M; y++) {
-            double yy = (double)y / (M-1) - 0.1;
-            double yy2 = (double)y / (M-1) - 0.9;
-            // h_B[x][y] = 0.04/sqrt(2*PI*0.1*0.1) * exp(-(xx*xx + yy*yy)/(2*0.1*0.1));
-            // h_B[x][y] += 0.04/sqrt(2*PI*0.1*0.1) * exp(-(xx2*xx2 + yy2*yy2)/(2*0.1*0.1));
-
+        for (uint y = 0; y < M; y++)
             ground.get_mesh().set_displacement(x*N + y, Vecf(0, h_B[x][y], 0));
-        }
     }
     recalculate_normals(ground, h_B);
-    ground.get_mesh().static_displace();
-
-    // Initial height
-    double sigma = 0.05;
-    for (uint x = 0; x < N; x++) {
-        double xx = (double)x / (N-1) - 5.0/7;
-        double xx2 = (double)x / (N-1) - 0.123;
-        for (uint y = 0; y < M; y++) {
-            double yy = (double)y / (M-1) - 3.0/4;
-            double yy2 = (double)y / (M-1) - 0.5643;
-
-            h[0][x][y] = h0 + hM * exp(-(xx*xx + yy*yy)/(2*sigma*sigma));
-            h[0][x][y] += hM * exp(-(xx2*xx2 + yy2*yy2)/(2*sigma*sigma));
-            prev_h[0][x][y] = h[0][x][y];
-
-            surfaces[0]->get_mesh().set_displacement(x*N + y, Vecf(0, h[0][x][y], 0));
-        }
-    }
-
-    // Set sub-surface heights to be flat
-    for (uint i = 1; i < L; i++) {
-        for (uint x = 0; x < N; x++) {
-            for (uint y = 0; y < M; y++) {
-                prev_h[i][x][y] = h[i][x][y] = (L - i) * h0 / L;
-                surfaces[i]->get_mesh().set_displacement(x*N + y, Vecf(0, h[i][x][y], 0));
-            }
-        }
-    }
+}
 
-    for (uint i = 0; i < L; i++) {
-        recalculate_normals(*surfaces[i], h[i]);
-        surfaces[i]->get_mesh().displace();
-    }
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+template<typename T>
+void ShallowWaterModel<N,M,L,Boundary,Real>::set_bathymetry(const Field<N,M,T>& h_B) {
+    engine.set_bathymetry(h_B);
+    displace_ground();
+    ground.get_mesh().mark_all_dirty();
+    ground.get_mesh().displace();
 }
 
-template<uint N, uint M, uint L>
-ShallowWaterModel<N,M,L>::~ShallowWaterModel() {
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+ShallowWaterModel<N,M,L,Boundary,Real>::~ShallowWaterModel() {
     for (uint i = 0; i < L; i++)
         delete surfaces[i];
 }
 
-
-template<uint N, uint M, typename T>
-T delta_x(const Matrix<N,M,T>& m, int x, int y) {
-    return m[x+1][y] - m[x-1][y];
-}
-template<uint N, uint M, typename T>
-T delta_y(const Matrix<N,M,T>& m, int x, int y) {
-    return m[x][y+1] - m[x][y-1];
-}
-template<uint N, uint M, uint L>
-Matrix<N,M> ShallowWaterModel<N,M,L>::get_pressure(uint i) {
-    Matrix<N,M> p;
-    for (uint j = 0; j <= i; j++)
-        p += g * (densities[j+1] - densities[j]) * h[j];
-    return p;
-}
-
-template<uint N, uint M, uint L>
-void ShallowWaterModel<N,M,L>::step() {
-    for (uint i = 0; i < L; i++) {
-        Matrix<N,M> next_u, next_v, next_h;
-
-        Matrix<N,M> eta = h[i] - (i+1 < L ? h[i+1] : 0) - h_B;
-
-        Matrix<N,M> p = get_pressure(i);
-
-        for (uint x = 1; x < N-1; x++) {
-            for (uint y = 1; y < M-1; y++) {
-                next_u[x][y] = u[i][x][y] - dt * (u[i][x][y]*delta_x(u[i],x,y)/dx  +  v[i][x][y]*delta_y(u[i],x,y)/dy  +  1/densities[i+1]*delta_x(p,x,y)/dx  +  damp*u[i][x][y]);
-                next_v[x][y] = v[i][x][y] - dt * (u[i][x][y]*delta_x(v[i],x,y)/dx  +  v[i][x][y]*delta_y(v[i],x,y)/dy  +  1/densities[i+1]*delta_y(p,x,y)/dy  +  damp*v[i][x][y]);
-
-                next_h[x][y] = h[i][x][y] - dt * (u[i][x][y]*delta_x(eta,x,y)/dx   +  v[i][x][y]*delta_y(eta,x,y)/dy   +  eta[x][y]*(delta_x(u[i],x,y)/dx + delta_y(v[i],x,y)/dy));
-            }
-        }
-        for (uint x = 0; x < N; x++) {
-            next_h[x][0] = next_h[x][1];
-            next_h[x][M-1] = next_h[x][M-2];
-        }
-        for (uint y = 0; y < M; y++) {
-            next_h[0][y] = next_h[1][y];
-            next_h[N-1][y] = next_h[N-2][y];
-        }
-
-        prev_u[i] = u[i];
-        prev_v[i] = v[i];
-        prev_h[i] = h[i];
-        u[i] = next_u;
-        v[i] = next_v;
-        h[i] = next_h;
-    }
-}
-
-template<uint N, uint M, uint L>
-void ShallowWaterModel<N,M,L>::recalculate_normals(Model<DisplacementMesh>& m, const Matrix<N,M>& h) {
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+void ShallowWaterModel<N,M,L,Boundary,Real>::recalculate_normals(Model<DisplacementMesh>& m, const Field<N,M,Real>& h, uint x0, uint x1) {
     const double dx_w = 1.0 / (N-1);
     const double dz_w = 1.0 / (M-1);
-    uint i = 0;
-    for (uint x = 0; x < N; x++) {
+    uint i = x0 * N;
+    for (uint x = x0; x < x1; x++) {
         for (uint y = 0; y < M; y++) {
             Vec3f n;
             if (x >= 1 && y >= 1 && x < N-1 && y < M-1) {
@@ -198,52 +164,175 @@ void ShallowWaterModel<N,M,L>::recalculate_normals(Model<DisplacementMesh>& m, c
     }
 }
 
-template<uint N, uint M, uint L>
-void ShallowWaterModel<N,M,L>::update() {
-    for (uint i = 0; i < 10; i++)
-        step();
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+void ShallowWaterModel<N,M,L,Boundary,Real>::update() {
+    TRACE_SCOPE("ShallowWaterModel::update");
+    advance(10);
+    sync_surfaces();
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+void ShallowWaterModel<N,M,L,Boundary,Real>::advance(uint steps) {
+    engine.advance(steps);
 
+    // if (engine.get_t() % 60 == 0) {
+    //     printf("Total energy: %.8f\n", engine.calc_total_energy());
+    // }
+}
+
+// Uploads the surfaces at `alpha` of the way from the previous to the current step
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+void ShallowWaterModel<N,M,L,Boundary,Real>::sync_surfaces(double alpha) {
+    TRACE_SCOPE("sync_surfaces");
     for (uint i = 0; i < L; i++) {
-        for (uint x = 0; x < N; x++) {
-            for (uint y = 0; y < M; y++)
-                surfaces[i]->get_mesh().set_displacement(x*N + y, Vecf(0, h[i][x][y], 0));
+        pack_displacements(i, alpha);
+        update_normals(i);
+        surfaces[i]->get_mesh().displace();
+    }
+}
+
+// Only the rows the engine wrote since the last pack, and with a new alpha
+// the rows between two time levels, can look any different
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+void ShallowWaterModel<N,M,L,Boundary,Real>::pack_displacements(uint i, double alpha) {
+    const Field<N,M,Real>& h = engine.get_h(i);
+    const Field<N,M,Real>& prev_h = engine.get_prev_h(i);
+
+    uint x0, x1;
+    engine.take_dirty_rows(i, x0, x1);
+    if (alpha != packed_alpha[i]) {
+        uint m0, m1;
+        engine.get_moving_rows(i, m0, m1);
+        if (m0 < m1) {
+            x0 = (x0 < x1 ? std::min(x0, m0) : m0);
+            x1 = std::max(x1, m1);
         }
-        recalculate_normals(*surfaces[i], h[i]);
+    }
+    if (resync[i]) {
+        x0 = 0;
+        x1 = N;
+    }
 
-        surfaces[i]->get_mesh().displace();
+    const Real a = alpha;
+    for (uint x = x0; x < x1; x++) {
+        for (uint y = 0; y < M; y++)
+            interpolated[i][x][y] = prev_h[x][y] + a * (h[x][y] - prev_h[x][y]);
     }
+    packed_alpha[i] = alpha;
+    displace_surface(i, x0, x1);
+}
 
-    // if (t % 60 == 0) {
-    //     printf("Total energy: %.8f\n", calc_total_energy());
-    // }
+// Writes the rows in [x0, x1) of `interpolated` that differ from the mesh's
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+void ShallowWaterModel<N,M,L,Boundary,Real>::displace_surface(uint i, uint x0, uint x1) {
+    DisplacementMesh& mesh = surfaces[i]->get_mesh();
+    const float* current = mesh.get_displacements();
+    const Field<N,M,Real>& f = interpolated[i];
+    for (uint x = 0; x < N; x++) {
+        changed[x] = false;
+        if (x < x0 || x >= x1)
+            continue;
+        const float* row = current + 3 * (size_t)x*N;
+        bool differs = resync[i];
+        for (uint y = 0; y < M && !differs; y++)
+            differs = (row[3*y + 1] != (float)f[x][y]);
+        changed[x] = differs;
+        if (!differs)
+            continue;
+        for (uint y = 0; y < M; y++)
+            mesh.set_displacement(x*N + y, Vecf(0, f[x][y], 0));
+    }
+    resync[i] = false;
+}
 
-    t++;
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+void ShallowWaterModel<N,M,L,Boundary,Real>::show_surface(uint i, const float* h) {
+    for (size_t c = 0; c < (size_t)N * M; c++)
+        interpolated[i](c) = h[c];
+    displace_surface(i, 0, N);
+    update_normals(i);
+    surfaces[i]->get_mesh().displace();
 }
 
-template<uint N, uint M, uint L>
-double ShallowWaterModel<N,M,L>::calc_total_energy() const {
-    double E = 0;
-    // for (uint x = 0; x < N; x++) {
-    //     for (uint y = 0; y < M; y++) {
-    //         double PE = 0.5 * g * h[x][y]*h[x][y];
-    //         double KE = 0.5 * h[x][y] * Vec(u[x][y], v[x][y]).len2();
-    //         E += PE + KE;
-    //     }
-    // }
-    return E;
+// From the last pack_displacements, which must have been for the same
+// surface. A normal reads the rows either side, so each span of changed rows
+// grows by one row both ways.
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+void ShallowWaterModel<N,M,L,Boundary,Real>::update_normals(uint i) {
+    uint x = 0;
+    while (x < N) {
+        if (!changed[x]) {
+            x++;
+            continue;
+        }
+        uint end = x + 1;
+        while (end < N && changed[end])
+            end++;
+        const uint x0 = (x > 0 ? x-1 : 0), x1 = std::min(end+1, N);
+        recalculate_normals(*surfaces[i], interpolated[i], x0, x1);
+        surfaces[i]->get_mesh().mark_dirty(x0*N, x1*N);
+        x = end;
+    }
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+void ShallowWaterModel<N,M,L,Boundary,Real>::invalidate_surfaces() {
+    for (uint i = 0; i < L; i++)
+        resync[i] = true;
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+void ShallowWaterModel<N,M,L,Boundary,Real>::drop(double x, double y, double amplitude, double sigma) {
+    engine.add_drop(x, y, amplitude, sigma);
+    sync_surfaces();
+}
+
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+bool ShallowWaterModel<N,M,L,Boundary,Real>::pick_surface(Shader* pick_shader, double mouse_x, double mouse_y, double& x, double& y) {
+    TRACE_SCOPE("pick_surface");
+    GLfloat clear_color[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // The surface's texture coordinates are its y, x in bump coordinates, blue marks a hit
+    pick_shader->enable();
+    pick_shader->set_uniform("modelMatrix", *surfaces[0]->get_transform());
+    surfaces[0]->render();
+
+    // Mouse positions are in screen coordinates, which may be smaller than the pixels
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    int w, h;
+    glfwGetWindowSize(glfwGetCurrentContext(), &w, &h);
+    const int px = (int)(mouse_x * viewport[2] / std::max(w, 1));
+    const int py = viewport[3] - 1 - (int)(mouse_y * viewport[3] / std::max(h, 1));
+    unsigned char pixel[4] = { 0, 0, 0, 0 };
+    if (px >= 0 && py >= 0 && px < viewport[2] && py < viewport[3])
+        glReadPixels(viewport[0] + px, viewport[1] + py, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+
+    glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    if (pixel[2] == 0)
+        return false;
+    x = pixel[1] / 255.0;
+    y = pixel[0] / 255.0;
+    return true;
 }
 
-template<uint N, uint M, uint L>
-void ShallowWaterModel<N,M,L>::render(const Matrix4f& viewMat) {
-    shaders[0]->set_uniform("viewMatrix", viewMat);
-    shaders[0]->set_uniform("modelMatrix", *ground.get_transform());
+template<uint N, uint M, uint L, typename Boundary, typename Real>
+void ShallowWaterModel<N,M,L,Boundary,Real>::render() {
+    TRACE_SCOPE("render");
+    shaders[0]->enable();
+    model_matrices[0].set(*ground.get_transform());
     ground.render();
 
     for (uint i = 0; i < L; i++) {
-        shaders[i+1]->set_uniform("viewMatrix", viewMat);
-        shaders[i+1]->set_uniform("modelMatrix", *surfaces[i]->get_transform());
+        shaders[i+1]->enable();
+        model_matrices[i+1].set(*surfaces[i]->get_transform());
         surfaces[i]->render();
     }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,111 @@
+#ifndef __SIMULATION_CLOCK_H__
+#define __SIMULATION_CLOCK_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "utils/types.h"
+
+// Advances a fixed-dt simulation at a target rate of simulated seconds per
+// wall second. Every step is exactly dt long, so the simulated trajectory only
+// depends on the number of steps taken, never on the frame rate.
+class SimulationClock {
+public:
+    enum Policy {
+        CATCH_UP, // Keep owed steps and pay them back on later frames (up to max_lag)
+        DROP      // Forget owed steps that didn't fit in this frame's budget
+    };
+
+    SimulationClock(double dt_, double rate_ = 1.0, double budget_ = 0.008, uint max_steps_ = 64, Policy policy_ = DROP);
+
+    // Runs `step` as many times as this frame owes and the CPU budget allows
+    template<typename F>
+    uint advance(const F& step);
+
+    void set_rate(double r) { rate = r; }
+    void set_budget(double seconds) { budget = seconds; }
+    void set_policy(Policy p) { policy = p; }
+    void set_max_lag(double seconds) { max_lag = seconds; }
+    void set_paused(bool p);
+
+    // Fraction of a step between the last two states, for interpolated rendering
+    double get_alpha() const { return std::min(accumulator / dt, 1.0); }
+    double get_sim_time() const { return steps_taken * dt; }
+    unsigned long get_steps_taken() const { return steps_taken; }
+    unsigned long get_steps_dropped() const { return steps_dropped; }
+    double get_step_cost() const { return step_cost; }
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    double dt, rate, budget;
+    uint max_steps;
+    Policy policy;
+    double max_lag = 0.25;
+
+    bool paused = false;
+    double accumulator = 0;
+    double step_cost = 0; // Smoothed CPU seconds per step
+    unsigned long steps_taken = 0, steps_dropped = 0;
+    clock::time_point last_time;
+
+    static double seconds(clock::duration d) { return std::chrono::duration<double>(d).count(); }
+};
+
+SimulationClock::SimulationClock(double dt_, double rate_, double budget_, uint max_steps_, Policy policy_):
+        dt(dt_), rate(rate_), budget(budget_), max_steps(max_steps_), policy(policy_), last_time(clock::now()) {
+}
+
+void SimulationClock::set_paused(bool p) {
+    if (paused && !p)
+        last_time = clock::now(); // Don't count the paused time as owed
+    paused = p;
+}
+
+template<typename F>
+uint SimulationClock::advance(const F& step) {
+    clock::time_point now = clock::now();
+    double elapsed = seconds(now - last_time);
+    last_time = now;
+    if (paused)
+        return 0;
+
+    // Never owe more than max_lag of wall time, avoids a spiral after a stall
+    accumulator += std::min(elapsed, max_lag) * rate;
+
+    uint owed = (uint)std::floor(accumulator / dt);
+    uint affordable = max_steps;
+    if (step_cost > 0)
+        affordable = (uint)std::max(1.0, std::min((double)max_steps, budget / step_cost));
+    uint steps = std::min(owed, affordable);
+
+    clock::time_point start = clock::now();
+    for (uint i = 0; i < steps; i++)
+        step();
+    if (steps > 0) {
+        double cost = seconds(clock::now() - start) / steps;
+        step_cost = (step_cost > 0 ? 0.9 * step_cost + 0.1 * cost : cost);
+    }
+
+    accumulator -= steps * dt;
+    steps_taken += steps;
+
+    if (owed > steps) {
+        if (policy == DROP) {
+            steps_dropped += owed - steps;
+            accumulator -= (owed - steps) * dt;
+        }
+        else {
+            double max_owed = max_lag * rate;
+            if (accumulator > max_owed) {
+                steps_dropped += (unsigned long)((accumulator - max_owed) / dt);
+                accumulator = max_owed;
+            }
+        }
+    }
+
+    return steps;
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef __SOURCES_H__
+#define __SOURCES_H__
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "utils/types.h"
+#include "field.h"
+#include "scenario.h"
+
+// Momentum source terms as template policies of the engine. The stencil hands
+// `add` the advection, pressure and damping tendencies of a cell and steps
+// whatever comes back, so a term is fused into the same sweep and NoSources
+// leaves the generated code exactly as it was.
+//
+// Tendencies are subtracted (kernels.h) and carry the factor 2 of the
+// undivided differences, so a term's physical rate r is added as -2r and its
+// coefficients keep their physical meaning next to the pressure gradient.
+
+// Where a term is being evaluated
+struct SourceCell {
+    uint layer, layers; // Layer 0 is the top
+    uint x, y;
+    double y_pos;       // y in [0, 1), the north-south coordinate
+    double thickness;   // Of the layer at the cell, > 0 in wet cells
+    double inv_density; // Of the layer
+};
+
+struct NoSources {
+    void add(double& tu, double& tv, double u, double v, const SourceCell& c) const {}
+};
+
+// Coriolis on a beta plane centred on the middle of the domain,
+// f = f0 + beta * (y - 0.5); beta = 0 is an f-plane. Stepped forward like the
+// rest, so it adds a slow growth of order (f dt)^2 per step that damp has to
+// outweigh.
+struct Coriolis {
+    double f0, beta;
+
+    Coriolis(double f0_ = 0, double beta_ = 0): f0(f0_), beta(beta_) {}
+
+    void add(double& tu, double& tv, double u, double v, const SourceCell& c) const {
+        const double f = f0 + beta * (c.y_pos - 0.5);
+        tu -= 2 * f * v;
+        tv += 2 * f * u;
+    }
+};
+
+// Quadratic drag of the floor on the bottom layer, -C_d |u| u / thickness.
+// Thinner water is taken to be depth_floor deep so the drag stays bounded at
+// the shore.
+struct QuadraticFriction {
+    double drag, depth_floor;
+
+    QuadraticFriction(double drag_ = 0, double depth_floor_ = 0.01): drag(drag_), depth_floor(depth_floor_) {}
+
+    void add(double& tu, double& tv, double u, double v, const SourceCell& c) const {
+        if (c.layer+1 != c.layers)
+            return;
+        const double k = 2 * drag * std::sqrt(u*u + v*v) / std::max(c.thickness, depth_floor);
+        tu += k * u;
+        tv += k * v;
+    }
+};
+
+// Surface stress on the top layer, tau / (density * thickness), from a stress
+// field given per cell. The field is either tau_x, tau_y or buffers the
+// caller owns and may rewrite between steps, read in place every step.
+template<uint N, uint M>
+struct WindStress {
+    Field<N,M,double> tau_x, tau_y;
+    double depth_floor;
+
+    WindStress(double depth_floor_ = 0.01): depth_floor(depth_floor_) {}
+
+    void set_uniform(double tx, double ty) {
+        tau_x.fill(tx);
+        tau_y.fill(ty);
+    }
+
+    // Element (x, y) at ext[x*stride_x + y*stride_y], NULL goes back to tau_x, tau_y
+    void set_external(const double* ext_x_, const double* ext_y_, ptrdiff_t stride_x_, ptrdiff_t stride_y_) {
+        ext_x = ext_x_;
+        ext_y = ext_y_;
+        stride_x = stride_x_;
+        stride_y = stride_y_;
+    }
+
+    void add(double& tu, double& tv, double u, double v, const SourceCell& c) const {
+        if (c.layer != 0)
+            return;
+        const double k = 2 * c.inv_density / std::max(c.thickness, depth_floor);
+        if (ext_x != NULL) {
+            const ptrdiff_t i = c.x * stride_x + c.y * stride_y;
+            tu -= k * ext_x[i];
+            tv -= k * ext_y[i];
+        }
+        else {
+            tu -= k * tau_x[c.x][c.y];
+            tv -= k * tau_y[c.x][c.y];
+        }
+    }
+
+private:
+    const double* ext_x = NULL;
+    const double* ext_y = NULL;
+    ptrdiff_t stride_x = 0, stride_y = 0;
+};
+
+// A Gaussian patch of surface pressure, e.g. one dragged around by the
+// mouse. Hydrostatic, so every layer feels its gradient. Centre and sigma
+// are in the coordinates of bumps, the amplitude in those of the pressure
+// the stencil sums (g * density * height). Zero amplitude is off.
+template<uint N, uint M>
+struct SurfacePressure {
+    double x = 0, y = 0;
+    double amplitude = 0, sigma = 0.05;
+
+    void set(double x_, double y_, double amplitude_, double sigma_) {
+        x = x_;
+        y = y_;
+        amplitude = amplitude_;
+        sigma = sigma_;
+    }
+    void clear() { amplitude = 0; }
+
+    void add(double& tu, double& tv, double u, double v, const SourceCell& c) const {
+        if (amplitude == 0)
+            return;
+        const double xx = (double)c.x / (N-1) - x, yy = (double)c.y / (M-1) - y;
+        const double r = (xx*xx + yy*yy) / (2 * sigma*sigma);
+        if (r > 8)
+            return;
+        // The analytic gradient scaled like an undivided difference over dx = 1/N
+        const double dp = -amplitude * std::exp(-r) / (sigma*sigma);
+        tu += c.inv_density * (2.0 * N / (N-1)) * dp * xx;
+        tv += c.inv_density * (2.0 * M / (M-1)) * dp * yy;
+    }
+};
+
+// Two policies one after the other, nest for more
+template<typename A, typename B>
+struct SourcePair {
+    A first;
+    B second;
+
+    SourcePair(A first_ = A(), B second_ = B()): first(first_), second(second_) {}
+
+    void add(double& tu, double& tv, double u, double v, const SourceCell& c) const {
+        first.add(tu, tv, u, v, c);
+        second.add(tu, tv, u, v, c);
+    }
+};
+
+// Everything an ocean scenario can switch on
+template<uint N, uint M>
+using OceanSources = SourcePair<Coriolis, SourcePair<QuadraticFriction, WindStress<N,M> > >;
+
+template<uint N, uint M>
+OceanSources<N,M> ocean_sources(const Scenario& s) {
+    WindStress<N,M> wind;
+    wind.set_uniform(s.wind_stress[0], s.wind_stress[1]);
+    return OceanSources<N,M>(Coriolis(s.coriolis_f0, s.coriolis_beta),
+                             SourcePair<QuadraticFriction, WindStress<N,M> >(QuadraticFriction(s.bottom_drag), wind));
+}
+
+#endif
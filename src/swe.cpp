@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <exception>
+#include <new>
+#include <sstream>
+#include <string>
+
+#include "utils/types.h"
+#include "utils/thread_pool.h"
+#include "field.h"
+#include "scenario.h"
+#include "sources.h"
+#include "bathymetry.h"
+#include "shallow_water_engine.h"
+#include "swe.h"
+
+// Grid of every engine behind the API, like the sweep's a compile-time size
+#ifndef SWE_GRID
+#define SWE_GRID 75
+#endif
+
+static const uint MAX_LAYERS = 4;
+
+typedef Field<SWE_GRID,SWE_GRID> ApiField;
+
+static thread_local std::string last_error;
+
+static int fail(const std::string& error) {
+    last_error = error;
+    return -1;
+}
+
+// Exceptions can't cross into C, every entry point catches them all and
+// reports the one in flight through this, which itself never throws
+static int fail_exception() {
+    const char* error = "internal error";
+    try {
+        throw;
+    }
+    catch (const std::bad_alloc&) {
+        error = "out of memory";
+    }
+    catch (const std::exception& e) {
+        error = e.what();
+    }
+    catch (...) {
+    }
+    try {
+        last_error = error;
+    }
+    catch (...) {
+        last_error.clear();
+    }
+    return -1;
+}
+
+// What the C side sees of an engine, the ones behind it are compiled per
+// layer count, scheme and precision. All of them carry the ocean sources so
+// forcing can be attached at any time.
+class EngineHandle {
+public:
+    virtual ~EngineHandle() {}
+
+    virtual void step(uint steps) = 0;
+    virtual void get_field(swe_field field, uint layer, swe_view& view) const = 0;
+    virtual void set_field(swe_field field, uint layer, const ApiField& f) = 0;
+    virtual void set_wind_stress(const double* tau_x, const double* tau_y, ptrdiff_t stride_x, ptrdiff_t stride_y) = 0;
+    virtual void set_thread_pool(ThreadPool* pool) = 0;
+
+    virtual double get_dt() const = 0;
+    virtual uint get_t() const = 0;
+    virtual double calc_total_energy() const = 0;
+};
+
+template<uint L, typename Integrator, typename Real>
+class EngineImpl : public EngineHandle {
+public:
+    typedef ShallowWaterEngine<SWE_GRID,SWE_GRID,L,ReflectiveBoundary,Integrator,Real,OceanSources<SWE_GRID,SWE_GRID> > Engine;
+
+    EngineImpl(const Scenario& s): engine(s, ReflectiveBoundary(), ocean_sources<SWE_GRID,SWE_GRID>(s)) {}
+
+    void step(uint steps) { engine.advance(steps); }
+
+    void get_field(swe_field field, uint layer, swe_view& view) const {
+        const Field<SWE_GRID,SWE_GRID,Real>* f = &engine.get_h_B();
+        if      (field == SWE_FIELD_H)      f = &engine.get_h(layer);
+        else if (field == SWE_FIELD_U)      f = &engine.get_u(layer);
+        else if (field == SWE_FIELD_V)      f = &engine.get_v(layer);
+        else if (field == SWE_FIELD_PREV_H) f = &engine.get_prev_h(layer);
+
+        view.data = f->get_data();
+        view.type = (sizeof(Real) == sizeof(float) ? SWE_FLOAT32 : SWE_FLOAT64);
+        view.nx = SWE_GRID;
+        view.ny = SWE_GRID;
+        view.stride_x = SWE_GRID;
+        view.stride_y = 1;
+    }
+
+    void set_field(swe_field field, uint layer, const ApiField& f) {
+        if (field == SWE_FIELD_BATHYMETRY) {
+            engine.set_bathymetry(f);
+            return;
+        }
+        ApiField u = field_cast<double>(engine.get_u(layer));
+        ApiField v = field_cast<double>(engine.get_v(layer));
+        ApiField h = field_cast<double>(engine.get_h(layer));
+        if      (field == SWE_FIELD_U) u = f;
+        else if (field == SWE_FIELD_V) v = f;
+        else                           h = f;
+        engine.set_state(layer, u, v, h);
+    }
+
+    void set_wind_stress(const double* tau_x, const double* tau_y, ptrdiff_t stride_x, ptrdiff_t stride_y) {
+        engine.get_sources().second.second.set_external(tau_x, tau_y, stride_x, stride_y);
+    }
+
+    void set_thread_pool(ThreadPool* pool) { engine.set_thread_pool(pool); }
+
+    double get_dt() const { return engine.get_dt(); }
+    uint get_t() const { return engine.get_t(); }
+    double calc_total_energy() const { return engine.calc_total_energy(); }
+
+private:
+    Engine engine;
+};
+
+template<uint L, typename Integrator>
+static EngineHandle* create_engine(const Scenario& s) {
+    if (s.precision == PRECISION_FLOAT)
+        return new EngineImpl<L,Integrator,float>(s);
+    return new EngineImpl<L,Integrator,double>(s);
+}
+
+template<uint L>
+static EngineHandle* create_engine(const Scenario& s) {
+    if (s.scheme == SCHEME_SEMI_IMPLICIT)
+        return create_engine<L,SemiImplicit>(s);
+    return create_engine<L,ForwardEuler>(s);
+}
+
+struct swe_engine {
+    Scenario scenario;
+    EngineHandle* handle;
+    ThreadPool* pool;
+};
+
+static swe_engine* create(const Scenario& s) {
+    if (s.grid != SWE_GRID) {
+        fail("grid must be " + std::to_string(SWE_GRID));
+        return NULL;
+    }
+    if (s.layers < 1 || s.layers > MAX_LAYERS) {
+        fail("layers must be 1 to " + std::to_string(MAX_LAYERS));
+        return NULL;
+    }
+
+    swe_engine* engine = new swe_engine();
+    engine->scenario = s;
+    engine->handle = NULL;
+    engine->pool = NULL;
+    try {
+        switch (s.layers) {
+            case 1:  engine->handle = create_engine<1>(s); break;
+            case 2:  engine->handle = create_engine<2>(s); break;
+            case 3:  engine->handle = create_engine<3>(s); break;
+            default: engine->handle = create_engine<MAX_LAYERS>(s); break;
+        }
+
+        if (!s.bathymetry.empty()) {
+            ApiField h_B;
+            ThreadPool loader(std::max(s.threads, 1u));
+            if (!load_bathymetry(s.bathymetry.c_str(), s.bathymetry_opts, h_B, loader)) {
+                fail("failed to load bathymetry " + s.bathymetry);
+                swe_destroy(engine);
+                return NULL;
+            }
+            engine->handle->set_field(SWE_FIELD_BATHYMETRY, 0, h_B);
+        }
+        if (swe_set_threads(engine, s.threads) != 0) {
+            swe_destroy(engine);
+            return NULL;
+        }
+    }
+    catch (...) {
+        swe_destroy(engine);
+        throw;
+    }
+    return engine;
+}
+
+static bool check_layer(const swe_engine* engine, swe_field field, int layer) {
+    if (engine == NULL) {
+        fail("engine is NULL");
+        return false;
+    }
+    if (field != SWE_FIELD_BATHYMETRY && (layer < 0 || (uint)layer >= engine->scenario.layers)) {
+        fail("layer " + std::to_string(layer) + " out of range");
+        return false;
+    }
+    return true;
+}
+
+extern "C" {
+
+int swe_api_version(void) {
+    return SWE_API_VERSION;
+}
+
+const char* swe_last_error(void) {
+    return last_error.c_str();
+}
+
+swe_engine* swe_create(const char* config) {
+    try {
+        ScenarioFile file;
+        if (config != NULL) {
+            std::istringstream in(config);
+            if (!parse_scenario(in, "config", file)) {
+                fail("bad scenario config");
+                return NULL;
+            }
+        }
+        if (!file.sweep.empty()) {
+            fail("a [sweep] section has no meaning here");
+            return NULL;
+        }
+        return create(file.base);
+    }
+    catch (...) {
+        fail_exception();
+        return NULL;
+    }
+}
+
+swe_engine* swe_create_from_file(const char* path) {
+    try {
+        ScenarioFile file;
+        if (path == NULL || !load_scenario(path, file)) {
+            fail(std::string("failed to load scenario ") + (path != NULL ? path : "NULL"));
+            return NULL;
+        }
+        if (!file.sweep.empty()) {
+            fail("a [sweep] section has no meaning here");
+            return NULL;
+        }
+        return create(file.base);
+    }
+    catch (...) {
+        fail_exception();
+        return NULL;
+    }
+}
+
+void swe_destroy(swe_engine* engine) {
+    if (engine == NULL)
+        return;
+    try {
+        delete engine->handle;
+        delete engine->pool;
+        delete engine;
+    }
+    catch (...) {
+        fail_exception();
+    }
+}
+
+int swe_grid_size(const swe_engine* engine, int* nx, int* ny) {
+    try {
+        if (engine == NULL)
+            return fail("engine is NULL");
+        if (nx != NULL)
+            *nx = SWE_GRID;
+        if (ny != NULL)
+            *ny = SWE_GRID;
+        return 0;
+    }
+    catch (...) {
+        return fail_exception();
+    }
+}
+
+int swe_layers(const swe_engine* engine) {
+    try {
+        return (engine != NULL ? (int)engine->scenario.layers : fail("engine is NULL"));
+    }
+    catch (...) {
+        return fail_exception();
+    }
+}
+
+double swe_dt(const swe_engine* engine) {
+    try {
+        return (engine != NULL ? engine->handle->get_dt() : 0);
+    }
+    catch (...) {
+        fail_exception();
+        return 0;
+    }
+}
+
+unsigned long swe_time_step(const swe_engine* engine) {
+    try {
+        return (engine != NULL ? engine->handle->get_t() : 0);
+    }
+    catch (...) {
+        fail_exception();
+        return 0;
+    }
+}
+
+int swe_set_threads(swe_engine* engine, int threads) {
+    try {
+        if (engine == NULL)
+            return fail("engine is NULL");
+        if (threads < 1)
+            return fail("threads must be at least 1");
+
+        // Nulled before the new pool is made, so if that throws there is nothing left to free twice
+        engine->handle->set_thread_pool(NULL);
+        delete engine->pool;
+        engine->pool = NULL;
+        engine->scenario.threads = 1;
+        if (threads > 1)
+            engine->pool = new ThreadPool(threads);
+        engine->handle->set_thread_pool(engine->pool);
+        engine->scenario.threads = threads;
+        return 0;
+    }
+    catch (...) {
+        return fail_exception();
+    }
+}
+
+int swe_set_field(swe_engine* engine, swe_field field, int layer, const double* data, ptrdiff_t stride_x, ptrdiff_t stride_y) {
+    try {
+        if (!check_layer(engine, field, layer))
+            return -1;
+        if (field == SWE_FIELD_PREV_H)
+            return fail("the previous time level can't be set");
+        if (data == NULL)
+            return fail("data is NULL");
+
+        ApiField f;
+        for (uint x = 0; x < SWE_GRID; x++) {
+            for (uint y = 0; y < SWE_GRID; y++)
+                f[x][y] = data[x * stride_x + y * stride_y];
+        }
+        engine->handle->set_field(field, layer, f);
+        return 0;
+    }
+    catch (...) {
+        return fail_exception();
+    }
+}
+
+int swe_set_wind_stress(swe_engine* engine, const double* tau_x, const double* tau_y, ptrdiff_t stride_x, ptrdiff_t stride_y) {
+    try {
+        if (engine == NULL)
+            return fail("engine is NULL");
+        if ((tau_x == NULL) != (tau_y == NULL))
+            return fail("tau_x and tau_y must both be given or both be NULL");
+        engine->handle->set_wind_stress(tau_x, tau_y, stride_x, stride_y);
+        return 0;
+    }
+    catch (...) {
+        return fail_exception();
+    }
+}
+
+int swe_step(swe_engine* engine, unsigned int steps) {
+    try {
+        if (engine == NULL)
+            return fail("engine is NULL");
+        engine->handle->step(steps);
+        return 0;
+    }
+    catch (...) {
+        return fail_exception();
+    }
+}
+
+int swe_get_field(const swe_engine* engine, swe_field field, int layer, swe_view* view) {
+    try {
+        if (!check_layer(engine, field, layer))
+            return -1;
+        if (view == NULL)
+            return fail("view is NULL");
+        engine->handle->get_field(field, layer, *view);
+        return 0;
+    }
+    catch (...) {
+        return fail_exception();
+    }
+}
+
+double swe_total_energy(const swe_engine* engine) {
+    try {
+        return (engine != NULL ? engine->handle->calc_total_energy() : 0);
+    }
+    catch (...) {
+        fail_exception();
+        return 0;
+    }
+}
+
+}
@@ -0,0 +1,95 @@
+#ifndef __SWE_H__
+#define __SWE_H__
+
+#include <stddef.h>
+
+/* C interface to the headless solver, built as libswe.so by `make lib`.
+ *
+ *     swe_engine* e = swe_create("layers = 2\nsteps = 0\n");
+ *     swe_step(e, 100);
+ *     swe_view h;
+ *     swe_get_field(e, SWE_FIELD_H, 0, &h);
+ *     // cell (x, y) is ((const double*)h.data)[x*h.stride_x + y*h.stride_y]
+ *     swe_destroy(e);
+ *
+ * Views point straight at the engine's storage, nothing is copied. The time
+ * levels rotate every step, so a view holds until the next swe_step or
+ * swe_set_* on that engine. Functions returning int give 0 on success and -1
+ * on failure, with the reason in swe_last_error(). An engine may be used by
+ * one thread at a time, different engines from any number. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SWE_API_VERSION 1
+
+/* The library is built with hidden visibility, only these are exported */
+#if defined(__GNUC__)
+#define SWE_EXPORT __attribute__((visibility("default")))
+#else
+#define SWE_EXPORT
+#endif
+
+typedef struct swe_engine swe_engine;
+
+typedef enum {
+    SWE_FIELD_H,          /* Height of the layer's surface above the datum */
+    SWE_FIELD_U,
+    SWE_FIELD_V,
+    SWE_FIELD_PREV_H,     /* H one step earlier */
+    SWE_FIELD_BATHYMETRY  /* Floor, layer is ignored */
+} swe_field;
+
+typedef enum {
+    SWE_FLOAT32,
+    SWE_FLOAT64
+} swe_type;
+
+/* Strides are in elements, between neighbouring cells along x and y */
+typedef struct {
+    const void* data;
+    swe_type type;
+    int nx, ny;
+    ptrdiff_t stride_x, stride_y;
+} swe_view;
+
+SWE_EXPORT int swe_api_version(void);
+
+/* Why the last call on this thread failed */
+SWE_EXPORT const char* swe_last_error(void);
+
+/* From the text of a scenario file (key = value lines, no [sweep] section)
+ * or the file itself; NULL config is the default scenario */
+SWE_EXPORT swe_engine* swe_create(const char* config);
+SWE_EXPORT swe_engine* swe_create_from_file(const char* path);
+SWE_EXPORT void swe_destroy(swe_engine* engine);
+
+SWE_EXPORT int swe_grid_size(const swe_engine* engine, int* nx, int* ny);
+SWE_EXPORT int swe_layers(const swe_engine* engine);
+SWE_EXPORT double swe_dt(const swe_engine* engine);
+SWE_EXPORT unsigned long swe_time_step(const swe_engine* engine);
+
+/* Threads each step is split across, 1 runs on the caller only */
+SWE_EXPORT int swe_set_threads(swe_engine* engine, int threads);
+
+/* Initial conditions: copies one field of a layer from the caller's doubles,
+ * at both time levels. SWE_FIELD_BATHYMETRY also lifts any surface below the
+ * new floor. */
+SWE_EXPORT int swe_set_field(swe_engine* engine, swe_field field, int layer, const double* data, ptrdiff_t stride_x, ptrdiff_t stride_y);
+
+/* Surface wind stress read in place from the caller's buffers every step, so
+ * they must outlive the engine or be detached with NULL first */
+SWE_EXPORT int swe_set_wind_stress(swe_engine* engine, const double* tau_x, const double* tau_y, ptrdiff_t stride_x, ptrdiff_t stride_y);
+
+SWE_EXPORT int swe_step(swe_engine* engine, unsigned int steps);
+
+SWE_EXPORT int swe_get_field(const swe_engine* engine, swe_field field, int layer, swe_view* view);
+
+SWE_EXPORT double swe_total_energy(const swe_engine* engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
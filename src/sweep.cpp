@@ -0,0 +1,429 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "utils/types.h"
+#include "utils/thread_pool.h"
+#include "utils/tile_scheduler.h"
+#include "utils/trace.h"
+#include "scenario.h"
+#include "shallow_water_engine.h"
+#include "precision_monitor.h"
+#include "gauges.h"
+#include "async_writer.h"
+#include "frame_ring.h"
+#include "roofline.h"
+
+// Grid size is a template parameter of the engine, so a sweep binary runs one size
+#ifndef SWEEP_GRID
+#define SWEEP_GRID 75
+#endif
+static const uint MAX_LAYERS = 4;
+
+struct JobResult {
+    double seconds = 0;
+    double initial_energy = 0, final_energy = 0;
+    double max_deviation = 0; // Largest |h - h0| of the top surface at the end
+    PrecisionReport precision; // Against a double run, zero for double runs
+    unsigned long frames_dropped = 0; // Snapshots skipped by the output policy
+    double solver_iterations = 0; // Mean per step, semi-implicit runs only
+    size_t remote_bytes = 0, field_bytes = 0; // Of the stepped fields at the end, with numa_report
+    const char* status = "ok";
+};
+
+// Snapshot file: char magic[8] = "SWESNAP", uint32 N, M, L, output_every, then
+// per frame uint32 step, uint32 0 and h of every layer as N x M float32
+static void write_snapshot_header(AsyncWriter& writer, uint layers, uint every) {
+    OutputBuffer* buffer = writer.acquire(24);
+    if (buffer == NULL)
+        return;
+    const uint32_t header[4] = { SWEEP_GRID, SWEEP_GRID, layers, every };
+    memcpy(buffer->data(), "SWESNAP", 8);
+    memcpy(buffer->data() + 8, header, sizeof(header));
+    writer.submit(buffer);
+}
+
+// Copies the heights into a pooled buffer, the writer thread does the rest
+template<typename Engine, uint L>
+static void write_snapshot(AsyncWriter& writer, const Engine& engine) {
+    const size_t cells = (size_t)SWEEP_GRID * SWEEP_GRID;
+    OutputBuffer* buffer = writer.acquire(8 + L * cells * sizeof(float));
+    if (buffer == NULL)
+        return;
+    const uint32_t frame[2] = { engine.get_t(), 0 };
+    memcpy(buffer->data(), frame, sizeof(frame));
+    float* out = (float*)(buffer->data() + 8);
+    for (uint i = 0; i < L; i++) {
+        const typename Engine::real_type* h = engine.get_h(i).get_data();
+        for (size_t c = 0; c < cells; c++)
+            *out++ = h[c];
+    }
+    writer.submit(buffer);
+}
+
+// Outputs of the job go to `out_prefix`.gauges and `out_prefix`.snap
+template<uint L, typename Integrator, typename Real, typename Sources>
+void run_job(const Scenario& s, const Sources& sources, const std::string& out_prefix, JobResult& result) {
+    typedef ShallowWaterEngine<SWEEP_GRID,SWEEP_GRID,L,ReflectiveBoundary,Integrator,Real,Sources> Engine;
+
+    Engine* engine = new Engine(s, ReflectiveBoundary(), sources);
+
+    ThreadPool* pool = (s.threads > 1 ? new ThreadPool(s.threads) : NULL);
+    engine->set_thread_pool(pool);
+
+    // Pinned before the fields move, so every worker first touches the rows
+    // it steps from the node it then stays on
+    if (!s.cpu_map.empty() && !(pool != NULL ? pool->pin(s.cpu_map) : pin_thread(s.cpu_map[0]))) {
+        fprintf(stderr, "ERROR Failed to pin the solver's threads to cpu_map!\n");
+        result.status = "pin_error";
+        delete pool;
+        delete engine;
+        return;
+    }
+    if (pool != NULL || s.huge_pages != HUGE_PAGES_NONE)
+        engine->place_fields(s.huge_pages);
+
+    TileScheduler* scheduler = (s.tile_size > 0 ? new TileScheduler(std::max(s.threads, 1u)) : NULL);
+    engine->set_tile_scheduler(scheduler, s.tile_size);
+
+    Field<SWEEP_GRID,SWEEP_GRID> h_B;
+    if (!s.bathymetry.empty()) {
+        ThreadPool loader(std::max(s.threads, 1u));
+        if (!load_bathymetry(s.bathymetry.c_str(), s.bathymetry_opts, h_B, loader)) {
+            result.status = "bathymetry_error";
+            delete scheduler;
+            delete pool;
+            delete engine;
+            return;
+        }
+        engine->set_bathymetry(h_B);
+    }
+
+    // Gauges are sampled on the job's own thread, a few hundred stations cost
+    // far less than handing them to the pool every step
+    GaugeSet<SWEEP_GRID,SWEEP_GRID,L> gauges(s.gauge_layers);
+    for (uint i = 0; i < s.gauges.size(); i++)
+        gauges.add(s.gauges[i].name, s.gauges[i].x, s.gauges[i].y);
+    if (gauges.size() > 0 && !gauges.open((out_prefix + ".gauges").c_str(), s.dt)) {
+        result.status = "gauge_error";
+        delete scheduler;
+        delete pool;
+        delete engine;
+        return;
+    }
+
+    AsyncWriter snapshots(s.output_queue, s.output_policy);
+    if (s.output_every > 0) {
+        if (!snapshots.open((out_prefix + ".snap").c_str())) {
+            result.status = "output_error";
+            delete scheduler;
+            delete pool;
+            delete engine;
+            return;
+        }
+        write_snapshot_header(snapshots, L, s.output_every);
+    }
+
+    // Live frames for viewers attaching from another process
+    FramePublisher<SWEEP_GRID,SWEEP_GRID,L> publisher;
+    if (!s.publish.empty()) {
+        if (!publisher.open(s.publish.c_str(), s, engine->get_h_B())) {
+            result.status = "publish_error";
+            delete scheduler;
+            delete pool;
+            delete engine;
+            return;
+        }
+        publisher.publish(*engine);
+    }
+    const uint publish_every = std::max(s.publish_every, 1u);
+
+    result.initial_energy = engine->calc_total_energy();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // Without per-step outputs a tiled run needn't stop the graph every step
+    if (gauges.size() == 0 && s.output_every == 0 && !publisher.is_open()) {
+        engine->advance(s.steps);
+    }
+    else {
+        engine->advance(s.steps, [&]() {
+            if (gauges.size() > 0)
+                gauges.sample(*engine);
+            if (snapshots.due(engine->get_t(), s.output_every))
+                write_snapshot<Engine,L>(snapshots, *engine);
+            if (publisher.is_open() && engine->get_t() % publish_every == 0)
+                publisher.publish(*engine);
+        });
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.solver_iterations = (double)engine->get_total_solver_iterations() / std::max(s.steps, 1u);
+    if (s.numa_report)
+        result.remote_bytes = engine->count_remote_bytes(result.field_bytes);
+
+    result.final_energy = engine->calc_total_energy();
+    const Field<SWEEP_GRID,SWEEP_GRID,Real>& h = engine->get_h(0);
+    for (uint x = 0; x < SWEEP_GRID; x++) {
+        for (uint y = 0; y < SWEEP_GRID; y++)
+            result.max_deviation = std::max(result.max_deviation, std::fabs(h[x][y] - s.h0));
+    }
+    if (!std::isfinite(result.final_energy) || !std::isfinite(result.max_deviation))
+        result.status = "unstable";
+
+    snapshots.close();
+    result.frames_dropped = snapshots.get_dropped();
+
+    // Reduced precision runs are replayed in double afterwards, outside the timing
+    if (s.precision != PRECISION_DOUBLE && strcmp(result.status, "ok") == 0) {
+        PrecisionMonitor<SWEEP_GRID,SWEEP_GRID,L,ReflectiveBoundary,Integrator,Sources> monitor(s, ReflectiveBoundary(), sources);
+        monitor.set_thread_pool(pool);
+        monitor.set_bathymetry(h_B);
+        result.precision = monitor.compare(*engine);
+    }
+
+    delete scheduler;
+    delete pool;
+    delete engine;
+}
+
+// Scenarios without Coriolis, friction or wind get the engine without the terms
+template<uint L, typename Integrator, typename Real>
+void run_job(const Scenario& s, const std::string& out_prefix, JobResult& result) {
+    if (s.has_sources())
+        run_job<L,Integrator,Real>(s, ocean_sources<SWEEP_GRID,SWEEP_GRID>(s), out_prefix, result);
+    else
+        run_job<L,Integrator,Real>(s, NoSources(), out_prefix, result);
+}
+
+template<uint L, typename Integrator>
+void run_job(const Scenario& s, const std::string& out_prefix, JobResult& result) {
+    if (s.precision == PRECISION_FLOAT)
+        run_job<L,Integrator,float>(s, out_prefix, result);
+    else
+        run_job<L,Integrator,double>(s, out_prefix, result);
+}
+
+template<uint L>
+void run_job(const Scenario& s, const std::string& out_prefix, JobResult& result) {
+    if (s.scheme == SCHEME_SEMI_IMPLICIT)
+        run_job<L,SemiImplicit>(s, out_prefix, result);
+    else
+        run_job<L,ForwardEuler>(s, out_prefix, result);
+}
+
+void run_job(const Scenario& s, const std::string& out_prefix, JobResult& result) {
+    // The runner thread steps too when pinned, and takes other jobs after this one
+    SavedAffinity affinity;
+    if (s.grid != SWEEP_GRID) {
+        result.status = "unsupported_grid";
+        return;
+    }
+    switch (s.layers) {
+        case 1: run_job<1>(s, out_prefix, result); break;
+        case 2: run_job<2>(s, out_prefix, result); break;
+        case 3: run_job<3>(s, out_prefix, result); break;
+        case 4: run_job<MAX_LAYERS>(s, out_prefix, result); break;
+        default: result.status = "unsupported_layers";
+    }
+}
+
+
+// Roofline report of the base scenario's step() on one thread
+template<uint L, typename Real>
+void run_roofline(const Scenario& s) {
+    typedef ShallowWaterEngine<SWEEP_GRID,SWEEP_GRID,L,ReflectiveBoundary,ForwardEuler,Real> Engine;
+    Engine* engine = new Engine(s);
+
+    const MachineRoofs roofs = probe_machine();
+    PerfCounters counters;
+    std::vector<KernelReport> kernels;
+    const double cells = (double)SWEEP_GRID * SWEEP_GRID;
+    kernels.push_back(measure_kernel("step", cells, step_cost(SWEEP_GRID, SWEEP_GRID, L, sizeof(Real), false, s.min_depth > 0, engine->get_substeps()),
+                                     counters, [&]() { engine->step(); }));
+    print_roofline(stdout, roofs, kernels, counters.is_available());
+    delete engine;
+}
+
+template<uint L>
+void run_roofline(const Scenario& s) {
+    if (s.precision == PRECISION_FLOAT)
+        run_roofline<L,float>(s);
+    else
+        run_roofline<L,double>(s);
+}
+
+bool run_roofline(const Scenario& s) {
+    if (s.grid != SWEEP_GRID || s.scheme != SCHEME_EXPLICIT) {
+        fprintf(stderr, "ERROR The roofline report needs the explicit scheme on a %ux%u grid!\n", SWEEP_GRID, SWEEP_GRID);
+        return false;
+    }
+    switch (s.layers) {
+        case 1: run_roofline<1>(s); break;
+        case 2: run_roofline<2>(s); break;
+        case 3: run_roofline<3>(s); break;
+        case 4: run_roofline<MAX_LAYERS>(s); break;
+        default:
+            fprintf(stderr, "ERROR Unsupported number of layers: %u!\n", s.layers);
+            return false;
+    }
+    return true;
+}
+
+
+// Hands out the machine's cores to jobs, a job needing k threads waits for k
+// free cores. Cores are numbered from 0, and the ones jobs hold at the same
+// time never overlap, so each can pin to its own part of a cpu_map.
+class CoreBudget {
+public:
+    CoreBudget(uint cores): taken(cores, false) {}
+
+    // Numbers of the cores now held in `held`, as many as the job gets
+    void acquire(uint k, std::vector<uint>& held) {
+        k = std::max(1u, std::min(k, (uint)taken.size()));
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return (uint)std::count(taken.begin(), taken.end(), false) >= k; });
+        held.clear();
+        for (uint c = 0; held.size() < k; c++) {
+            if (!taken[c]) {
+                taken[c] = true;
+                held.push_back(c);
+            }
+        }
+    }
+
+    void release(const std::vector<uint>& held) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (uint i = 0; i < held.size(); i++)
+                taken[held[i]] = false;
+        }
+        cv.notify_all();
+    }
+
+private:
+    std::vector<bool> taken;
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+static void write_header(FILE* out) {
+    fprintf(out, "job,name,grid,layers,dt,damp,g,h0,hM,sigma,steps,threads,precision,scheme,seconds,initial_energy,final_energy,max_deviation,max_error,rms_error,energy_error,frames_dropped,solver_iterations,status\n");
+}
+
+static void write_record(FILE* out, uint job, const Scenario& s, const JobResult& r) {
+    fprintf(out, "%u,%s,%u,%u,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%u,%u,%s,%s,%.6f,%.12g,%.12g,%.12g,%.6g,%.6g,%.6g,%lu,%.3g,%s\n",
+            job, s.name.c_str(), s.grid, s.layers, s.dt, s.damp, s.g, s.h0, s.hM, s.sigma,
+            s.steps, s.threads, s.precision == PRECISION_FLOAT ? "float" : "double",
+            s.scheme == SCHEME_SEMI_IMPLICIT ? "semi_implicit" : "explicit",
+            r.seconds, r.initial_energy, r.final_energy, r.max_deviation,
+            r.precision.max_error, r.precision.rms_error, r.precision.energy_error, r.frames_dropped, r.solver_iterations, r.status);
+    fflush(out);
+}
+
+// Usage: sweep <scenario.scn> [-o results.csv] [-j max concurrent jobs] [-r]
+//
+// -r prints a roofline report of the base scenario instead of sweeping
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <scenario.scn> [-o results.csv] [-j jobs] [-r]\n", argv[0]);
+        return 1;
+    }
+    const char* out_path = "results.csv";
+    uint cores = std::max(1u, std::thread::hardware_concurrency());
+    uint max_jobs = cores;
+    bool roofline = false;
+    for (int a = 2; a < argc; a++) {
+        if (strcmp(argv[a], "-o") == 0 && a + 1 < argc)
+            out_path = argv[++a];
+        else if (strcmp(argv[a], "-j") == 0 && a + 1 < argc)
+            max_jobs = std::max(1, atoi(argv[++a]));
+        else if (strcmp(argv[a], "-r") == 0)
+            roofline = true;
+    }
+
+    std::string out_stem = out_path;
+    if (out_stem.size() > 4 && out_stem.compare(out_stem.size() - 4, 4, ".csv") == 0)
+        out_stem.resize(out_stem.size() - 4);
+
+    ScenarioFile file;
+    if (!load_scenario(argv[1], file))
+        return 1;
+    if (roofline)
+        return (run_roofline(file.base) ? 0 : 1);
+    std::vector<Scenario> jobs;
+    if (!file.expand(jobs))
+        return 1;
+
+    FILE* out = fopen(out_path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "ERROR Failed to open output file: %s!\n", out_path);
+        return 1;
+    }
+    write_header(out);
+
+    printf("Running %zu jobs, at most %u at a time on %u cores\n", jobs.size(), max_jobs, cores);
+
+    std::atomic<uint> next(0);
+    std::mutex out_mutex;
+    // Pinned sweeps only hand out the CPUs of the map
+    CoreBudget budget(file.base.cpu_map.empty() ? cores : std::min<size_t>(cores, file.base.cpu_map.size()));
+
+    std::vector<std::thread> workers;
+    for (uint w = 0; w < std::min<size_t>(max_jobs, jobs.size()); w++) {
+        workers.push_back(std::thread([&, w]() {
+            TRACE_THREAD("job runner " + std::to_string(w));
+            for (uint j = next++; j < jobs.size(); j = next++) {
+                std::vector<uint> held;
+                budget.acquire(jobs[j].threads, held);
+                Scenario s = jobs[j];
+                s.threads = (uint)held.size();
+                // Core c of the budget is entry c of the map
+                if (!s.cpu_map.empty()) {
+                    s.cpu_map.clear();
+                    for (uint i = 0; i < held.size(); i++)
+                        s.cpu_map.push_back(jobs[j].cpu_map[held[i] % jobs[j].cpu_map.size()]);
+                }
+
+                // Series of job j go next to the results, results.csv -> results.j.gauges
+                char suffix[32];
+                snprintf(suffix, sizeof(suffix), ".%u", j);
+                // and so do live frames of a sweep, /swe -> /swe.j
+                if (!s.publish.empty() && jobs.size() > 1)
+                    s.publish += suffix;
+
+                JobResult result;
+                {
+                    TRACE_SCOPE("job");
+                    run_job(s, out_stem + suffix, result);
+                }
+                budget.release(held);
+
+                std::lock_guard<std::mutex> lock(out_mutex);
+                write_record(out, j, s, result);
+                printf("[%u/%zu] %s: %s (%.2fs)\n", j+1, jobs.size(), s.name.c_str(), result.status, result.seconds);
+                // Each step streams every field about once, so this is roughly its cross-node traffic
+                if (s.numa_report && result.field_bytes > 0)
+                    printf("    %.1f%% of %.1f MB of fields on another node than the thread stepping them\n",
+                           100.0 * result.remote_bytes / result.field_bytes, result.field_bytes / 1048576.0);
+                else if (s.numa_report)
+                    printf("    NUMA nodes of the fields unknown\n");
+            }
+        }));
+    }
+    for (uint w = 0; w < workers.size(); w++)
+        workers[w].join();
+
+    fclose(out);
+
+    // Only with SWE_TRACE, results.csv -> results.trace.json
+    TRACE_SAVE((out_stem + ".trace.json").c_str());
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/types.h"
+#include "utils/thread_pool.h"
+#include "bathymetry.h"
+#include "scenario.h"
+#include "shallow_water_1d.h"
+
+#ifndef TRANSECT_GRID
+#define TRANSECT_GRID 200
+#endif
+static const uint T_N = TRANSECT_GRID;
+
+// Output layout: header, then per transect its floor (n floats) followed by
+// `frames` snapshots of h (n floats each), all float32 in host byte order.
+// dt is the base scenario's, the .csv index has each transect's own.
+struct TransectFileHeader {
+    char magic[8];
+    uint32_t n, count, frames, output_every;
+    float dx, dt;
+};
+
+struct Transect {
+    const Scenario* scenario;
+    int raster_row; // -1 for a flat floor
+};
+
+static Vector<T_N> transect_floor(const Raster& raster, const BathymetryOptions& opts, uint row) {
+    Vector<T_N> h_B(0.0);
+    const uint W = raster.get_width();
+    for (uint x = 0; x < T_N; x++) {
+        double c = (double)x * (W - 1) / (T_N - 1);
+        uint c0 = std::min((uint)c, W - 1), c1 = std::min(c0 + 1, W - 1);
+        double f = c - c0;
+        h_B[x] = opts.offset + opts.scale * ((1-f) * raster.get(c0, row) + f * raster.get(c1, row));
+    }
+    return h_B;
+}
+
+// Usage: transects <scenario.scn> [-o transects.bin]
+//
+// Every job of the scenario's sweep is run on every row of its bathymetry
+// raster (or once on a flat floor), all transects in parallel.
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <scenario.scn> [-o transects.bin]\n", argv[0]);
+        return 1;
+    }
+    std::string out_path = "transects.bin";
+    if (argc > 3 && strcmp(argv[2], "-o") == 0)
+        out_path = argv[3];
+
+    ScenarioFile file;
+    if (!load_scenario(argv[1], file))
+        return 1;
+    // Every block has the same frames and the floor comes from one raster
+    for (uint a = 0; a < file.sweep.size(); a++) {
+        const std::string& key = file.sweep[a].key;
+        if (key == "steps" || key == "output_every" || key.compare(0, 10, "bathymetry") == 0) {
+            fprintf(stderr, "ERROR Transects can't sweep '%s', all jobs share the run length and floor!\n", key.c_str());
+            return 1;
+        }
+    }
+    std::vector<Scenario> jobs;
+    if (!file.expand(jobs))
+        return 1;
+
+    // All jobs of a sweep share the bathymetry and run length
+    const Scenario& base = file.base;
+    Raster raster;
+    if (!base.bathymetry.empty() && !raster.open(base.bathymetry.c_str(), base.bathymetry_opts))
+        return 1;
+
+    std::vector<Transect> transects;
+    for (uint j = 0; j < jobs.size(); j++) {
+        if (base.bathymetry.empty()) {
+            Transect t = { &jobs[j], -1 };
+            transects.push_back(t);
+        }
+        else {
+            for (uint r = 0; r < raster.get_height(); r++) {
+                Transect t = { &jobs[j], (int)r };
+                transects.push_back(t);
+            }
+        }
+    }
+
+    const uint every = (base.output_every > 0 ? base.output_every : std::max(base.steps, 1u));
+    const uint frames = base.steps / every + 1;
+    const size_t block = (size_t)(frames + 1) * T_N;
+
+    int fd = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR Failed to open output file: %s!\n", out_path.c_str());
+        return 1;
+    }
+    TransectFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SWE1D", 5);
+    header.n = T_N;
+    header.count = transects.size();
+    header.frames = frames;
+    header.output_every = every;
+    header.dx = 1.0f / T_N;
+    header.dt = base.dt;
+    if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        fprintf(stderr, "ERROR Failed to write %s!\n", out_path.c_str());
+        return 1;
+    }
+
+    printf("Running %zu transects of %u cells for %u steps\n", transects.size(), T_N, base.steps);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    ThreadPool pool;
+    std::atomic<bool> failed(false);
+    pool.parallel_for(0, transects.size(), [&](uint lo, uint hi) {
+        std::vector<float> out(block);
+        for (uint k = lo; k < hi; k++) {
+            const Transect& tr = transects[k];
+            Vector<T_N> h_B(0.0);
+            if (tr.raster_row >= 0)
+                h_B = transect_floor(raster, base.bathymetry_opts, tr.raster_row);
+
+            ShallowWater1D<T_N> engine(*tr.scenario, h_B);
+
+            for (uint x = 0; x < T_N; x++)
+                out[x] = h_B[x];
+            uint f = 1;
+            for (uint s = 0; s <= base.steps; s++) {
+                if (s % every == 0 && f <= frames) {
+                    const Vector<T_N>& h = engine.get_h();
+                    for (uint x = 0; x < T_N; x++)
+                        out[f * T_N + x] = h[x];
+                    f++;
+                }
+                if (s < base.steps)
+                    engine.step();
+            }
+
+            // Blocks sit at fixed offsets, threads never touch each other's bytes
+            off_t offset = sizeof(header) + (off_t)k * block * sizeof(float);
+            if (pwrite(fd, &out[0], block * sizeof(float), offset) != (ssize_t)(block * sizeof(float)))
+                failed = true;
+        }
+    });
+    close(fd);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Wrote %s in %.2fs\n", out_path.c_str(), seconds);
+
+    // Which job and raster row each block belongs to
+    std::string index_path = out_path + ".csv";
+    FILE* index = fopen(index_path.c_str(), "w");
+    if (index != NULL) {
+        fprintf(index, "transect,name,raster_row,dt\n");
+        for (uint k = 0; k < transects.size(); k++)
+            fprintf(index, "%u,%s,%d,%g\n", k, transects[k].scenario->name.c_str(), transects[k].raster_row, transects[k].scenario->dt);
+        fclose(index);
+    }
+
+    if (failed) {
+        fprintf(stderr, "ERROR Failed to write %s!\n", out_path.c_str());
+        return 1;
+    }
+    return 0;
+}
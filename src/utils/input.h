@@ -94,7 +94,7 @@ public:
         last_key_pressed = Key::NONE;
         scroll_amt = 0;
 
-        for (int i = 0; i < keys_to_change.size(); i++) {
+        for (size_t i = 0; i < keys_to_change.size(); i++) {
             int key = keys_to_change[i].first;
             if (keys_to_change[i].second) // if first being pressed
                 first_pressed_keys[key] = false;
@@ -103,7 +103,7 @@ public:
         }
         keys_to_change.clear();
 
-        for (int i = 0; i < mouse_vals_to_change.size(); i++) {
+        for (size_t i = 0; i < mouse_vals_to_change.size(); i++) {
             int button = mouse_vals_to_change[i].first;
             if (mouse_vals_to_change[i].second) // if first being pressed
                 mouse_first_pressed[button] = false;
@@ -132,7 +132,7 @@ private:
     static Key last_key_pressed;
 
     static bool contains_key(const std::vector<std::pair<int, bool>>& v, int key) {
-        for (int i = 0; i < v.size(); i++) {
+        for (size_t i = 0; i < v.size(); i++) {
             if (v[i].first == key)
                 return true;
         }
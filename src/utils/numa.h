@@ -0,0 +1,194 @@
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "types.h"
+
+// Where field memory lives on multi-socket machines, without libnuma. Linux
+// puts an anonymous page on the node of the thread that first writes it, so
+// storage mapped fresh and filled by the worker that will step it stays local
+// to that worker, as long as the worker is pinned and can't migrate. Pages
+// are only queried, never moved. Elsewhere everything here degrades to plain
+// pages, no pinning and unknown nodes.
+
+enum HugePages {
+    HUGE_PAGES_NONE,
+    HUGE_PAGES_TRANSPARENT, // 2 MB aligned and madvise'd, the kernel promotes them when it can
+    HUGE_PAGES_EXPLICIT     // MAP_HUGETLB from the reserved pool, transparent if it is empty
+};
+
+static const size_t HUGE_PAGE_SIZE = 2 << 20;
+// Granularity of page_nodes, a huge page reports its node for each stretch
+static const size_t NODE_PAGE_SIZE = 4096;
+// CPUs an affinity mask can name
+#ifdef __linux__
+static const uint MAX_CPUS = CPU_SETSIZE;
+#else
+static const uint MAX_CPUS = 1024;
+#endif
+
+// Fresh anonymous pages nothing has touched yet, 64 byte aligned. Allocations
+// under a huge page get small pages whatever `huge` says. `mapped` is what
+// unmap_pages needs back.
+inline void* map_pages(size_t bytes, HugePages huge, size_t& mapped) {
+#ifdef __linux__
+    if (bytes < HUGE_PAGE_SIZE)
+        huge = HUGE_PAGES_NONE;
+    const size_t page = (huge == HUGE_PAGES_NONE ? (size_t)sysconf(_SC_PAGESIZE) : HUGE_PAGE_SIZE);
+    mapped = (bytes + page - 1) / page * page;
+
+    if (huge == HUGE_PAGES_EXPLICIT) {
+        void* p = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            return p;
+        static bool warned = false;
+        if (!warned) {
+            fprintf(stderr, "WARNING No explicit huge pages left (see /proc/sys/vm/nr_hugepages), using transparent ones!\n");
+            warned = true;
+        }
+        huge = HUGE_PAGES_TRANSPARENT;
+    }
+
+    // Over-map by a huge page and trim, so the kernel can back it with whole ones
+    const size_t extra = (huge == HUGE_PAGES_TRANSPARENT ? HUGE_PAGE_SIZE : 0);
+    char* p = (char*)mmap(NULL, mapped + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    if (extra > 0) {
+        char* aligned = (char*)(((size_t)p + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+        if (aligned > p)
+            munmap(p, aligned - p);
+        if (aligned + mapped < p + mapped + extra)
+            munmap(aligned + mapped, p + mapped + extra - (aligned + mapped));
+        p = aligned;
+        madvise(p, mapped, MADV_HUGEPAGE);
+    }
+    return p;
+#else
+    void* p = NULL;
+    mapped = 0;
+    return (posix_memalign(&p, 64, bytes) == 0 ? p : NULL);
+#endif
+}
+
+inline void unmap_pages(void* p, size_t mapped) {
+#ifdef __linux__
+    munmap(p, mapped);
+#else
+    free(p);
+#endif
+}
+
+// Pins the calling thread to one CPU, false if it can't be
+inline bool pin_thread(uint cpu) {
+#ifdef __linux__
+    if (cpu >= MAX_CPUS)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+// Puts the calling thread's CPU affinity back as it was at construction, for
+// a thread that pins itself for one job and then goes on to others
+class SavedAffinity {
+public:
+#ifdef __linux__
+    SavedAffinity() { saved = (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0); }
+    ~SavedAffinity() {
+        if (saved)
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+private:
+    cpu_set_t set;
+    bool saved;
+#else
+    SavedAffinity() {}
+#endif
+};
+
+// NUMA node the calling thread runs on, -1 if unknown
+inline int current_node() {
+#ifdef __linux__
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+        return node;
+#endif
+    return -1;
+}
+
+// Node of every NODE_PAGE_SIZE stretch of [p, p + bytes) that has been
+// touched, -1 for the rest, appended to `nodes`
+inline void page_nodes(const void* p, size_t bytes, std::vector<int>& nodes) {
+    const size_t page = NODE_PAGE_SIZE;
+    const size_t first = (size_t)p / page * page;
+    const size_t count = ((size_t)p + bytes - first + page - 1) / page;
+#ifdef __linux__
+    // move_pages with no target nodes only reports where each page is
+    std::vector<void*> pages(count);
+    std::vector<int> status(count, -1);
+    for (size_t k = 0; k < count; k++)
+        pages[k] = (void*)(first + k * page);
+    if (count > 0 && syscall(SYS_move_pages, 0, count, &pages[0], NULL, &status[0], 0) == 0) {
+        for (size_t k = 0; k < count; k++)
+            nodes.push_back(status[k] >= 0 ? status[k] : -1);
+        return;
+    }
+#endif
+    nodes.insert(nodes.end(), count, -1);
+}
+
+// CPU list of a topology map such as "0 2 4 6" or "0-7,16-23", empty if it
+// doesn't parse or names a CPU from MAX_CPUS on
+inline std::vector<uint> parse_cpu_map(const std::string& map) {
+    std::vector<uint> cpus;
+    std::string text = map;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == ',')
+            text[i] = ' ';
+    }
+    size_t pos = 0;
+    while (pos < text.size()) {
+        while (pos < text.size() && text[pos] == ' ')
+            pos++;
+        if (pos == text.size())
+            break;
+        uint lo = 0, hi = 0;
+        int used = 0;
+        if (sscanf(text.c_str() + pos, "%u-%u%n", &lo, &hi, &used) == 2) {
+            // %u takes "-1" as UINT_MAX, so "0--1" lands here too
+            if (lo > hi || hi >= MAX_CPUS)
+                return std::vector<uint>();
+            for (uint c = lo; c <= hi; c++)
+                cpus.push_back(c);
+        }
+        else if (sscanf(text.c_str() + pos, "%u%n", &lo, &used) == 1 && lo < MAX_CPUS) {
+            cpus.push_back(lo);
+        }
+        else {
+            return std::vector<uint>();
+        }
+        pos += used;
+    }
+    return cpus;
+}
+
+#endif
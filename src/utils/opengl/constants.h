@@ -6,4 +6,7 @@ static const int TCOORD_ATTRIB = 1;
 static const int NORMAL_ATTRIB = 2;
 static const int DISPLACEMENT_ATTRIB = 3;
 
+static const char* const FRAME_BLOCK_NAME = "Frame";
+static const int FRAME_BLOCK_BINDING = 0;
+
 #endif
\ No newline at end of file
@@ -4,11 +4,17 @@
 #include <GLFW/glfw3.h>
 #include <leon/vector.h>
 #include <leon/matrix.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
 
 #include "constants.h"
 #include "../types.h"
 #include "mesh.h"
 
+// Per-vertex displacements and normals on top of a mesh. Setters only touch
+// the CPU copies; displace() uploads the vertex spans marked dirty since the
+// last upload, one glBufferSubData per span and buffer.
 class DisplacementMesh {
 public:
     DisplacementMesh(const Mesh& m, GLenum usage_ = GL_STATIC_DRAW);
@@ -16,7 +22,14 @@ public:
     void set_displacement(uint i, const Vec3f& d);
     void set_normal(uint i, const Vec3f& d);
 
-    void displace() const;
+    // Vertices [first, end) changed, spans are merged with the last one if they touch
+    void mark_dirty(uint first, uint end);
+    void mark_all_dirty() { mark_dirty(0, mesh.num_verts() / 3); }
+
+    // x, y, z of every vertex
+    const float* get_displacements() const { return displacement; }
+
+    void displace();
     void render() const;
     void remove();
 
@@ -34,6 +47,8 @@ protected:
 
     GLenum usage;
 
+    std::vector<std::pair<uint,uint> > dirty;
+
     void add_attribs();
 };
 
@@ -82,22 +97,44 @@ void DisplacementMesh::set_normal(uint i, const Vec3f& d) {
     normals[3*i + 2] = d[2];
 }
 
-void DisplacementMesh::displace() const {
+void DisplacementMesh::mark_dirty(uint first, uint end) {
+    if (first >= end)
+        return;
+    if (!dirty.empty() && first <= dirty.back().second && end >= dirty.back().first) {
+        dirty.back().first = std::min(dirty.back().first, first);
+        dirty.back().second = std::max(dirty.back().second, end);
+    }
+    else {
+        dirty.push_back(std::make_pair(first, end));
+    }
+}
+
+void DisplacementMesh::displace() {
+    if (dirty.empty())
+        return;
     glBindVertexArray(*mesh);
 
     glBindBuffer(GL_ARRAY_BUFFER, nbo);
-    glBufferData(GL_ARRAY_BUFFER, mesh.num_verts() * sizeof(float), normals, usage);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    for (uint k = 0; k < dirty.size(); k++) {
+        const uint first = 3 * dirty[k].first, count = 3 * (dirty[k].second - dirty[k].first);
+        glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(float), count * sizeof(float), normals + first);
+    }
 
     glBindBuffer(GL_ARRAY_BUFFER, dbo);
-    glBufferData(GL_ARRAY_BUFFER, mesh.num_verts() * sizeof(float), displacement, usage);
+    for (uint k = 0; k < dirty.size(); k++) {
+        const uint first = 3 * dirty[k].first, count = 3 * (dirty[k].second - dirty[k].first);
+        glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(float), count * sizeof(float), displacement + first);
+    }
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     glBindVertexArray(0);
+    dirty.clear();
 }
 
+// Allocates the buffers with everything set so far, nothing is dirty after
 void DisplacementMesh::static_displace() {
     add_attribs();
+    dirty.clear();
 }
 
 void DisplacementMesh::render() const {
@@ -0,0 +1,73 @@
+#ifndef __FRAMEBUFFER_H__
+#define __FRAMEBUFFER_H__
+
+#ifndef GLFW_INCLUDE_GLCOREARB
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>
+#include <stdio.h>
+#include "../types.h"
+
+// Offscreen render target, an RGBA8 colour and a 24 bit depth renderbuffer of
+// any size. Renderbuffers rather than textures, nothing samples them and
+// every driver (Mesa's llvmpipe included) supports these formats.
+class Framebuffer {
+public:
+    Framebuffer(uint w, uint h);
+
+    bool is_complete() const { return complete; }
+
+    // Binds for drawing and reading and sets the viewport to the whole target
+    void bind() const;
+    static void unbind();
+    void remove();
+
+    uint get_width() const { return width; }
+    uint get_height() const { return height; }
+    GLuint operator * () const { return fbo; }
+
+private:
+    GLuint fbo, color, depth;
+    uint width, height;
+    bool complete;
+};
+
+Framebuffer::Framebuffer(uint w, uint h): width(w), height(h) {
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+    complete = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    if (!complete)
+        fprintf(stderr, "ERROR Framebuffer %ux%u is incomplete!\n", width, height);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void Framebuffer::bind() const {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+}
+
+void Framebuffer::unbind() {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void Framebuffer::remove() {
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &color);
+    glDeleteRenderbuffers(1, &depth);
+}
+
+#endif
@@ -3,13 +3,17 @@
 
 #include <GLFW/glfw3.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "../types.h"
 
 static void error_callback(int error, const char* description) {
 	fprintf(stderr, "GL Error: %s\n", description);
 }
 
-bool initGLFW(uint v_maj = 3, uint v_min = 2, uint msaa_samples = 1, bool forward_compat = true) {
+// `headless` is for offscreen windows: without a display to connect to, the
+// context is created through OSMesa, Mesa's software renderer, which needs a
+// GLFW built with OSMesa support
+bool initGLFW(uint v_maj = 3, uint v_min = 2, uint msaa_samples = 1, bool forward_compat = true, bool headless = false) {
 	glfwSetErrorCallback(error_callback);
 
     // Initialize GLFW
@@ -23,6 +27,9 @@ bool initGLFW(uint v_maj = 3, uint v_min = 2, uint msaa_samples = 1, bool forwar
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, forward_compat ? GL_TRUE : GL_FALSE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
+	if (headless && getenv("DISPLAY") == NULL && getenv("WAYLAND_DISPLAY") == NULL)
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+
     return true;
 }
 
@@ -60,9 +60,9 @@ namespace {
         std::vector<int> normsIndices;
         std::vector<int> textsIndices;
 
-        for (int f = 0; f < faces.size(); ++f) {
+        for (size_t f = 0; f < faces.size(); ++f) {
             for (int g = 0; g < 3; ++g) {
-                int v = 0;
+                size_t v = 0;
                 bool create = true;
                 for (; v < vertsIndices.size(); ++v) {
                     if (vertsIndices[v] == faces[f].groups[g].pos && normsIndices[v] == faces[f].groups[g].norm && textsIndices[v] == faces[f].groups[g].tc) {
@@ -75,31 +75,31 @@ namespace {
                     normsIndices.push_back(faces[f].groups[g].norm);
                     textsIndices.push_back(faces[f].groups[g].tc);
                 }
-                indices.push_back(v);
+                indices.push_back((int)v);
             }
         }
 
         unsigned int* indicesArr = new unsigned int[indices.size()];
-        for (int i = 0; i < indices.size(); ++i) {
+        for (size_t i = 0; i < indices.size(); ++i) {
             indicesArr[i] = (unsigned int)indices[i];
         }
 
         float* posArr = new float[vertsIndices.size()*3];
-        for (int i = 0; i < vertsIndices.size(); ++i) {
+        for (size_t i = 0; i < vertsIndices.size(); ++i) {
             posArr[3*i+0] = verts[3*vertsIndices[i]+0];
             posArr[3*i+1] = verts[3*vertsIndices[i]+1];
             posArr[3*i+2] = verts[3*vertsIndices[i]+2];
         }
 
         float* normArr = new float[normsIndices.size()*3];
-        for (int i = 0; i < normsIndices.size(); ++i) {
+        for (size_t i = 0; i < normsIndices.size(); ++i) {
             normArr[3*i+0] = norms[3*normsIndices[i]+0];
             normArr[3*i+1] = norms[3*normsIndices[i]+1];
             normArr[3*i+2] = norms[3*normsIndices[i]+2];
         }
 
         float* texArr = new float[textsIndices.size()*2];
-        for (int i = 0; i < textsIndices.size(); ++i) {
+        for (size_t i = 0; i < textsIndices.size(); ++i) {
             texArr[2*i+0] = texts[2*textsIndices[i]+0];
             texArr[2*i+1] = 1 - texts[2*textsIndices[i]+1];
         }
@@ -12,6 +12,24 @@
 
 #include "constants.h"
 
+class Shader;
+
+// Uniform location resolved once up front, avoids the by-name lookup on every set
+template<typename T>
+class Uniform {
+public:
+    Uniform(): shader(NULL), location(-1) {}
+    Uniform(Shader* shader_, GLint location_): shader(shader_), location(location_) {}
+
+    void set(const T& value) const;
+
+    GLint operator * () const { return location; }
+
+private:
+    Shader* shader;
+    GLint location;
+};
+
 class Shader {
 public:
     Shader(const std::string& vert_shader, const std::string& frag_shader);
@@ -21,6 +39,11 @@ public:
     void disable();
 
     GLuint get_uniform(const char* name);
+    template<typename T>
+    Uniform<T> get_uniform_handle(const char* name) { return Uniform<T>(this, get_uniform(name)); }
+
+    void bind_uniform_block(const char* name, GLuint binding);
+
     void set_uniform(const char* name, int value);
     void set_uniform(const char* name, float x);
     void set_uniform(const char* name, double x) { set_uniform(name, (float)x); }
@@ -39,6 +62,12 @@ public:
 
     void set_uniform(const char* name, const Matrix4f& mat);
 
+    void set_uniform(GLint location, int value);
+    void set_uniform(GLint location, float x);
+    void set_uniform(GLint location, const Vec3f& v);
+    void set_uniform(GLint location, const Vec4f& v);
+    void set_uniform(GLint location, const Matrix4f& mat);
+
 private:
     static Shader* current;
 
@@ -47,10 +76,16 @@ private:
     std::map<std::string, GLuint> uniforms_locations;
 
     GLuint add_shader(const char* shader, GLenum type);
+    void load_uniform_locations();
 };
 
 Shader* Shader::current = NULL;
 
+template<typename T>
+void Uniform<T>::set(const T& value) const {
+    shader->set_uniform(location, value);
+}
+
 Shader::Shader(const std::string& vert_shader, const std::string& frag_shader) {
     program = glCreateProgram();
 
@@ -78,6 +113,12 @@ Shader::Shader(const std::string& vert_shader, const std::string& frag_shader) {
     glDeleteShader(vertID);
     glDeleteShader(fragID);
 
+    load_uniform_locations();
+
+    // Per-frame camera/light data comes from a shared uniform buffer
+    if (glGetUniformBlockIndex(program, FRAME_BLOCK_NAME) != GL_INVALID_INDEX)
+        bind_uniform_block(FRAME_BLOCK_NAME, FRAME_BLOCK_BINDING);
+
     enabled = false;
 }
 
@@ -91,6 +132,8 @@ Shader::~Shader() {
 
 
 void Shader::enable() {
+    if (current == this)
+        return;
     if (current != NULL)
         current->disable();
     current = this;
@@ -113,7 +156,7 @@ GLuint Shader::get_uniform(const char* name) {
         return uniforms_locations[s_name];
 
     GLuint result = glGetUniformLocation(program, name);
-    if (result == -1)
+    if (result == (GLuint)-1)
         fprintf(stderr, "Could not find uniform variable '%s'!\n", name);
     else
         uniforms_locations[s_name] = result;
@@ -121,6 +164,15 @@ GLuint Shader::get_uniform(const char* name) {
     return result;
 }
 
+void Shader::bind_uniform_block(const char* name, GLuint binding) {
+    GLuint index = glGetUniformBlockIndex(program, name);
+    if (index == GL_INVALID_INDEX) {
+        fprintf(stderr, "Could not find uniform block '%s'!\n", name);
+        return;
+    }
+    glUniformBlockBinding(program, index, binding);
+}
+
 void Shader::set_uniform(const char* name, int value) {
     if (!enabled) enable();
     glUniform1i(get_uniform(name), value);
@@ -151,6 +203,48 @@ void Shader::set_uniform(const char* name, const Matrix4f& mat) {
     glUniformMatrix4fv(get_uniform(name), 1, false, *mat.flatten());
 }
 
+void Shader::set_uniform(GLint location, int value) {
+    if (!enabled) enable();
+    glUniform1i(location, value);
+}
+
+void Shader::set_uniform(GLint location, float x) {
+    if (!enabled) enable();
+    glUniform1f(location, x);
+}
+
+void Shader::set_uniform(GLint location, const Vec3f& v) {
+    if (!enabled) enable();
+    glUniform3f(location, v[0], v[1], v[2]);
+}
+
+void Shader::set_uniform(GLint location, const Vec4f& v) {
+    if (!enabled) enable();
+    glUniform4f(location, v[0], v[1], v[2], v[3]);
+}
+
+void Shader::set_uniform(GLint location, const Matrix4f& mat) {
+    if (!enabled) enable();
+    glUniformMatrix4fv(location, 1, false, *mat.flatten());
+}
+
+
+void Shader::load_uniform_locations() {
+    // Resolve every active (non-block) uniform once at link time
+    GLint count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    for (GLint i = 0; i < count; i++) {
+        char name[256];
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type;
+        glGetActiveUniform(program, i, sizeof(name), &length, &size, &type, name);
+
+        GLint location = glGetUniformLocation(program, name);
+        if (location != -1)
+            uniforms_locations[std::string(name, length)] = location;
+    }
+}
 
 GLuint Shader::add_shader(const char* shader, GLenum type) {
     GLuint id = glCreateShader(type);
@@ -0,0 +1,79 @@
+#ifndef __UNIFORM_BUFFER_H__
+#define __UNIFORM_BUFFER_H__
+
+#include <GLFW/glfw3.h>
+#include <string.h>
+
+#include <leon/vector.h>
+#include <leon/matrix.h>
+
+#include "constants.h"
+#include "../types.h"
+
+// Uniform buffer bound to a fixed binding point, T must follow the std140 layout
+template<typename T>
+class UniformBuffer {
+public:
+    UniformBuffer(GLuint binding_, GLenum usage = GL_DYNAMIC_DRAW);
+
+    void update(const T& data) const;
+    void remove();
+
+    GLuint operator * () const { return ubo; }
+
+private:
+    GLuint ubo, binding;
+};
+
+template<typename T>
+UniformBuffer<T>::UniformBuffer(GLuint binding_, GLenum usage): binding(binding_) {
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(T), NULL, usage);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+}
+
+template<typename T>
+void UniformBuffer<T>::update(const T& data) const {
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+template<typename T>
+void UniformBuffer<T>::remove() {
+    glDeleteBuffers(1, &ubo);
+}
+
+
+// Mirrors the `Frame` block declared in the shaders (std140)
+struct FrameUniforms {
+    float proj_matrix[16];
+    float view_matrix[16];
+    float view_pos[4];
+    float light_direction[4];
+    float light_ambient[4];
+    float light_diffuse[4];
+    float light_specular[4];
+
+    void set_proj(const Matrix4f& m) { memcpy(proj_matrix, *m.flatten(), sizeof(proj_matrix)); }
+    void set_view(const Matrix4f& m) { memcpy(view_matrix, *m.flatten(), sizeof(view_matrix)); }
+
+    void set_view_pos(const Vec3f& v)        { set(view_pos, v); }
+    void set_light_direction(const Vec3f& v) { set(light_direction, v); }
+    void set_light_ambient(const Vec3f& v)   { set(light_ambient, v); }
+    void set_light_diffuse(const Vec3f& v)   { set(light_diffuse, v); }
+    void set_light_specular(const Vec3f& v)  { set(light_specular, v); }
+
+private:
+    static void set(float* dst, const Vec3f& v) {
+        dst[0] = v[0];
+        dst[1] = v[1];
+        dst[2] = v[2];
+        dst[3] = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.h"
+#include "trace.h"
+#include "numa.h"
+
+// Fixed set of persistent workers. parallel_for statically splits a range into
+// one contiguous chunk per thread (the calling thread takes chunk 0), so the
+// same index always lands on the same worker.
+class ThreadPool {
+public:
+    ThreadPool(uint threads = 0);
+    ~ThreadPool();
+
+    // Calls f(lo, hi) on disjoint sub-ranges covering [begin, end), blocks until done
+    template<typename F>
+    void parallel_for(uint begin, uint end, const F& f);
+
+    // Calls f(k) once on every worker k in [0, size())
+    template<typename F>
+    void run_on_all(const F& f);
+
+    uint size() const { return workers.size() + 1; }
+
+    // Pins worker k to cpus[k % cpus.size()], the calling thread included as
+    // worker 0, which stays pinned until it restores its own affinity (see
+    // SavedAffinity). False if any of them can't be.
+    bool pin(const std::vector<uint>& cpus);
+
+private:
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable start_cv, done_cv;
+    std::function<void(uint)> job;
+    unsigned long generation = 0;
+    uint pending = 0;
+    bool stopping = false;
+
+    void work(uint k);
+};
+
+ThreadPool::ThreadPool(uint threads) {
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for (uint k = 1; k < threads; k++)
+        workers.push_back(std::thread(&ThreadPool::work, this, k));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start_cv.notify_all();
+    for (uint k = 0; k < workers.size(); k++)
+        workers[k].join();
+}
+
+void ThreadPool::work(uint k) {
+    TRACE_THREAD("pool worker " + std::to_string(k));
+    unsigned long seen = 0;
+    while (true) {
+        std::function<void(uint)> f;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start_cv.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            f = job;
+        }
+        {
+            TRACE_SCOPE("pool job");
+            f(k);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0)
+                done_cv.notify_one();
+        }
+    }
+}
+
+template<typename F>
+void ThreadPool::run_on_all(const F& f) {
+    if (workers.empty()) {
+        f(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = f;
+        pending = workers.size();
+        generation++;
+    }
+    start_cv.notify_all();
+
+    f(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&]() { return pending == 0; });
+}
+
+bool ThreadPool::pin(const std::vector<uint>& cpus) {
+    if (cpus.empty())
+        return false;
+    std::atomic<bool> pinned(true);
+    run_on_all([&](uint k) {
+        if (!pin_thread(cpus[k % cpus.size()]))
+            pinned = false;
+    });
+    return pinned;
+}
+
+template<typename F>
+void ThreadPool::parallel_for(uint begin, uint end, const F& f) {
+    if (end <= begin)
+        return;
+    TRACE_SCOPE("parallel_for");
+    const uint n = end - begin;
+    const uint threads = size();
+    run_on_all([&](uint k) {
+        uint lo = begin + (unsigned long)n * k / threads;
+        uint hi = begin + (unsigned long)n * (k+1) / threads;
+        if (lo < hi)
+            f(lo, hi);
+    });
+}
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef __TILE_SCHEDULER_H__
+#define __TILE_SCHEDULER_H__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.h"
+#include "trace.h"
+
+// Runs a sequence of units of work on every tile of a 2D tiling without a
+// barrier between units. Unit k of a tile may start once that tile and its
+// four neighbours have finished every unit before k, so a tile only ever
+// waits for the tiles next to it and distant tiles drift several units apart.
+//
+// Each worker owns a deque of ready tasks. Whatever a finished task makes
+// ready goes onto the finishing worker's deque, which it pops from the back,
+// so a tile tends to stay on one core while it runs ahead; a worker with an
+// empty deque steals from the front of another's.
+class TileScheduler {
+public:
+    TileScheduler(uint threads = 0);
+    ~TileScheduler();
+
+    // Calls f(worker, tile, unit) for every tile = x * tiles_y + y of the
+    // tiles_x by tiles_y tiling and every unit in [0, units), with worker in
+    // [0, size()). Blocks until all are done, the calling thread is worker 0.
+    template<typename F>
+    void run(uint tiles_x, uint tiles_y, uint units, const F& f);
+
+    uint size() const { return queues.size(); }
+
+    // Tasks a worker took from another's deque, over all runs
+    unsigned long get_steals() const { return steals; }
+
+private:
+    struct Task {
+        uint tile, unit;
+    };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<Queue*> queues;
+
+    std::mutex mutex;
+    std::condition_variable start_cv, done_cv, wake_cv;
+    std::function<void(uint, uint, uint)> job;
+    unsigned long generation = 0;
+    uint active = 0;
+    bool stopping = false;
+
+    // State of the current run: units finished and units queued of each tile
+    uint tiles_x = 0, tiles_y = 0, units = 0;
+    std::vector<std::atomic<uint> > done, queued;
+    std::atomic<unsigned long> remaining, pushed, steals;
+    std::atomic<uint> sleepers;
+
+    void work(uint k);
+    void execute(uint k);
+    bool pop(uint k, Task& task);
+    bool steal(uint k, Task& task);
+    void release(uint k, uint tile);
+};
+
+TileScheduler::TileScheduler(uint threads): remaining(0), pushed(0), steals(0), sleepers(0) {
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for (uint k = 0; k < threads; k++)
+        queues.push_back(new Queue());
+    for (uint k = 1; k < threads; k++)
+        workers.push_back(std::thread(&TileScheduler::work, this, k));
+}
+
+TileScheduler::~TileScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start_cv.notify_all();
+    for (uint k = 0; k < workers.size(); k++)
+        workers[k].join();
+    for (uint k = 0; k < queues.size(); k++)
+        delete queues[k];
+}
+
+void TileScheduler::work(uint k) {
+    TRACE_THREAD("tile worker " + std::to_string(k));
+    unsigned long seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start_cv.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+        execute(k);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--active == 0)
+                done_cv.notify_one();
+        }
+    }
+}
+
+void TileScheduler::execute(uint k) {
+    Task task;
+    while (remaining > 0) {
+        // Sampled before looking, a task queued meanwhile cancels the sleep below
+        const unsigned long seen = pushed;
+        if (pop(k, task) || steal(k, task)) {
+            job(k, task.tile, task.unit);
+            done[task.tile] = task.unit + 1;
+
+            // The tile itself and its neighbours may have been waiting on this unit
+            const uint x = task.tile / tiles_y, y = task.tile % tiles_y;
+            release(k, task.tile);
+            if (x > 0)         release(k, task.tile - tiles_y);
+            if (x+1 < tiles_x) release(k, task.tile + tiles_y);
+            if (y > 0)         release(k, task.tile - 1);
+            if (y+1 < tiles_y) release(k, task.tile + 1);
+
+            if (--remaining == 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                wake_cv.notify_all();
+            }
+            continue;
+        }
+
+        // Nothing ready anywhere, the tiles left are waiting on running ones
+        for (uint spin = 0; spin < 64 && pushed == seen && remaining > 0; spin++)
+            std::this_thread::yield();
+        std::unique_lock<std::mutex> lock(mutex);
+        sleepers++;
+        wake_cv.wait(lock, [&]() { return pushed != seen || remaining == 0; });
+        sleepers--;
+    }
+}
+
+bool TileScheduler::pop(uint k, Task& task) {
+    Queue& q = *queues[k];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty())
+        return false;
+    task = q.tasks.back();
+    q.tasks.pop_back();
+    return true;
+}
+
+bool TileScheduler::steal(uint k, Task& task) {
+    for (uint i = 1; i < queues.size(); i++) {
+        Queue& q = *queues[(k + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = q.tasks.front();
+            q.tasks.pop_front();
+            steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Queues the tile's next unit if its neighbours have caught up. The compare
+// and swap on the queued count makes sure only one worker queues it.
+void TileScheduler::release(uint k, uint tile) {
+    const uint unit = done[tile];
+    if (unit >= units)
+        return;
+    const uint x = tile / tiles_y, y = tile % tiles_y;
+    if ((x > 0 && done[tile - tiles_y] < unit) || (x+1 < tiles_x && done[tile + tiles_y] < unit) ||
+        (y > 0 && done[tile - 1] < unit) || (y+1 < tiles_y && done[tile + 1] < unit))
+        return;
+    uint expected = unit;
+    if (!queued[tile].compare_exchange_strong(expected, unit + 1))
+        return;
+
+    Queue& q = *queues[k];
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back({ tile, unit });
+    }
+    pushed++;
+    if (sleepers > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        wake_cv.notify_one();
+    }
+}
+
+template<typename F>
+void TileScheduler::run(uint tiles_x_, uint tiles_y_, uint units_, const F& f) {
+    const uint tiles = tiles_x_ * tiles_y_;
+    if (tiles == 0 || units_ == 0)
+        return;
+    TRACE_SCOPE("tile graph");
+
+    tiles_x = tiles_x_;
+    tiles_y = tiles_y_;
+    units = units_;
+    if (done.size() != tiles) {
+        std::vector<std::atomic<uint> >(tiles).swap(done);
+        std::vector<std::atomic<uint> >(tiles).swap(queued);
+    }
+
+    // Every tile's first unit is ready, dealt out in contiguous blocks so
+    // each worker starts on one patch of the domain
+    for (uint t = 0; t < tiles; t++) {
+        done[t] = 0;
+        queued[t] = 1;
+        queues[(unsigned long)t * size() / tiles]->tasks.push_back({ t, 0 });
+    }
+    remaining = (unsigned long)tiles * units;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = f;
+        active = workers.size();
+        generation++;
+    }
+    start_cv.notify_all();
+
+    execute(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&]() { return active == 0; });
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+// Timeline of the frame and solver pipeline, saved as Chrome trace JSON for
+// ui.perfetto.dev or chrome://tracing. Only compiled in with -DSWE_TRACE
+// (`make TRACE=1`); without it every macro expands to nothing, arguments
+// included, so the instrumented code is exactly the uninstrumented one.
+//
+//     TRACE_SCOPE("step");            // one slice from here to the end of the block
+//     TRACE_THREAD("pool worker 3");  // names the calling thread's track
+//     TRACE_SAVE("trace.json");       // everything recorded so far, any thread
+//
+// Names given to TRACE_SCOPE must outlive the trace, i.e. be string literals.
+#ifdef SWE_TRACE
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+// Events each thread can hold, the rest are counted and dropped
+#ifndef SWE_TRACE_EVENTS
+#define SWE_TRACE_EVENTS (1 << 18)
+#endif
+
+struct TraceEvent {
+    const char* name;
+    uint64_t begin, end; // ns since the first event of the process
+};
+
+// Written only by its own thread: an event is stored, then published by
+// bumping count, so TRACE_SAVE can read [0, count) while recording goes on
+struct TraceBuffer {
+    std::vector<TraceEvent> events;
+    std::atomic<size_t> count;
+    std::atomic<unsigned long> dropped;
+    std::string thread_name;
+    uint tid;
+};
+
+// Buffers are never freed, a thread's events outlive the thread
+static std::mutex trace_mutex;
+static std::vector<TraceBuffer*> trace_buffers;
+static thread_local TraceBuffer* trace_buffer = NULL;
+
+static uint64_t trace_now() {
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+static TraceBuffer* trace_thread_buffer() {
+    if (trace_buffer == NULL) {
+        TraceBuffer* buffer = new TraceBuffer();
+        buffer->events.resize(SWE_TRACE_EVENTS);
+        buffer->count = 0;
+        buffer->dropped = 0;
+
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        buffer->tid = trace_buffers.size() + 1;
+        buffer->thread_name = "thread " + std::to_string(buffer->tid);
+        trace_buffers.push_back(buffer);
+        trace_buffer = buffer;
+    }
+    return trace_buffer;
+}
+
+static void trace_record(const char* name, uint64_t begin, uint64_t end) {
+    TraceBuffer* buffer = trace_thread_buffer();
+    const size_t n = buffer->count.load(std::memory_order_relaxed);
+    if (n == buffer->events.size()) {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer->events[n].name = name;
+    buffer->events[n].begin = begin;
+    buffer->events[n].end = end;
+    buffer->count.store(n + 1, std::memory_order_release);
+}
+
+static void trace_thread_name(const std::string& name) {
+    TraceBuffer* buffer = trace_thread_buffer();
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    buffer->thread_name = name;
+}
+
+class TraceScope {
+public:
+    TraceScope(const char* name_): name(name_), begin(trace_now()) {}
+    ~TraceScope() { trace_record(name, begin, trace_now()); }
+
+private:
+    const char* name;
+    uint64_t begin;
+};
+
+static void trace_write_string(FILE* file, const char* s) {
+    fputc('"', file);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', file);
+        if ((unsigned char)*s >= 0x20)
+            fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+static bool trace_save(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR Failed to open trace file: %s!\n", path);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (uint b = 0; b < trace_buffers.size(); b++) {
+        const TraceBuffer& buffer = *trace_buffers[b];
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", buffer.tid);
+        trace_write_string(file, buffer.thread_name.c_str());
+        fprintf(file, "}}");
+        first = false;
+
+        // Complete events, timestamps in microseconds
+        const size_t n = buffer.count.load(std::memory_order_acquire);
+        for (size_t e = 0; e < n; e++) {
+            const TraceEvent& event = buffer.events[e];
+            fprintf(file, ",\n{\"name\":");
+            trace_write_string(file, event.name);
+            fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    buffer.tid, event.begin / 1000.0, (event.end - event.begin) / 1000.0);
+        }
+        if (buffer.dropped > 0)
+            fprintf(stderr, "Trace buffer of %s was full, %lu events dropped\n", buffer.thread_name.c_str(), buffer.dropped.load());
+    }
+    fprintf(file, "\n]}\n");
+
+    const bool ok = !ferror(file);
+    fclose(file);
+    if (!ok)
+        fprintf(stderr, "ERROR Failed to write trace file: %s!\n", path);
+    return ok;
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_THREAD(name) trace_thread_name(name)
+#define TRACE_SAVE(path) trace_save(path)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_THREAD(name) ((void)0)
+#define TRACE_SAVE(path) ((void)0)
+
+#endif
+
+#endif
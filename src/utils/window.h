@@ -8,13 +8,19 @@
 #include "types.h"
 #include "color.h"
 #include "input.h"
+#include "trace.h"
+#include "opengl/framebuffer.h"
 
 class Window {
 public:
-    Window(const char* title, uint w, uint h, Color bg_col = Color(0), uint v_sync = 1) {
+    // An offscreen window is never shown, every frame is drawn into a w x h
+    // Framebuffer instead, so the size isn't limited by the screen
+    Window(const char* title, uint w, uint h, Color bg_col = Color(0), uint v_sync = 1, bool offscreen = false) {
         col = bg_col;
 
-        window = glfwCreateWindow(w, h, title, NULL, NULL);
+        if (offscreen)
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        window = glfwCreateWindow(offscreen ? 64 : w, offscreen ? 64 : h, title, NULL, NULL);
         if (!window) {
             std::cerr << "Failed to create window!" << std::endl;
             glfwTerminate();
@@ -23,7 +29,15 @@ public:
 
         glfwMakeContextCurrent(window);
 
-        glfwSwapInterval(v_sync);
+        if (offscreen) {
+            framebuffer = new Framebuffer(w, h);
+            if (!framebuffer->is_complete()) {
+                glfwTerminate();
+                exit(1);
+            }
+        }
+
+        glfwSwapInterval(offscreen ? 0 : v_sync);
         glEnable(GL_DEPTH_TEST);
         glDepthFunc(GL_LESS);
         glDisable(GL_CULL_FACE);
@@ -39,6 +53,8 @@ public:
         int frames = 0;
         double last_time = glfwGetTime();
         while (!should_close()) {
+            TRACE_SCOPE("frame");
+
             // Measure FPS
             double cur_time = glfwGetTime();
             frames++;
@@ -48,20 +64,36 @@ public:
                 last_time += 1.0;
             }
 
-            glClearColor(col.r, col.g, col.b, col.a);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-            step();
-
-            Input::update();
-
-            // Get error
-            GLenum err = glGetError();
-            if (err != GL_NO_ERROR)
-                std::cerr << "GL Error: " << err << std::endl;
-
-            glfwSwapBuffers(window);
-            glfwPollEvents();
+            {
+                TRACE_SCOPE("clear");
+                if (framebuffer != NULL)
+                    framebuffer->bind();
+                glClearColor(col.r, col.g, col.b, col.a);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            }
+            {
+                TRACE_SCOPE("step callback");
+                step();
+            }
+            {
+                TRACE_SCOPE("Input::update");
+                Input::update();
+            }
+            {
+                // Get error, waits for the GPU to catch up with everything queued so far
+                TRACE_SCOPE("glGetError");
+                GLenum err = glGetError();
+                if (err != GL_NO_ERROR)
+                    std::cerr << "GL Error: " << err << std::endl;
+            }
+            {
+                TRACE_SCOPE("swap");
+                glfwSwapBuffers(window);
+            }
+            {
+                TRACE_SCOPE("poll events");
+                glfwPollEvents();
+            }
         }
     }
 
@@ -73,8 +105,20 @@ public:
         return glfwWindowShouldClose(window);
     }
 
+    // Ends loop() after the current frame, the only way out of an offscreen loop
+    void close() {
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
+    }
+
+    // The offscreen target, NULL for a visible window
+    Framebuffer* get_framebuffer() { return framebuffer; }
+
+    // Usually runs after glfwTerminate, the framebuffer's GL objects went with the context
+    ~Window() { delete framebuffer; }
+
 private:
     GLFWwindow* window;
+    Framebuffer* framebuffer = NULL;
     Color col;
 };
 
@@ -0,0 +1,209 @@
+#define GL_SILENCE_DEPRECATION
+#define GLFW_INCLUDE_GLCOREARB
+
+#include <GLFW/glfw3.h>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <leon/vector.h>
+#include <leon/transform.h>
+#include <leon/camera.h>
+#include <leon/io_utils.h>
+#include "utils/opengl/init.h"
+#include "utils/opengl/shader.h"
+#include "utils/opengl/model.h"
+#include "utils/opengl/obj_loader.h"
+#include "utils/opengl/uniform_buffer.h"
+#include "utils/window.h"
+#include "utils/key.h"
+#include "utils/input.h"
+#include "shallow_water_model.h"
+#include "frame_ring.h"
+
+static const uint WIDTH = 1680, HEIGHT = 945;
+static const uint GRID = 75, MAX_LAYERS = 4;
+
+struct ViewerShaders {
+    Shader* lit_displacement;
+    Shader* unlit_displacement;
+    Shader* ocean;
+};
+
+static void load_floor(const FrameSubscriber& ring, Field<GRID,GRID,float>& h_B) {
+    memcpy(h_B.get_data(), ring.get_floor(), GRID * GRID * sizeof(float));
+}
+
+// Draws whatever the ring last published until the window closes. When the
+// run finishes the last frame stays up and the viewer waits for the next run
+// under the same name.
+template<uint L>
+static int view(FrameSubscriber& ring, const char* name, Window& window, ViewerShaders& shaders, uint width, uint height) {
+    Scenario s;
+    s.layers = L;
+    s.dt = ring.get_dt();
+    s.h0 = ring.get_h0();
+    s.hM = ring.get_hM();
+    const double h_B = s.h0;
+    const double h_M = s.hM;
+
+    // Ground, then one per layer from the top
+    Shader* surface_shaders[L+1];
+    surface_shaders[0] = shaders.unlit_displacement;
+    for (uint i = 0; i < L; i++)
+        surface_shaders[i+1] = (i == 0 ? shaders.ocean : shaders.lit_displacement);
+    ShallowWaterModel<GRID,GRID,L> swm(s, surface_shaders);
+
+    Field<GRID,GRID,float> floor;
+    load_floor(ring, floor);
+    swm.set_bathymetry(floor);
+
+    Camera cam(perspective(70.0f, (float)width/height, 0.1f, 1000.0f), Transform(Vecf(0, -h_B, -3)), Vecf(0, -h_B, 0));
+
+    UniformBuffer<FrameUniforms> frame_buffer(FRAME_BLOCK_BINDING);
+    FrameUniforms frame;
+    frame.set_proj(cam.get_proj_mat());
+    frame.set_light_direction(Vecf(0, 1, -10).norm());
+    frame.set_light_ambient(Vecf(1.0, 1.0, 1.0));
+    frame.set_light_diffuse(Vecf(1.0, 1.0, 1.0));
+    frame.set_light_specular(Vecf(1.0, 0.9, 0.7));
+
+    shaders.lit_displacement->set_uniform("color", Vec(0.00, 0.28, 0.73, 1.0));
+    shaders.lit_displacement->set_uniform("ambientLight", 0.3f);
+    shaders.ocean->set_uniform("heightMax", h_B+h_M/3);
+    shaders.ocean->set_uniform("heightMin", h_B-h_M/20);
+
+    std::vector<float> heights((size_t)L * GRID * GRID);
+    uint64_t step = 0;
+    bool wireframe = false;
+    bool frozen = false;
+    bool finished = false;
+    double last_attach = 0, last_check = 0;
+    int status = 0;
+
+    window.set_bg_color(Color(0.49, 0.73, 0.91));
+    window.loop([&]() -> void {
+        Vec2 dv = Input::get_mouse_change();
+
+        if (Input::get_mouse(Input::LEFT_MOUSE_BUTTON)) {
+            cam.get_transform().translate(0, h_B, 0);
+            cam.get_transform().rotate(dv[1]/100.0, dv[0]/100.0, 0);
+            cam.get_transform().translate(0, -h_B, 0);
+        }
+        else if (Input::get_mouse(Input::MIDDLE_MOUSE_BUTTON)) {
+            cam.get_transform().translate(dv[0]/200.0, -dv[1]/200.0, 0);
+        }
+        else if (Input::get_mouse(Input::RIGHT_MOUSE_BUTTON)) {
+            cam.get_transform().translate(0, 0, -dv[1]/100.0);
+        }
+
+        if (Input::get_key_down(Key::W)) {
+            wireframe = !wireframe;
+            glPolygonMode(GL_FRONT_AND_BACK, wireframe ? GL_LINE : GL_FILL);
+        }
+        // Holds the current frame, the run carries on regardless
+        if (Input::get_key_down(Key::P))
+            frozen = !frozen;
+
+        // A crashed run never closes the ring, so once a second also check
+        // whether the name moved on to the next one
+        if (ring.is_attached() && !ring.is_closed() && glfwGetTime() - last_check >= 1.0) {
+            last_check = glfwGetTime();
+            if (ring.is_replaced(name))
+                ring.detach();
+        }
+
+        // Once a second look for the next run under the same name
+        if (!ring.is_attached() || ring.is_closed()) {
+            if (!finished) {
+                std::cout << "Run finished at step " << step << ", waiting for the next one on " << name << std::endl;
+                finished = true;
+            }
+            if (glfwGetTime() - last_attach >= 1.0) {
+                last_attach = glfwGetTime();
+                if (ring.attach(name) && !ring.is_closed()) {
+                    if (ring.get_n() != GRID || ring.get_m() != GRID || ring.get_layers() != L) {
+                        std::cerr << "The new run on " << name << " has a different grid or layer count, restart the viewer" << std::endl;
+                        status = 1;
+                        window.close();
+                        return;
+                    }
+                    load_floor(ring, floor);
+                    swm.set_bathymetry(floor);
+                    finished = false;
+                    std::cout << "Attached to the next run on " << name << std::endl;
+                }
+            }
+        }
+
+        if (!frozen && ring.is_attached() && ring.read_latest(heights.data(), step)) {
+            for (uint i = 0; i < L; i++)
+                swm.show_surface(i, heights.data() + (size_t)i * GRID * GRID);
+        }
+
+        frame.set_view(*cam.get_transform());
+        frame.set_view_pos(cam.get_transform().get_pos());
+        frame_buffer.update(frame);
+
+        swm.render();
+    });
+
+    frame_buffer.remove();
+    return status;
+}
+
+// Usage: viewer [/swe] [-s 1920x1080]
+//
+// Shows a run that publishes into the shared memory ring `name` (the
+// scenario key `publish`, /swe.j for job j of a sweep). Waits for the run if
+// it hasn't started yet; closing the viewer leaves the run alone.
+int main(int argc, char** argv) {
+    const char* name = "/swe";
+    uint width = WIDTH, height = HEIGHT;
+    int a = 1;
+    if (argc > 1 && argv[1][0] != '-') {
+        name = argv[1];
+        a = 2;
+    }
+    for (; a + 1 < argc; a++) {
+        if (strcmp(argv[a], "-s") == 0 && sscanf(argv[++a], "%ux%u", &width, &height) != 2) {
+            std::cerr << "Size must look like 1920x1080" << std::endl;
+            return 1;
+        }
+    }
+
+    FrameSubscriber ring;
+    if (!ring.attach(name)) {
+        std::cout << "Waiting for a run on " << name << std::endl;
+        while (!ring.attach(name))
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+    if (ring.get_n() != GRID || ring.get_m() != GRID || ring.get_layers() < 1 || ring.get_layers() > MAX_LAYERS) {
+        std::cerr << "The viewer is built for a " << GRID << "x" << GRID << " grid with 1 to " << MAX_LAYERS << " layers" << std::endl;
+        return 1;
+    }
+
+    if (!initGLFW(3, 2, 1, true, false))
+        return 1;
+
+    Window window(name, width, height, Color(0), 1, false);
+
+    Shader lit_displacement_shader(load_file_as_string("res/displacement_lit.vert"), load_file_as_string("res/lit.frag"));
+    Shader unlit_displacement_shader(load_file_as_string("res/displacement.vert"), load_file_as_string("res/default.frag"));
+    Shader ocean_shader(load_file_as_string("res/ocean.vert"), load_file_as_string("res/ocean.frag"));
+    ViewerShaders shaders = { &lit_displacement_shader, &unlit_displacement_shader, &ocean_shader };
+
+    int status = 0;
+    switch (ring.get_layers()) {
+        case 1: status = view<1>(ring, name, window, shaders, width, height); break;
+        case 2: status = view<2>(ring, name, window, shaders, width, height); break;
+        case 3: status = view<3>(ring, name, window, shaders, width, height); break;
+        default: status = view<MAX_LAYERS>(ring, name, window, shaders, width, height); break;
+    }
+
+    glfwTerminate();
+    return status;
+}